@@ -0,0 +1,279 @@
+#define _GNU_SOURCE   //for mallinfo2()
+
+#include "int-set.h"
+#include "intersect.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/** Benchmark of int-set operations over sets of increasing size.  For
+ *  each size n, A is the set of the n multiples of 2 from 0 and B that
+ *  of the n multiples of 3 from 0, so they overlap in a third of A.
+ *  Times are the best of N_RUNS and are printed in ns per element of
+ *  A for:
+ *
+ *    add:      adding A's elements in random order by addIntSet()
+ *              (only for n <= MAX_RANDOM_ADD, as each add may move
+ *              all the elements after it)
+ *    bulk:     adding A's elements in the same order by one
+ *              addMultipleIntSet()
+ *    isIn:     n isInIntSet() lookups of random ints in [0, 2n),
+ *              half of which are in A
+ *    iterate:  iterating over A
+ *    union:    unionIntSet(A, B)
+ *    inter:    intersectionIntSet(A, B)
+ *    count:    intersectionSizeIntSet(A, B)
+ *    union/S:  unionIntSet(A, S), where S is the set of the n/SKEW
+ *              multiples of 3*SKEW from 0 (at least 1)
+ *    inter/S:  intersectionIntSet(A, S)
+ *
+ *  followed by the bytes allocated for A per element.
+ *
+ *  Usage: int-set-bench [-b] [-k KERNEL] [N...]; -b benchmarks sets of
+ *  kind INT_SET_BITMAP instead of INT_SET_ARRAY and -k KERNEL limits
+ *  intersection to kernel scalar, sse4.1 or avx2 (default: the best
+ *  the CPU supports); sizes default to powers of 10 from 1e3 to 1e7.
+ */
+
+enum {
+  N_RUNS = 3,                //best of
+  MAX_RANDOM_ADD = 100000,
+  SKEW = 1000,
+};
+
+static IntSetKind kind = INT_SET_ARRAY;
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/** Return # of bytes allocated by malloc() and not freed */
+static size_t
+bytesInUse(void)
+{
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;    //hblkhd: large blocks mmap'ed
+}
+
+static void *
+checkedNewIntSet(void)
+{
+  void *set = newIntSetOfKind(kind);
+  if (set == NULL) {
+    fprintf(stderr, "cannot create set: %s\n", strerror(errno));
+    exit(1);
+  }
+  return set;
+}
+
+static void
+checkedAdd(void *set, int element)
+{
+  if (addIntSet(set, element) < 0) {
+    fprintf(stderr, "cannot add %d: %s\n", element, strerror(errno));
+    exit(1);
+  }
+}
+
+/** Return new set of the n multiples of k from 0, added in order */
+static void *
+multiples(int n, int k)
+{
+  void *set = checkedNewIntSet();
+  for (int i = 0; i < n; i++) checkedAdd(set, k*i);
+  return set;
+}
+
+/** Return a random int in [0, n) */
+static int
+randInt(int n)
+{
+  return (int)(((unsigned long long)rand() * RAND_MAX + rand()) % n);
+}
+
+static void
+check(int got, int expected, const char *what, int n)
+{
+  if (got != expected) {
+    fprintf(stderr, "%s for n = %d gave %d instead of %d\n",
+            what, n, got, expected);
+    exit(1);
+  }
+}
+
+/** Time each operation over sets of size n and print a line of their
+ *  best ns per element.
+ */
+static void
+bench(int n)
+{
+  int *order = malloc(n * sizeof(int));
+  int *probes = malloc(n * sizeof(int));
+  if (order == NULL || probes == NULL) {
+    fprintf(stderr, "cannot allocate %d ints\n", n);
+    exit(1);
+  }
+  for (int i = 0; i < n; i++) order[i] = 2*i;
+  for (int i = n - 1; i > 0; i--) {
+    int j = randInt(i + 1);
+    int t = order[i]; order[i] = order[j]; order[j] = t;
+  }
+  for (int i = 0; i < n; i++) probes[i] = randInt(2*n);
+  const int nInter = (n + 2)/3;       //multiples of 6 in A
+  const int nUnion = 2*n - nInter;
+  const int nSkew = n/SKEW > 0 ? n/SKEW : 1;
+  int nInterSkew = 0;                 //elements of S, all even, below 2n
+  for (int i = 0; i < nSkew; i++) nInterSkew += 3*SKEW*i < 2*n;
+
+  enum {
+    ADD, BULK, IS_IN, ITERATE, UNION, INTER, COUNT, UNION_S, INTER_S, N_OPS
+  };
+  double best[N_OPS];
+  size_t bytes = 0;
+  for (int op = 0; op < N_OPS; op++) best[op] = 1e300;
+  for (int run = 0; run < N_RUNS; run++) {
+    double t[N_OPS] = { 0 };
+    if (n <= MAX_RANDOM_ADD) {
+      void *set = checkedNewIntSet();
+      double t0 = now();
+      for (int i = 0; i < n; i++) checkedAdd(set, order[i]);
+      t[ADD] = now() - t0;
+      check(nElementsIntSet(set), n, "add", n);
+      freeIntSet(set);
+    }
+    void *set = checkedNewIntSet();
+    double t0 = now();
+    int nBulk = addMultipleIntSet(set, order, n);
+    t[BULK] = now() - t0;
+    check(nBulk, n, "bulk add", n);
+    freeIntSet(set);
+
+    size_t inUse = bytesInUse();
+    void *a = multiples(n, 2);
+    bytes = bytesInUse() - inUse;
+    t0 = now();
+    int nFound = 0;
+    for (int i = 0; i < n; i++) nFound += isInIntSet(a, probes[i]);
+    t[IS_IN] = now() - t0;
+    int nEven = 0;
+    for (int i = 0; i < n; i++) nEven += probes[i] % 2 == 0;
+    check(nFound, nEven, "isIn", n);
+
+    t0 = now();
+    long long sum = 0;
+    int nIter = 0;
+    for (const void *iter = newIntSetIterator(a); iter != NULL;
+         iter = stepIntSetIterator(iter)) {
+      sum += intSetIteratorElement(iter);
+      nIter++;
+    }
+    t[ITERATE] = now() - t0;
+    check(nIter, n, "iterate", n);
+    if (sum != (long long)n * (n - 1)) {
+      fprintf(stderr, "iterate for n = %d gave wrong elements\n", n);
+      exit(1);
+    }
+
+    void *b = multiples(n, 3);
+    t0 = now();
+    int nC = intersectionSizeIntSet(a, b);
+    t[COUNT] = now() - t0;
+    check(nC, nInter, "intersection size", n);
+
+    t0 = now();
+    int nU = unionIntSet(a, b);
+    t[UNION] = now() - t0;
+    check(nU, nUnion, "union", n);
+    freeIntSet(a);
+
+    a = multiples(n, 2);
+    t0 = now();
+    int nI = intersectionIntSet(a, b);
+    t[INTER] = now() - t0;
+    check(nI, nInter, "intersection", n);
+    freeIntSet(a);
+    freeIntSet(b);
+
+    void *skewed = multiples(nSkew, 3*SKEW);
+    a = multiples(n, 2);
+    t0 = now();
+    nU = unionIntSet(a, skewed);
+    t[UNION_S] = now() - t0;
+    check(nU, n + nSkew - nInterSkew, "skewed union", n);
+    freeIntSet(a);
+
+    a = multiples(n, 2);
+    t0 = now();
+    nI = intersectionIntSet(a, skewed);
+    t[INTER_S] = now() - t0;
+    check(nI, nInterSkew, "skewed intersection", n);
+    freeIntSet(a);
+    freeIntSet(skewed);
+
+    for (int op = 0; op < N_OPS; op++) {
+      if (t[op] < best[op]) best[op] = t[op];
+    }
+  }
+  printf("%9d", n);
+  for (int op = 0; op < N_OPS; op++) {
+    if (op == ADD && n > MAX_RANDOM_ADD) {
+      printf(" %9s", "-");
+    }
+    else {
+      printf(" %9.2f", best[op] * 1e9 / n);
+    }
+  }
+  printf(" %9.2f\n", (double)bytes / n);
+  free(order);
+  free(probes);
+}
+
+int
+main(int argc, const char *argv[])
+{
+  const char *kernels[] = { "scalar", "sse4.1", "avx2" };
+  IntersectKernel kernel = INTERSECT_AVX2;
+  int i = 1;
+  if (i < argc && strcmp(argv[i], "-b") == 0) {
+    kind = INT_SET_BITMAP;
+    i++;
+  }
+  if (i + 1 < argc && strcmp(argv[i], "-k") == 0) {
+    int k = INTERSECT_SCALAR;
+    while (k <= INTERSECT_AVX2 && strcmp(argv[i + 1], kernels[k]) != 0) k++;
+    if (k > INTERSECT_AVX2) {
+      fprintf(stderr, "unknown kernel %s\n", argv[i + 1]);
+      exit(1);
+    }
+    kernel = k;
+    i += 2;
+  }
+  kernel = useIntersectKernel(kernel);
+  srand(1);
+  printf("intersection kernel %s\n", kernels[kernel]);
+  printf("%9s %9s %9s %9s %9s %9s %9s %9s %9s %9s %9s\n",
+         "n", "add", "bulk", "isIn", "iterate", "union", "inter", "count",
+         "union/S", "inter/S", "bytes");
+  if (i < argc) {
+    for (; i < argc; i++) {
+      int n = atoi(argv[i]);
+      if (n < 1) {
+        fprintf(stderr, "usage: %s [-b] [-k KERNEL] [N...]\n", argv[0]);
+        exit(1);
+      }
+      bench(n);
+    }
+  }
+  else {
+    for (int n = 1000; n <= 10000000; n *= 10) bench(n);
+  }
+  return 0;
+}
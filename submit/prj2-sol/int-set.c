@@ -1,59 +1,153 @@
+#include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 #include "int-set.h"
+#include "intersect.h"
+#include "roaring.h"
 
 /** Abstract data type for set of int's.  Note that sets do not allow
  *  duplicates.
+ *
+ *  The elements are kept in increasing order in elements[len], so
+ *  membership is a binary search.  elements[] always has room for one
+ *  more int past the last element; it holds a copy of the last element,
+ *  so an iterator (a pointer into elements[]) is at the end of the set
+ *  exactly when the next int is not greater than the current one.
+ *
+ *  Sets of kind INT_SET_BITMAP hold their elements in a Roaring
+ *  bitmap instead; their iterators point into the same layout of
+ *  array, which the bitmap builds when asked for it.
  */
-typedef struct NodeStruct {
-    int val;
-    struct NodeStruct* next;
-} Node;
-
 typedef struct {
+    IntSetKind kind;
     int len;
-    Node dummy;
+    int size;       // # of ints allocated for elements, > len
+    int* elements;
+    Roaring* bitmap;    // INT_SET_BITMAP only, other fields unused
 } IntSet;
 
+enum {
+    INIT_SIZE = 8,
+    GALLOP_RATIO = 16,  // gallop through sets this many times larger
+    RADIX_MIN = 64,     // insertion sort fewer elements than this
+};
+
+/** Ensure set has room for n elements.  Returns < 0 on error with
+ *  errno set.
+ */
+static int
+reserveIntSet(IntSet* set, int n) {
+    if (n < set->size) return 0;
+    int size = set->size < INIT_SIZE ? INIT_SIZE : set->size;
+    while (size <= n && size < INT_MAX) {
+        size = (size <= INT_MAX/2) ? 2*size : INT_MAX;
+    }
+    if (size <= n) {
+        errno = ENOMEM;
+        return -1;
+    }
+    int* elements = realloc(set->elements, size*sizeof(int));
+    if (elements == NULL) return -1;
+    set->elements = elements;
+    set->size = size;
+    return 0;
+}
+
+/** Copy the last element of set past its end for its iterators */
+static void
+setEndIntSet(IntSet* set) {
+    if (set->len > 0) set->elements[set->len] = set->elements[set->len - 1];
+}
+
+/** Return index of first of a[lo..hi) which is >= element, hi if none */
+static int
+lowerBound(const int* a, int lo, int hi, int element) {
+    while (lo < hi) {
+        int mid = lo + (hi - lo)/2;
+        if (a[mid] < element) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
 
-static Node*
-linkNewNode(Node* p0, int val) {
-    Node *p = malloc(sizeof(Node));
-    if (p == NULL) return NULL;
-    p->val = val;
-    p->next = p0->next;
-    p0->next = p;
-    return p;
+/** Return index of first of the sorted a[lo..n) which is >= element,
+ *  n if none.  Gallops up from lo in steps of 1, 2, 4, ... and then
+ *  searches the last step, so takes O(log d) for an index d past lo.
+ */
+static int
+gallopUp(const int* a, int lo, int n, int element) {
+    int hi = lo;
+    for (long step = 1; hi < n && a[hi] < element; step *= 2) {
+        lo = hi + 1;
+        hi = step < n - hi ? hi + step : n;
+    }
+    return lowerBound(a, lo, hi, element);
 }
 
-static Node*
-unlinkNode(IntSet* set, Node* p0) {
-    Node* p = p0->next;
-    p0->next = p->next;
-    free(p);
-    set->len -= 1;
-    return p0->next;
+/** Return index of first of the sorted a[0..hi) which is > element,
+ *  hi if none, galloping down from hi like gallopUp().
+ */
+static int
+gallopDown(const int* a, int hi, int element) {
+    int lo = hi;
+    for (long step = 1; lo > 0 && a[lo - 1] > element; step *= 2) {
+        hi = lo - 1;
+        lo = step < lo ? lo - step : 0;
+    }
+    // lower bound of element + 1, without overflowing
+    while (lo < hi) {
+        int mid = lo + (hi - lo)/2;
+        if (a[mid] <= element) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
 }
 
 /** Return a new empty int-set.  Returns NULL on error with errno set.
  */
 void *newIntSet() {
-    return calloc(1, sizeof(IntSet));
+    return newIntSetOfKind(INT_SET_ARRAY);
+}
+
+/** Return a new empty int-set using representation kind; newIntSet()
+ *  is newIntSetOfKind(INT_SET_ARRAY).  All int-set functions accept
+ *  sets of either kind, and a set keeps its kind when it is changed.
+ *  Returns NULL on error with errno set.
+ */
+void *newIntSetOfKind(IntSetKind kind) {
+    IntSet* set = calloc(1, sizeof(IntSet));
+    if (set == NULL) return NULL;
+    set->kind = kind;
+    int ret = (kind == INT_SET_BITMAP)
+        ? ((set->bitmap = newRoaring()) == NULL ? -1 : 0)
+        : reserveIntSet(set, 0);
+    if (ret < 0) {
+        free(set);
+        return NULL;
+    }
+    return set;
 }
 
 /** Return # of elements in intSet */
 int nElementsIntSet(void *intSet) {
-    return ((IntSet*)intSet)->len;
+    IntSet* set = (IntSet*)intSet;
+    return set->kind == INT_SET_BITMAP ? nElementsRoaring(set->bitmap)
+                                       : set->len;
 }
 
 /** Return non-zero iff intSet contains element. */
 int isInIntSet(void *intSet, int element) {
     IntSet* set = (IntSet*)intSet;
-    for (Node* p = set->dummy.next; p != NULL; p = p->next) {
-        if (p->val == element) {
-            return 1;
-        }
-    }
-    return 0;
+    if (set->kind == INT_SET_BITMAP) return isInRoaring(set->bitmap, element);
+    int i = lowerBound(set->elements, 0, set->len, element);
+    return i < set->len && set->elements[i] == element;
 }
 
 /** Change intSet by adding element to it.  Returns # of elements
@@ -61,28 +155,282 @@ int isInIntSet(void *intSet, int element) {
  *  set.
  */
 int addIntSet(void *intSet, int element) {
-    if (isInIntSet(intSet, element)) return nElementsIntSet(intSet);
-
     IntSet* set = (IntSet*)intSet;
+    if (set->kind == INT_SET_BITMAP) return addRoaring(set->bitmap, element);
+    int i = lowerBound(set->elements, 0, set->len, element);
+    if (i < set->len && set->elements[i] == element) return set->len;
+
+    if (reserveIntSet(set, set->len + 1) < 0) return -1;
+    memmove(&set->elements[i + 1], &set->elements[i],
+            (set->len - i)*sizeof(int));
+    set->elements[i] = element;
+    set->len++;
+    setEndIntSet(set);
+    return set->len;
+}
+
+/** Return the elements of set in increasing order and set *nP to
+ *  their #.  Returns NULL on error.
+ */
+static const int*
+elementsIntSet(IntSet* set, int* nP) {
+    if (set->kind == INT_SET_BITMAP) {
+        *nP = nElementsRoaring(set->bitmap);
+        return elementsRoaring(set->bitmap);
+    }
+    *nP = set->len;
+    return set->elements;
+}
 
-    Node* p0;
-    for (p0 = &set->dummy; p0->next != NULL && p0->next->val <= element; p0 = p0->next) 
-    {}
+/** Return a new bitmap of the sorted elements[n], NULL on error */
+static Roaring*
+roaringOfElements(const int* elements, int n) {
+    Roaring* bitmap = newRoaring();
+    if (bitmap == NULL) return NULL;
+    for (int i = 0; i < n; i++) {
+        if (addRoaring(bitmap, elements[i]) < 0) {
+            freeRoaring(bitmap);
+            return NULL;
+        }
+    }
+    return bitmap;
+}
+
+/** Set array set setA to the union of it and the sorted b[nB] if
+ *  isUnion, else to their symmetric difference.
+ */
+static int
+mergeElements(IntSet* setA, const int* b, int nB, int isUnion) {
+    if (setA->len > INT_MAX - nB) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (reserveIntSet(setA, setA->len + nB) < 0) return -1;
+
+    // merge from the back, so no element of A is overwritten before
+    // it is merged; this leaves the result at the end of elements[]
+    int* a = setA->elements;
+    int iA = setA->len, iB = nB, out = setA->len + nB;
+    if (nB > setA->len/GALLOP_RATIO) {
+        while (iB > 0) {
+            if (iA > 0 && a[iA - 1] > b[iB - 1]) {
+                a[--out] = a[--iA];
+            } else if (iA > 0 && a[iA - 1] == b[iB - 1]) {
+                iA--;
+                iB--;
+                if (isUnion) a[--out] = b[iB];
+            } else {
+                a[--out] = b[--iB];
+            }
+        }
+    } else {
+        // few elements of B: move the elements of A between them as blocks
+        while (iB > 0) {
+            int lo = gallopDown(a, iA, b[iB - 1]);
+            out -= iA - lo;
+            memmove(&a[out], &a[lo], (iA - lo)*sizeof(int));
+            iA = lo;
+            if (iA > 0 && a[iA - 1] == b[iB - 1]) {
+                iA--;
+                iB--;
+                if (isUnion) a[--out] = b[iB];
+            } else {
+                a[--out] = b[--iB];
+            }
+        }
+    }
+    // the rest of A is still in place, just before the merged tail
+    int nMerged = setA->len + nB - out;
+    memmove(&a[iA], &a[out], nMerged*sizeof(int));
+    setA->len = iA + nMerged;
+    setEndIntSet(setA);
+    return setA->len;
+}
+
+/** Set array set setA to the intersection of it and the sorted b[nB]. */
+static int
+intersectionElements(IntSet* setA, const int* b, int nB) {
+    int* a = setA->elements;
+    int nA = setA->len;
+    int iA = 0, iB = 0, out = 0;
+
+    // when one set is much smaller, gallop through the other for each
+    // of its elements instead of stepping through all of the other
+    if (nB < nA/GALLOP_RATIO) {
+        for (; iB < nB; iB++) {
+            iA = gallopUp(a, iA, nA, b[iB]);
+            if (iA == nA) break;
+            if (a[iA] == b[iB]) a[out++] = a[iA++];
+        }
+    } else if (nA < nB/GALLOP_RATIO) {
+        for (; iA < nA; iA++) {
+            iB = gallopUp(b, iB, nB, a[iA]);
+            if (iB == nB) break;
+            if (b[iB] == a[iA]) a[out++] = a[iA];
+        }
+    } else {
+        out = intersectSorted(a, nA, b, nB, a);
+    }
+
+    setA->len = out;
+    setEndIntSet(setA);
+    return setA->len;
+}
 
-    if (!linkNewNode(p0, element)) return -1;
+/** Set array set setA to its elements which are not in the sorted
+ *  b[nB].
+ */
+static int
+differenceElements(IntSet* setA, const int* b, int nB) {
+    int* a = setA->elements;
+    int nA = setA->len;
+    int iA = 0, iB = 0, out = 0;
+
+    if (nB < nA/GALLOP_RATIO) {
+        // few elements of B: move the elements of A between them as blocks
+        for (; iB < nB && iA < nA; iB++) {
+            int hi = gallopUp(a, iA, nA, b[iB]);
+            memmove(&a[out], &a[iA], (hi - iA)*sizeof(int));
+            out += hi - iA;
+            iA = (hi < nA && a[hi] == b[iB]) ? hi + 1 : hi;
+        }
+        memmove(&a[out], &a[iA], (nA - iA)*sizeof(int));
+        out += nA - iA;
+    } else if (nA < nB/GALLOP_RATIO) {
+        for (; iA < nA; iA++) {
+            iB = gallopUp(b, iB, nB, a[iA]);
+            if (iB == nB || b[iB] != a[iA]) a[out++] = a[iA];
+        }
+    } else {
+        for (; iA < nA; iA++) {
+            while (iB < nB && b[iB] < a[iA]) iB++;
+            if (iB == nB || b[iB] != a[iA]) a[out++] = a[iA];
+        }
+    }
+
+    setA->len = out;
+    setEndIntSet(setA);
+    return setA->len;
+}
+
+/** Return # of elements common to the sorted a[nA] and b[nB] */
+static int
+countCommon(const int* a, int nA, const int* b, int nB) {
+    if (nA < nB) {
+        const int* t = a; a = b; b = t;
+        int n = nA; nA = nB; nB = n;
+    }
+    if (nB >= nA/GALLOP_RATIO) return countIntersectSorted(a, nA, b, nB);
+    int n = 0;
+    for (int iA = 0, iB = 0; iB < nB; iB++) {
+        iA = gallopUp(a, iA, nA, b[iB]);
+        if (iA == nA) break;
+        n += a[iA] == b[iB];
+    }
+    return n;
+}
 
-    return ++set->len;
+/** Apply union or intersection op to setA and setB, where setA is a
+ *  bitmap and setB is not, over a bitmap copy of setB.
+ */
+static int
+bitmapOp(int (*op)(Roaring*, const Roaring*), IntSet* setA, IntSet* setB) {
+    Roaring* bitmapB = roaringOfElements(setB->elements, setB->len);
+    if (bitmapB == NULL) return -1;
+    int ret = op(setA->bitmap, bitmapB);
+    freeRoaring(bitmapB);
+    return ret;
+}
+
+/** Sort a[n] by insertion */
+static void
+insertionSort(int* a, int n) {
+    for (int i = 1; i < n; i++) {
+        int v = a[i];
+        int j = i;
+        for (; j > 0 && a[j - 1] > v; j--) a[j] = a[j - 1];
+        a[j] = v;
+    }
+}
+
+/** Sort a[n] using tmp[n] as scratch space, by an LSD radix sort on
+ *  the bytes of the elements with their sign bits flipped, so that
+ *  negative elements come first.  The counts of all 4 bytes are taken
+ *  in one pass, and passes over a byte which all elements share are
+ *  skipped.
+ */
+static void
+radixSort(int* a, int* tmp, int n) {
+    int counts[4][256] = {{ 0 }};
+    for (int i = 0; i < n; i++) {
+        unsigned key = (unsigned)a[i] ^ 0x80000000u;
+        for (int d = 0; d < 4; d++) counts[d][(key >> 8*d) & 0xff]++;
+    }
+    int* src = a;
+    int* dst = tmp;
+    for (int d = 0; d < 4; d++) {
+        unsigned first = (((unsigned)a[0] ^ 0x80000000u) >> 8*d) & 0xff;
+        if (counts[d][first] == n) continue;
+        int offsets[256];
+        for (int b = 0, sum = 0; b < 256; b++) {
+            offsets[b] = sum;
+            sum += counts[d][b];
+        }
+        for (int i = 0; i < n; i++) {
+            unsigned key = (unsigned)src[i] ^ 0x80000000u;
+            dst[offsets[(key >> 8*d) & 0xff]++] = src[i];
+        }
+        int* t = src; src = dst; dst = t;
+    }
+    if (src != a) memcpy(a, src, n*sizeof(int));
 }
 
 /** Change intSet by adding all elements in array elements[nElements] to
  *  it.  Returns # of elements in intSet after addition.  Returns
  *  < 0 on error with errno set.
+ *
+ *  Rather than adding the elements one at a time, which moves the
+ *  elements after each one, a copy of them is sorted (unless already
+ *  sorted), its duplicates removed and the result merged into the set
+ *  as by a union, so this is linear apart from small sorts.
  */
 int addMultipleIntSet(void *intSet, const int elements[], int nElements) {
-    int ret = -1;
-    for (int i = 0; i < nElements; i++) {
-        if ((ret = addIntSet(intSet, elements[i])) < 0) break;
+    IntSet* set = (IntSet*)intSet;
+    if (nElements <= 0) return nElementsIntSet(set);
+    int sorted = 1;
+    for (int i = 1; i < nElements && sorted; i++) {
+        sorted = elements[i - 1] <= elements[i];
+    }
+    int nCopy = (sorted || nElements < RADIX_MIN) ? nElements : 2*nElements;
+    if (nCopy < nElements) {    // 2*nElements overflowed
+        errno = ENOMEM;
+        return -1;
+    }
+    int* copy = malloc(nCopy*sizeof(int));
+    if (copy == NULL) return -1;
+    memcpy(copy, elements, nElements*sizeof(int));
+    if (!sorted && nElements < RADIX_MIN) {
+        insertionSort(copy, nElements);
+    } else if (!sorted) {
+        radixSort(copy, &copy[nElements], nElements);
     }
+    int n = 1;
+    for (int i = 1; i < nElements; i++) {
+        if (copy[i] != copy[n - 1]) copy[n++] = copy[i];
+    }
+
+    int ret;
+    if (set->kind == INT_SET_BITMAP) {
+        Roaring* bitmap = roaringOfElements(copy, n);
+        ret = -1;
+        if (bitmap != NULL) {
+            ret = unionRoaring(set->bitmap, bitmap);
+            freeRoaring(bitmap);
+        }
+    } else {
+        ret = mergeElements(set, copy, n, 1);
+    }
+    free(copy);
     return ret;
 }
 
@@ -92,27 +440,15 @@ int addMultipleIntSet(void *intSet, const int elements[], int nElements) {
 int unionIntSet(void *intSetA, void *intSetB) {
     IntSet* setA = (IntSet*) intSetA;
     IntSet* setB = (IntSet*) intSetB;
-    Node* pA0 = &setA->dummy;
-    Node* pB = setB->dummy.next;
-    for (; pA0->next != NULL && pB != NULL; ) {
-        if (pA0->next->val < pB->val) {
-            pA0 = pA0->next;
-        } else if (pA0->next->val == pB->val) {
-            pA0 = pA0->next;
-            pB = pB->next;
-        } else {
-            if (addIntSet(intSetA, pB->val) < 0) return -1;
-            pA0 = pA0->next;
-            pB = pB->next;
-        }
-    }
-
-    for (; pB != NULL; pB = pB->next) {
-        if (addIntSet(intSetA, pB->val) < 0) return -1;
-        pA0 = pA0->next;
+    if (setA == setB) return nElementsIntSet(setA);
+    if (setA->kind == INT_SET_BITMAP) {
+        return setB->kind == INT_SET_BITMAP
+            ? unionRoaring(setA->bitmap, setB->bitmap)
+            : bitmapOp(unionRoaring, setA, setB);
     }
-
-    return nElementsIntSet(intSetA);
+    int nB;
+    const int* b = elementsIntSet(setB, &nB);
+    return b == NULL ? -1 : mergeElements(setA, b, nB, 1);
 }
 
 /** Set intSetA to the intersection of intSetA and intSetB.  Return #
@@ -121,31 +457,210 @@ int unionIntSet(void *intSetA, void *intSetB) {
 int intersectionIntSet(void *intSetA, void *intSetB) {
     IntSet* setA = (IntSet*) intSetA;
     IntSet* setB = (IntSet*) intSetB;
-    Node* pA0 = &setA->dummy;
-    Node* pB = setB->dummy.next;
-
-    for (; pA0->next != NULL && pB != NULL; ) {
-        if (pA0->next->val < pB->val) {
-            unlinkNode(setA, pA0);
-        } else if (pA0->next->val == pB->val) {
-            pA0 = pA0->next;
-            pB = pB->next;
-        } else {
-            pB = pB->next;
+    if (setA->kind == INT_SET_BITMAP) {
+        return setB->kind == INT_SET_BITMAP
+            ? intersectionRoaring(setA->bitmap, setB->bitmap)
+            : bitmapOp(intersectionRoaring, setA, setB);
+    }
+    int nB;
+    const int* b = elementsIntSet(setB, &nB);
+    return b == NULL ? -1 : intersectionElements(setA, b, nB);
+}
+
+/** Return # of elements in the intersection of intSetA and intSetB,
+ *  without changing either.  Returns < 0 on error.
+ */
+int intersectionSizeIntSet(void *intSetA, void *intSetB) {
+    IntSet* setA = (IntSet*) intSetA;
+    IntSet* setB = (IntSet*) intSetB;
+    if (setA->kind == INT_SET_BITMAP && setB->kind == INT_SET_BITMAP) {
+        return intersectionSizeRoaring(setA->bitmap, setB->bitmap);
+    }
+    int nA, nB;
+    const int* a = elementsIntSet(setA, &nA);
+    const int* b = elementsIntSet(setB, &nB);
+    return (a == NULL || b == NULL) ? -1 : countCommon(a, nA, b, nB);
+}
+
+/** Set intSetA to the elements of intSetA which are not in intSetB.
+ *  Return # of elements in the updated intSetA.  Returns < 0 on error.
+ */
+int differenceIntSet(void *intSetA, void *intSetB) {
+    IntSet* setA = (IntSet*) intSetA;
+    IntSet* setB = (IntSet*) intSetB;
+    if (setA->kind == INT_SET_BITMAP) {
+        return setB->kind == INT_SET_BITMAP
+            ? differenceRoaring(setA->bitmap, setB->bitmap)
+            : bitmapOp(differenceRoaring, setA, setB);
+    }
+    if (setA == setB) {
+        setA->len = 0;
+        return 0;
+    }
+    int nB;
+    const int* b = elementsIntSet(setB, &nB);
+    return b == NULL ? -1 : differenceElements(setA, b, nB);
+}
+
+/** Set intSetA to the elements which are in exactly one of intSetA
+ *  and intSetB.  Return # of elements in the updated intSetA.  Returns
+ *  < 0 on error.
+ */
+int symmetricDifferenceIntSet(void *intSetA, void *intSetB) {
+    IntSet* setA = (IntSet*) intSetA;
+    IntSet* setB = (IntSet*) intSetB;
+    if (setA->kind == INT_SET_BITMAP) {
+        return setB->kind == INT_SET_BITMAP
+            ? symmetricDifferenceRoaring(setA->bitmap, setB->bitmap)
+            : bitmapOp(symmetricDifferenceRoaring, setA, setB);
+    }
+    if (setA == setB) {
+        setA->len = 0;
+        return 0;
+    }
+    int nB;
+    const int* b = elementsIntSet(setB, &nB);
+    return b == NULL ? -1 : mergeElements(setA, b, nB, 0);
+}
+
+/** Return non-zero iff every element of intSetA is in intSetB.
+ *  Returns < 0 on error.
+ */
+int isSubsetIntSet(void *intSetA, void *intSetB) {
+    int nA = nElementsIntSet(intSetA);
+    if (nA > nElementsIntSet(intSetB)) return 0;
+    int n = intersectionSizeIntSet(intSetA, intSetB);
+    return n < 0 ? n : n == nA;
+}
+
+/** Return non-zero iff intSetA and intSetB have the same elements.
+ *  Returns < 0 on error.
+ */
+int equalsIntSet(void *intSetA, void *intSetB) {
+    IntSet* setA = (IntSet*) intSetA;
+    IntSet* setB = (IntSet*) intSetB;
+    int nA = nElementsIntSet(setA);
+    if (nA != nElementsIntSet(setB)) return 0;
+    if (setA->kind == INT_SET_ARRAY && setB->kind == INT_SET_ARRAY) {
+        return memcmp(setA->elements, setB->elements, nA*sizeof(int)) == 0;
+    }
+    int n = intersectionSizeIntSet(setA, setB);
+    return n < 0 ? n : n == nA;
+}
+
+/** The next element of one of the sets merged by unionAllIntSet() */
+typedef struct {
+    const int* next;
+    const int* end;
+} Cursor;
+
+/** Restore the heap order on *next of heap[n] below heap[i]. */
+static void
+siftDown(Cursor* heap, int n, int i) {
+    Cursor c = heap[i];
+    for (int child; (child = 2*i + 1) < n; i = child) {
+        if (child + 1 < n && *heap[child + 1].next < *heap[child].next) {
+            child++;
         }
+        if (*c.next <= *heap[child].next) break;
+        heap[i] = heap[child];
     }
+    heap[i] = c;
+}
 
-    return nElementsIntSet(intSetA);
+/** Set intSet to the union of intSet and all of intSets[nSets].
+ *  Return # of elements in the updated intSet.  Returns < 0 on error.
+ *
+ *  For an array set, all the sets are merged at once through a heap of
+ *  their next elements into a new array, so each element is moved
+ *  once whatever the # of sets.  Bitmap sets are or'ed in one at a
+ *  time, as that is done a container at a time.
+ */
+int unionAllIntSet(void *intSet, void *intSets[], int nSets) {
+    IntSet* set = (IntSet*) intSet;
+    if (set->kind == INT_SET_BITMAP) {
+        int ret = nElementsIntSet(set);
+        for (int i = 0; i < nSets && ret >= 0; i++) {
+            ret = unionIntSet(set, intSets[i]);
+        }
+        return ret;
+    }
+    Cursor* heap = malloc((nSets + 1)*sizeof(Cursor));
+    if (heap == NULL) return -1;
+    int nHeap = 0;
+    long total = 0;
+    for (int i = -1; i < nSets; i++) {
+        int n;
+        const int* elements = elementsIntSet(i < 0 ? set : intSets[i], &n);
+        if (elements == NULL) {
+            free(heap);
+            return -1;
+        }
+        if (n == 0) continue;
+        heap[nHeap++] = (Cursor) { .next = elements, .end = &elements[n] };
+        total += n;
+    }
+    if (total >= INT_MAX) {
+        free(heap);
+        errno = ENOMEM;
+        return -1;
+    }
+    int* elements = malloc((total + 1)*sizeof(int));
+    if (elements == NULL) {
+        free(heap);
+        return -1;
+    }
+    for (int i = nHeap/2 - 1; i >= 0; i--) siftDown(heap, nHeap, i);
+    int n = 0;
+    while (nHeap > 0) {
+        int element = *heap[0].next++;
+        if (n == 0 || element != elements[n - 1]) elements[n++] = element;
+        if (heap[0].next == heap[0].end) heap[0] = heap[--nHeap];
+        siftDown(heap, nHeap, 0);
+    }
+    free(heap);
+    free(set->elements);
+    set->elements = elements;
+    set->size = total + 1;
+    set->len = n;
+    setEndIntSet(set);
+    return set->len;
+}
+
+static int
+compareSizes(const void* p1, const void* p2) {
+    int n1 = nElementsIntSet(*(void**)p1);
+    int n2 = nElementsIntSet(*(void**)p2);
+    return (n1 > n2) - (n1 < n2);
+}
+
+/** Set intSet to the intersection of intSet and all of
+ *  intSets[nSets].  Return # of elements in the updated intSet.
+ *  Returns < 0 on error.
+ *
+ *  The sets are intersected into intSet in place from the smallest up,
+ *  so the result shrinks as fast as possible and the larger sets are
+ *  galloped through; it stops early once intSet is empty.
+ */
+int intersectionAllIntSet(void *intSet, void *intSets[], int nSets) {
+    int ret = nElementsIntSet(intSet);
+    if (nSets == 0) return ret;
+    void** bySize = malloc(nSets*sizeof(void*));
+    if (bySize == NULL) return -1;
+    memcpy(bySize, intSets, nSets*sizeof(void*));
+    qsort(bySize, nSets, sizeof(void*), compareSizes);
+    for (int i = 0; i < nSets && ret > 0; i++) {
+        ret = intersectionIntSet(intSet, bySize[i]);
+    }
+    free(bySize);
+    return ret;
 }
 
 /** Free all resources used by previously created intSet. */
 void freeIntSet(void *intSet) {
     IntSet* iSet = (IntSet*)intSet;
-    Node *p1;
-    for (Node* p = iSet->dummy.next; p != NULL; p = p1) {
-        p1 = p->next;
-        free(p);
-    }
+    if (iSet->bitmap != NULL) freeRoaring(iSet->bitmap);
+    free(iSet->elements);
     free(iSet);
 }
 
@@ -153,20 +668,22 @@ void freeIntSet(void *intSet) {
  *  is empty.
  */
 const void *newIntSetIterator(const void *intSet) {
-    const IntSet* set = (IntSet*) intSet;
-    return set->dummy.next;
+    IntSet* set = (IntSet*) intSet;
+    int n;
+    const int* elements = elementsIntSet(set, &n);
+    return n == 0 ? NULL : elements;
 }
 
 /** Return current element for intSetIterator. */
 int intSetIteratorElement(const void *intSetIterator) {
-    const Node *p = (Node *)intSetIterator;
-    return p->val;
+    const int *p = (int *)intSetIterator;
+    return *p;
 }
 
 /** Step intSetIterator and return stepped iterator.  Return
  *  NULL if no more iterations are possible.
  */
 const void *stepIntSetIterator(const void *intSetIterator) {
-    const Node* p = (Node *) intSetIterator;
-    return p->next;
-}
\ No newline at end of file
+    const int* p = (int *) intSetIterator;
+    return p[1] > p[0] ? p + 1 : NULL;
+}
@@ -6,10 +6,24 @@
  *  duplicates.
  */
 
+/** Representations of int-sets */
+typedef enum {
+  INT_SET_ARRAY,     /** sorted array of the elements, 4 bytes each */
+  INT_SET_BITMAP,    /** compressed bitmap, far smaller for sets made of
+                      *  dense ranges of ints */
+} IntSetKind;
+
 /** Return a new empty int-set.  Returns NULL on error with errno set.
  */
 void *newIntSet();
 
+/** Return a new empty int-set using representation kind; newIntSet()
+ *  is newIntSetOfKind(INT_SET_ARRAY).  All int-set functions accept
+ *  sets of either kind, and a set keeps its kind when it is changed.
+ *  Returns NULL on error with errno set.
+ */
+void *newIntSetOfKind(IntSetKind kind);
+
 /** Return # of elements in intSet */
 int nElementsIntSet(void *intSet);
 
@@ -38,6 +52,43 @@ int unionIntSet(void *intSetA, void *intSetB);
  */
 int intersectionIntSet(void *intSetA, void *intSetB);
 
+/** Return # of elements in the intersection of intSetA and intSetB,
+ *  without changing either.  Returns < 0 on error.
+ */
+int intersectionSizeIntSet(void *intSetA, void *intSetB);
+
+/** Set intSetA to the elements of intSetA which are not in intSetB.
+ *  Return # of elements in the updated intSetA.  Returns < 0 on error.
+ */
+int differenceIntSet(void *intSetA, void *intSetB);
+
+/** Set intSetA to the elements which are in exactly one of intSetA
+ *  and intSetB.  Return # of elements in the updated intSetA.  Returns
+ *  < 0 on error.
+ */
+int symmetricDifferenceIntSet(void *intSetA, void *intSetB);
+
+/** Return non-zero iff every element of intSetA is in intSetB.
+ *  Returns < 0 on error.
+ */
+int isSubsetIntSet(void *intSetA, void *intSetB);
+
+/** Return non-zero iff intSetA and intSetB have the same elements.
+ *  Returns < 0 on error.
+ */
+int equalsIntSet(void *intSetA, void *intSetB);
+
+/** Set intSet to the union of intSet and all of intSets[nSets].
+ *  Return # of elements in the updated intSet.  Returns < 0 on error.
+ */
+int unionAllIntSet(void *intSet, void *intSets[], int nSets);
+
+/** Set intSet to the intersection of intSet and all of
+ *  intSets[nSets].  Return # of elements in the updated intSet.
+ *  Returns < 0 on error.
+ */
+int intersectionAllIntSet(void *intSet, void *intSets[], int nSets);
+
 /** Free all resources used by previously created intSet. */
 void freeIntSet(void *intSet);
 
@@ -0,0 +1,337 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "intersect.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#else
+#define HAVE_X86_KERNELS 0
+#endif
+
+/** The SIMD kernels step through a and b a block at a time.  All
+ *  pairs of elements of the current blocks are compared at once,
+ *  giving a mask of the lanes of a's block which match.  Then the
+ *  block with the smaller last element is replaced by the next block
+ *  of its array (both if they are equal).  An element of a matched in
+ *  one block of b cannot match a later one, as b's elements are
+ *  distinct and increasing, so the masks of an a block are or'ed
+ *  together over the b blocks it meets.  When the a block is replaced,
+ *  its matches are packed to the front of a vector by a shuffle looked
+ *  up by that mask, and the whole vector is stored at the end of the
+ *  output, of which only the matches are kept.  What is left when
+ *  either array has less than a block is merged.
+ *
+ *  As an a block is only stored once it has been read, and the output
+ *  is never longer than the part of a read, out may be a.
+ */
+
+typedef int IntersectFn(const int* a, int nA, const int* b, int nB,
+                        int* out);
+typedef int CountFn(const int* a, int nA, const int* b, int nB);
+
+static int
+intersectScalar(const int* a, int nA, const int* b, int nB, int* out) {
+    int i = 0, j = 0, n = 0;
+    while (i < nA && j < nB) {
+        if (a[i] < b[j]) {
+            i++;
+        } else if (a[i] > b[j]) {
+            j++;
+        } else {
+            out[n++] = a[i++];
+            j++;
+        }
+    }
+    return n;
+}
+
+static int
+countScalar(const int* a, int nA, const int* b, int nB) {
+    int i = 0, j = 0, n = 0;
+    while (i < nA && j < nB) {
+        if (a[i] < b[j]) {
+            i++;
+        } else if (a[i] > b[j]) {
+            j++;
+        } else {
+            n++;
+            i++;
+            j++;
+        }
+    }
+    return n;
+}
+
+#if HAVE_X86_KERNELS
+
+/** Finish a kernel which ran out of blocks of b with the block of a
+ *  copied to block[blockSize] still current; the lanes of it in mask
+ *  matched have already been matched.  after[nAfter] is the rest of a
+ *  and b[nB] the rest of b.  Stores matches to out if it is not NULL.
+ *  Returns # of matches.
+ */
+static int
+finishKernel(const int* block, int blockSize, int mask,
+             const int* after, int nAfter, const int* b, int nB, int* out) {
+    int n = 0;
+    // earlier matches are before any later ones, as b is increasing
+    for (int lane = 0; lane < blockSize; lane++) {
+        if ((mask >> lane) & 1) {
+            if (out != NULL) out[n] = block[lane];
+            n++;
+        }
+    }
+    if (out != NULL) {
+        n += intersectScalar(block, blockSize, b, nB, &out[n]);
+        n += intersectScalar(after, nAfter, b, nB, &out[n]);
+    } else {
+        n += countScalar(block, blockSize, b, nB);
+        n += countScalar(after, nAfter, b, nB);
+    }
+    return n;
+}
+
+/** sseShuffles[m] is the pshufb control moving the 32-bit lanes set in
+ *  4-bit mask m to the front, in order.
+ */
+static uint8_t sseShuffles[16][16] __attribute__((aligned(16)));
+
+/** avxPermutes[m] is the vpermd control moving the 32-bit lanes set in
+ *  8-bit mask m to the front, in order.
+ */
+static int32_t avxPermutes[256][8] __attribute__((aligned(32)));
+
+static void
+initTables(void) {
+    for (int m = 0; m < 16; m++) {
+        int k = 0;
+        for (int lane = 0; lane < 4; lane++) {
+            if (!((m >> lane) & 1)) continue;
+            for (int b = 0; b < 4; b++) sseShuffles[m][4*k + b] = 4*lane + b;
+            k++;
+        }
+        for (int b = 4*k; b < 16; b++) sseShuffles[m][b] = 0x80;  // zero
+    }
+    for (int m = 0; m < 256; m++) {
+        int k = 0;
+        for (int lane = 0; lane < 8; lane++) {
+            if ((m >> lane) & 1) avxPermutes[m][k++] = lane;
+        }
+        while (k < 8) avxPermutes[m][k++] = 0;
+    }
+}
+
+/** Return mask of the lanes of va equal to some lane of vb */
+__attribute__((target("sse4.1")))
+static inline int
+matchSse41(__m128i va, __m128i vb) {
+    __m128i eq0 = _mm_cmpeq_epi32(va, vb);
+    __m128i eq1 = _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x39));
+    __m128i eq2 = _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x4e));
+    __m128i eq3 = _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x93));
+    __m128i eq = _mm_or_si128(_mm_or_si128(eq0, eq1), _mm_or_si128(eq2, eq3));
+    return _mm_movemask_ps(_mm_castsi128_ps(eq));
+}
+
+/** The SSE4.1 kernel on blocks of 4, storing matches to out if it is
+ *  not NULL; returns # of matches.
+ */
+__attribute__((target("sse4.1")))
+static inline int
+sse41Kernel(const int* a, int nA, const int* b, int nB, int* out) {
+    int i = 0, j = 0, n = 0;
+    if (nA >= 4 && nB >= 4) {
+        __m128i va = _mm_loadu_si128((const __m128i*)a);
+        __m128i vb = _mm_loadu_si128((const __m128i*)b);
+        int mask = 0;
+        for (;;) {
+            mask |= matchSse41(va, vb);
+            int aLast = _mm_extract_epi32(va, 3);
+            int bLast = _mm_extract_epi32(vb, 3);
+            if (aLast <= bLast) {
+                if (out != NULL) {
+                    __m128i shuffle =
+                        _mm_load_si128((const __m128i*)sseShuffles[mask]);
+                    _mm_storeu_si128((__m128i*)&out[n],
+                                     _mm_shuffle_epi8(va, shuffle));
+                }
+                n += __builtin_popcount(mask);
+                mask = 0;
+                i += 4;
+                if (i + 4 > nA) break;
+                va = _mm_loadu_si128((const __m128i*)&a[i]);
+            }
+            if (bLast <= aLast) {
+                j += 4;
+                if (j + 4 > nB) {
+                    int block[4];
+                    _mm_storeu_si128((__m128i*)block, va);
+                    return n + finishKernel(block, 4, mask, &a[i + 4],
+                                            nA - i - 4, &b[j], nB - j,
+                                            out != NULL ? &out[n] : NULL);
+                }
+                vb = _mm_loadu_si128((const __m128i*)&b[j]);
+            }
+        }
+    }
+    return n + (out != NULL
+                ? intersectScalar(&a[i], nA - i, &b[j], nB - j, &out[n])
+                : countScalar(&a[i], nA - i, &b[j], nB - j));
+}
+
+/** Return mask of the lanes of va equal to some lane of vb: each
+ *  128-bit half of va is compared with the rotations of both halves
+ *  of vb.
+ */
+__attribute__((target("avx2")))
+static inline int
+matchAvx2(__m256i va, __m256i vb) {
+    __m256i vbSwapped = _mm256_permute2x128_si256(vb, vb, 0x01);
+    __m256i vb1 = _mm256_shuffle_epi32(vb, 0x39);
+    __m256i vb2 = _mm256_shuffle_epi32(vb, 0x4e);
+    __m256i vb3 = _mm256_shuffle_epi32(vb, 0x93);
+    __m256i vbSwapped1 = _mm256_shuffle_epi32(vbSwapped, 0x39);
+    __m256i vbSwapped2 = _mm256_shuffle_epi32(vbSwapped, 0x4e);
+    __m256i vbSwapped3 = _mm256_shuffle_epi32(vbSwapped, 0x93);
+    __m256i eq0 = _mm256_or_si256(_mm256_cmpeq_epi32(va, vb),
+                                  _mm256_cmpeq_epi32(va, vbSwapped));
+    __m256i eq1 = _mm256_or_si256(_mm256_cmpeq_epi32(va, vb1),
+                                  _mm256_cmpeq_epi32(va, vbSwapped1));
+    __m256i eq2 = _mm256_or_si256(_mm256_cmpeq_epi32(va, vb2),
+                                  _mm256_cmpeq_epi32(va, vbSwapped2));
+    __m256i eq3 = _mm256_or_si256(_mm256_cmpeq_epi32(va, vb3),
+                                  _mm256_cmpeq_epi32(va, vbSwapped3));
+    __m256i eq = _mm256_or_si256(_mm256_or_si256(eq0, eq1),
+                                 _mm256_or_si256(eq2, eq3));
+    return _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+}
+
+/** The AVX2 kernel on blocks of 8, storing matches to out if it is not
+ *  NULL; returns # of matches.
+ */
+__attribute__((target("avx2")))
+static inline int
+avx2Kernel(const int* a, int nA, const int* b, int nB, int* out) {
+    int i = 0, j = 0, n = 0;
+    if (nA >= 8 && nB >= 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)a);
+        __m256i vb = _mm256_loadu_si256((const __m256i*)b);
+        int mask = 0;
+        for (;;) {
+            mask |= matchAvx2(va, vb);
+            int aLast = _mm256_extract_epi32(va, 7);
+            int bLast = _mm256_extract_epi32(vb, 7);
+            if (aLast <= bLast) {
+                if (out != NULL) {
+                    __m256i permute =
+                        _mm256_load_si256((const __m256i*)avxPermutes[mask]);
+                    __m256i packed = _mm256_permutevar8x32_epi32(va, permute);
+                    _mm256_storeu_si256((__m256i*)&out[n], packed);
+                }
+                n += __builtin_popcount(mask);
+                mask = 0;
+                i += 8;
+                if (i + 8 > nA) break;
+                va = _mm256_loadu_si256((const __m256i*)&a[i]);
+            }
+            if (bLast <= aLast) {
+                j += 8;
+                if (j + 8 > nB) {
+                    int block[8];
+                    _mm256_storeu_si256((__m256i*)block, va);
+                    return n + finishKernel(block, 8, mask, &a[i + 8],
+                                            nA - i - 8, &b[j], nB - j,
+                                            out != NULL ? &out[n] : NULL);
+                }
+                vb = _mm256_loadu_si256((const __m256i*)&b[j]);
+            }
+        }
+    }
+    return n + (out != NULL
+                ? intersectScalar(&a[i], nA - i, &b[j], nB - j, &out[n])
+                : countScalar(&a[i], nA - i, &b[j], nB - j));
+}
+
+// separate functions for the storing and counting variants, so the
+// test of out is compiled out of the inlined kernels
+
+__attribute__((target("sse4.1")))
+static int
+intersectSse41(const int* a, int nA, const int* b, int nB, int* out) {
+    return sse41Kernel(a, nA, b, nB, out);
+}
+
+__attribute__((target("sse4.1")))
+static int
+countSse41(const int* a, int nA, const int* b, int nB) {
+    return sse41Kernel(a, nA, b, nB, NULL);
+}
+
+__attribute__((target("avx2")))
+static int
+intersectAvx2(const int* a, int nA, const int* b, int nB, int* out) {
+    return avx2Kernel(a, nA, b, nB, out);
+}
+
+__attribute__((target("avx2")))
+static int
+countAvx2(const int* a, int nA, const int* b, int nB) {
+    return avx2Kernel(a, nA, b, nB, NULL);
+}
+
+#endif //if HAVE_X86_KERNELS
+
+static IntersectFn* intersectFn;
+static CountFn* countFn;
+
+/** Make later calls use kernel, or the best one this CPU supports if
+ *  it does not support kernel.  Returns the kernel used.  Meant for
+ *  testing and benchmarking.
+ */
+IntersectKernel useIntersectKernel(IntersectKernel kernel) {
+    IntersectKernel best = INTERSECT_SCALAR;
+#if HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        best = INTERSECT_AVX2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        best = INTERSECT_SSE41;
+    }
+    if (intersectFn == NULL) initTables();
+#endif
+    if (kernel > best) kernel = best;
+    switch (kernel) {
+#if HAVE_X86_KERNELS
+    case INTERSECT_AVX2:
+        intersectFn = intersectAvx2;
+        countFn = countAvx2;
+        break;
+    case INTERSECT_SSE41:
+        intersectFn = intersectSse41;
+        countFn = countSse41;
+        break;
+#endif
+    default:
+        intersectFn = intersectScalar;
+        countFn = countScalar;
+        break;
+    }
+    return kernel;
+}
+
+/** Write the elements common to a[nA] and b[nB] to out[] in order and
+ *  return their #.  out may be a; otherwise it must not overlap a or b
+ *  and must have room for INTERSECT_SLACK more ints than the smaller
+ *  of nA and nB.
+ */
+int intersectSorted(const int a[], int nA, const int b[], int nB, int out[]) {
+    if (intersectFn == NULL) useIntersectKernel(INTERSECT_AVX2);
+    return intersectFn(a, nA, b, nB, out);
+}
+
+/** Return # of elements common to a[nA] and b[nB]. */
+int countIntersectSorted(const int a[], int nA, const int b[], int nB) {
+    if (countFn == NULL) useIntersectKernel(INTERSECT_AVX2);
+    return countFn(a, nA, b, nB);
+}
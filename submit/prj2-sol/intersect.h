@@ -0,0 +1,39 @@
+#ifndef INTERSECT_H_
+#define INTERSECT_H_
+
+/** Intersection of sorted arrays of distinct int's, with SIMD kernels
+ *  chosen at run time for the CPU: a block of each array is compared
+ *  against every element of the other's block at once and the matches
+ *  are packed by a shuffle, as in Lemire et al.  Used by int-set.c for
+ *  sets of similar size; much smaller sets are galloped instead.
+ */
+
+/** Kernels in order of preference */
+typedef enum {
+  INTERSECT_SCALAR,      /** plain merge */
+  INTERSECT_SSE41,       /** 4 x 4 blocks, needs SSE4.1 */
+  INTERSECT_AVX2,        /** 8 x 8 blocks, needs AVX2 */
+} IntersectKernel;
+
+/** # of ints past the result which intersectSorted() may overwrite,
+ *  as it stores whole blocks
+ */
+enum { INTERSECT_SLACK = 8 };
+
+/** Write the elements common to a[nA] and b[nB] to out[] in order and
+ *  return their #.  out may be a; otherwise it must not overlap a or b
+ *  and must have room for INTERSECT_SLACK more ints than the smaller
+ *  of nA and nB.
+ */
+int intersectSorted(const int a[], int nA, const int b[], int nB, int out[]);
+
+/** Return # of elements common to a[nA] and b[nB]. */
+int countIntersectSorted(const int a[], int nA, const int b[], int nB);
+
+/** Make later calls use kernel, or the best one this CPU supports if
+ *  it does not support kernel.  Returns the kernel used.  Meant for
+ *  testing and benchmarking.
+ */
+IntersectKernel useIntersectKernel(IntersectKernel kernel);
+
+#endif //ifndef INTERSECT_H_
@@ -0,0 +1,930 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "roaring.h"
+
+/** An element x is kept as the unsigned value x ^ 0x80000000, which
+ *  orders the same as x; its high 16 bits are the key of the container
+ *  it is in and its low 16 bits are its offset in that container.
+ */
+enum {
+    CHUNK_SIZE = 1 << 16,          // # of ints covered by a container
+    BITMAP_WORDS = CHUNK_SIZE/64,
+    MAX_ARRAY = 4096,              // an array of more is bigger than a bitmap
+    GALLOP_RATIO = 16,             // gallop through arrays this much larger
+};
+
+typedef enum { ARRAY, BITMAP, RUN } ContainerType;
+
+/** Ways of combining the bits of one container into a bitmap */
+typedef enum { OR, AND_NOT, XOR } BitOp;
+
+/** Offsets start through last inclusive */
+typedef struct {
+    uint16_t start, last;
+} Run;
+
+typedef struct {
+    uint16_t key;
+    uint8_t type;       // a ContainerType
+    int card;           // # of elements, > 0
+    int n;              // # of values for ARRAY, of runs for RUN
+    int size;           // # of values or runs allocated
+    union {
+        uint16_t* values;   // ARRAY: offsets in increasing order
+        uint64_t* words;    // BITMAP: BITMAP_WORDS words
+        Run* runs;          // RUN: disjoint, non-adjacent, in order
+    };
+} Container;
+
+struct RoaringStruct {
+    int len;
+    int nContainers;
+    int size;               // # of containers allocated
+    Container* containers;  // in increasing order of key
+    int* elements;          // cache for elementsRoaring(), NULL if stale
+};
+
+static uint32_t
+biased(int x) {
+    return (uint32_t)x ^ 0x80000000u;
+}
+
+static int
+unbiased(uint32_t u) {
+    return (int)(u ^ 0x80000000u);
+}
+
+/** Grow *p, an array of *sizeP items of itemSize bytes, to hold at
+ *  least n, doubling up to maxSize.  Returns < 0 on error.
+ */
+static int
+reserve(void* p, int* sizeP, int n, size_t itemSize, int maxSize) {
+    if (n <= *sizeP) return 0;
+    int size = *sizeP < 4 ? 4 : *sizeP;
+    while (size < n) size *= 2;
+    if (size > maxSize) size = maxSize;
+    void* items = realloc(*(void**)p, size*itemSize);
+    if (items == NULL) return -1;
+    *(void**)p = items;
+    *sizeP = size;
+    return 0;
+}
+
+/************************** Container operations ***********************/
+
+static void
+freeContainer(Container* c) {
+    free(c->values);    // all the union members alias the same pointer
+}
+
+/** Return index of first value in values[n] >= v, n if none. */
+static int
+lowerBound16(const uint16_t* values, int n, uint16_t v) {
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = lo + (hi - lo)/2;
+        if (values[mid] < v) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/** Return index of first of values[lo..n) >= v, n if none, galloping
+ *  up from lo in steps of 1, 2, 4, ...
+ */
+static int
+gallop16(const uint16_t* values, int lo, int n, uint16_t v) {
+    int hi = lo;
+    for (int step = 1; hi < n && values[hi] < v; step *= 2) {
+        lo = hi + 1;
+        hi = step < n - hi ? hi + step : n;
+    }
+    return lo + lowerBound16(&values[lo], hi - lo, v);
+}
+
+/** Return index of first run in runs[n] starting after v, n if none. */
+static int
+upperBoundRun(const Run* runs, int n, uint16_t v) {
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = lo + (hi - lo)/2;
+        if (runs[mid].start <= v) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int
+containerContains(const Container* c, uint16_t v) {
+    switch (c->type) {
+    case ARRAY: {
+        int i = lowerBound16(c->values, c->n, v);
+        return i < c->n && c->values[i] == v;
+    }
+    case BITMAP:
+        return (c->words[v/64] >> (v % 64)) & 1;
+    default: {
+        int i = upperBoundRun(c->runs, c->n, v);
+        return i > 0 && v <= c->runs[i - 1].last;
+    }
+    }
+}
+
+/** Combine bits into *word by op. */
+static inline void
+combineWord(uint64_t* word, uint64_t bits, BitOp op) {
+    switch (op) {
+    case OR:
+        *word |= bits;
+        break;
+    case AND_NOT:
+        *word &= ~bits;
+        break;
+    default:
+        *word ^= bits;
+        break;
+    }
+}
+
+/** Combine the bits start through last into words[] by op. */
+static void
+combineBits(uint64_t* words, int start, int last, BitOp op) {
+    for (int w = start/64; w <= last/64; w++) {
+        int lo = (w == start/64) ? start % 64 : 0;
+        int hi = (w == last/64) ? last % 64 : 63;
+        combineWord(&words[w], (~0ull >> (63 - hi)) & (~0ull << lo), op);
+    }
+}
+
+/** Combine the bits of the elements of c into words[BITMAP_WORDS] by
+ *  op: set them, clear them or flip them.
+ */
+static void
+combineContainer(uint64_t* words, const Container* c, BitOp op) {
+    switch (c->type) {
+    case ARRAY:
+        for (int i = 0; i < c->n; i++) {
+            combineWord(&words[c->values[i]/64], 1ull << (c->values[i] % 64),
+                        op);
+        }
+        break;
+    case BITMAP:
+        for (int w = 0; w < BITMAP_WORDS; w++) {
+            combineWord(&words[w], c->words[w], op);
+        }
+        break;
+    default:
+        for (int i = 0; i < c->n; i++) {
+            combineBits(words, c->runs[i].start, c->runs[i].last, op);
+        }
+        break;
+    }
+}
+
+static int
+countBits(const uint64_t* words) {
+    int card = 0;
+    for (int w = 0; w < BITMAP_WORDS; w++) {
+        card += __builtin_popcountll(words[w]);
+    }
+    return card;
+}
+
+/** Return # of runs of set bits in words[BITMAP_WORDS] */
+static int
+countRuns(const uint64_t* words) {
+    int nRuns = 0;
+    uint64_t carry = 0;     // top bit of previous word
+    for (int w = 0; w < BITMAP_WORDS; w++) {
+        nRuns += __builtin_popcountll(words[w] & ~((words[w] << 1) | carry));
+        carry = words[w] >> 63;
+    }
+    return nRuns;
+}
+
+/** Replace the contents of c by the card > 0 elements set in
+ *  words[BITMAP_WORDS], a malloc'd array which c takes over, held in
+ *  whichever container is smallest.  Returns < 0 on error, leaving c
+ *  unchanged.
+ */
+static int
+fromBitmap(Container* c, uint64_t* words, int card) {
+    int nRuns = countRuns(words);
+    int arrayBytes = card <= MAX_ARRAY ? 2*card : INT32_MAX;
+    int runBytes = nRuns*(int)sizeof(Run);
+    int bitmapBytes = BITMAP_WORDS*sizeof(uint64_t);
+    if (runBytes >= bitmapBytes && arrayBytes >= bitmapBytes) {
+        if (c->words != words) freeContainer(c);
+        c->type = BITMAP;
+        c->words = words;
+        c->card = card;
+        c->n = c->size = 0;
+        return 0;
+    }
+    if (runBytes < arrayBytes) {
+        Run* runs = malloc(nRuns*sizeof(Run));
+        if (runs == NULL) return -1;
+        int n = 0;
+        for (int v = 0; v < CHUNK_SIZE; ) {
+            uint64_t word = words[v/64] >> (v % 64);
+            if (word == 0) {
+                v = (v/64 + 1)*64;
+                continue;
+            }
+            v += __builtin_ctzll(word);
+            int last = v;
+            while (last + 1 < CHUNK_SIZE) {
+                // 0 bits of clear are set bits following last
+                uint64_t clear = ~words[(last + 1)/64] >> ((last + 1) % 64);
+                if (clear != 0) {
+                    last += __builtin_ctzll(clear);
+                    break;
+                }
+                last = ((last + 1)/64 + 1)*64 - 1;
+            }
+            runs[n++] = (Run) { .start = v, .last = last };
+            v = last + 1;
+        }
+        if (c->words != words) freeContainer(c);
+        free(words);
+        c->type = RUN;
+        c->runs = runs;
+        c->n = c->size = nRuns;
+    } else {
+        uint16_t* values = malloc(card*sizeof(uint16_t));
+        if (values == NULL) return -1;
+        int n = 0;
+        for (int w = 0; w < BITMAP_WORDS; w++) {
+            for (uint64_t word = words[w]; word != 0; word &= word - 1) {
+                values[n++] = w*64 + __builtin_ctzll(word);
+            }
+        }
+        if (c->words != words) freeContainer(c);
+        free(words);
+        c->type = ARRAY;
+        c->values = values;
+        c->n = c->size = card;
+    }
+    c->card = card;
+    return 0;
+}
+
+/** Return a new zeroed bitmap with the elements of c set, NULL on
+ *  error.
+ */
+static uint64_t*
+toBitmap(const Container* c) {
+    uint64_t* words = calloc(BITMAP_WORDS, sizeof(uint64_t));
+    if (words != NULL) combineContainer(words, c, OR);
+    return words;
+}
+
+/** Re-encode c in whichever container is smallest. */
+static int
+optimizeContainer(Container* c) {
+    uint64_t* words = c->type == BITMAP ? c->words : toBitmap(c);
+    if (words == NULL) return -1;
+    if (fromBitmap(c, words, c->card) < 0) {
+        if (words != c->words) free(words);
+        return -1;
+    }
+    return 0;
+}
+
+/** Add v to c.  Returns 1 if added, 0 if already there, < 0 on error. */
+static int
+containerAdd(Container* c, uint16_t v) {
+    switch (c->type) {
+    case ARRAY: {
+        int i = lowerBound16(c->values, c->n, v);
+        if (i < c->n && c->values[i] == v) return 0;
+        if (c->n == MAX_ARRAY) {
+            uint64_t* words = toBitmap(c);
+            if (words == NULL) return -1;
+            words[v/64] |= 1ull << (v % 64);
+            if (fromBitmap(c, words, c->card + 1) < 0) {
+                free(words);
+                return -1;
+            }
+            return 1;
+        }
+        if (reserve(&c->values, &c->size, c->n + 1, sizeof(uint16_t),
+                    MAX_ARRAY) < 0) {
+            return -1;
+        }
+        memmove(&c->values[i + 1], &c->values[i],
+                (c->n - i)*sizeof(uint16_t));
+        c->values[i] = v;
+        c->n++;
+        c->card++;
+        return 1;
+    }
+    case BITMAP: {
+        uint64_t bit = 1ull << (v % 64);
+        if (c->words[v/64] & bit) return 0;
+        c->words[v/64] |= bit;
+        c->card++;
+        // a full chunk is a single run
+        return (c->card == CHUNK_SIZE && optimizeContainer(c) < 0) ? -1 : 1;
+    }
+    default: {
+        int i = upperBoundRun(c->runs, c->n, v);   // runs[i - 1] starts <= v
+        if (i > 0 && v <= c->runs[i - 1].last) return 0;
+        int isAfterPrev = i > 0 && c->runs[i - 1].last + 1 == v;
+        int isBeforeNext = i < c->n && c->runs[i].start == v + 1;
+        if (isAfterPrev && isBeforeNext) {
+            c->runs[i - 1].last = c->runs[i].last;
+            memmove(&c->runs[i], &c->runs[i + 1],
+                    (c->n - i - 1)*sizeof(Run));
+            c->n--;
+        } else if (isAfterPrev) {
+            c->runs[i - 1].last = v;
+        } else if (isBeforeNext) {
+            c->runs[i].start = v;
+        } else {
+            if (reserve(&c->runs, &c->size, c->n + 1, sizeof(Run),
+                        CHUNK_SIZE/2) < 0) {
+                return -1;
+            }
+            memmove(&c->runs[i + 1], &c->runs[i], (c->n - i)*sizeof(Run));
+            c->runs[i] = (Run) { .start = v, .last = v };
+            c->n++;
+        }
+        c->card++;
+        // runs only pay while they are fewer than a quarter of the values
+        // or of the bitmap's bytes
+        int otherBytes = c->card <= MAX_ARRAY ? 2*c->card : CHUNK_SIZE/8;
+        if (c->n*(int)sizeof(Run) > otherBytes && optimizeContainer(c) < 0) {
+            return -1;
+        }
+        return 1;
+    }
+    }
+}
+
+/** Set *dst to a copy of src.  Returns < 0 on error. */
+static int
+copyContainer(Container* dst, const Container* src) {
+    size_t bytes =
+        src->type == ARRAY ? src->n*sizeof(uint16_t) :
+        src->type == BITMAP ? BITMAP_WORDS*sizeof(uint64_t) :
+        src->n*sizeof(Run);
+    void* data = malloc(bytes);
+    if (data == NULL) return -1;
+    memcpy(data, src->values, bytes);
+    *dst = *src;
+    dst->values = data;
+    dst->size = src->n;
+    return 0;
+}
+
+/** Replace the contents of a by the elements set in words, a bitmap
+ *  which is either a's own or a malloc'd one which a takes over.  a
+ *  is left empty, with its storage kept, if words has none.  Returns
+ *  < 0 on error, leaving a unchanged and freeing words if not a's.
+ */
+static int
+setFromBitmap(Container* a, uint64_t* words) {
+    int card = countBits(words);
+    if (words == a->words) a->card = card;   // still valid if re-encoding fails
+    if (card == 0) {
+        if (words != a->words) free(words);
+        a->card = 0;
+        return 0;
+    }
+    if (fromBitmap(a, words, card) < 0) {
+        if (words != a->words) free(words);
+        return -1;
+    }
+    return 0;
+}
+
+/** Set a to the union of a and b.  Returns < 0 on error. */
+static int
+containerUnion(Container* a, const Container* b) {
+    if (a->type == ARRAY && b->type == ARRAY && a->n + b->n <= MAX_ARRAY) {
+        uint16_t* values = malloc((a->n + b->n)*sizeof(uint16_t));
+        if (values == NULL) return -1;
+        int iA = 0, iB = 0, n = 0;
+        while (iA < a->n && iB < b->n) {
+            if (a->values[iA] < b->values[iB]) {
+                values[n++] = a->values[iA++];
+            } else {
+                if (a->values[iA] == b->values[iB]) iA++;
+                values[n++] = b->values[iB++];
+            }
+        }
+        while (iA < a->n) values[n++] = a->values[iA++];
+        while (iB < b->n) values[n++] = b->values[iB++];
+        free(a->values);
+        a->size = a->n + b->n;
+        a->values = values;
+        a->n = a->card = n;
+        return 0;
+    }
+    uint64_t* words = a->type == BITMAP ? a->words : toBitmap(a);
+    if (words == NULL) return -1;
+    combineContainer(words, b, OR);
+    return setFromBitmap(a, words);
+}
+
+/** Append v to out[n] unless out is NULL; returns n + 1. */
+static inline int
+keep(uint16_t* out, int n, uint16_t v) {
+    if (out != NULL) out[n] = v;
+    return n + 1;
+}
+
+/** Return # of values of array container c which are also in other,
+ *  stepping through both in order.  If out is not NULL, the values are
+ *  also stored in out[], which may be c's values.
+ */
+static int
+matchArray(const Container* c, const Container* other, uint16_t* out) {
+    const uint16_t* values = c->values;
+    int n = 0;
+    if (other->type == BITMAP) {
+        for (int i = 0; i < c->n; i++) {
+            uint16_t v = values[i];
+            if ((other->words[v/64] >> (v % 64)) & 1) n = keep(out, n, v);
+        }
+    } else if (other->type == RUN) {
+        for (int i = 0, k = 0; i < c->n && k < other->n; ) {
+            if (values[i] < other->runs[k].start) {
+                i++;
+            } else if (values[i] > other->runs[k].last) {
+                k++;
+            } else {
+                n = keep(out, n, values[i++]);
+            }
+        }
+    } else if (c->n < other->n/GALLOP_RATIO) {
+        // few values: gallop through other for each
+        for (int i = 0, k = 0; i < c->n; i++) {
+            k = gallop16(other->values, k, other->n, values[i]);
+            if (k == other->n) break;
+            if (other->values[k] == values[i]) n = keep(out, n, values[i]);
+        }
+    } else if (other->n < c->n/GALLOP_RATIO) {
+        for (int i = 0, k = 0; k < other->n; k++) {
+            i = gallop16(values, i, c->n, other->values[k]);
+            if (i == c->n) break;
+            if (values[i] == other->values[k]) n = keep(out, n, values[i++]);
+        }
+    } else {
+        for (int i = 0, k = 0; i < c->n && k < other->n; ) {
+            if (values[i] < other->values[k]) {
+                i++;
+            } else if (values[i] > other->values[k]) {
+                k++;
+            } else {
+                n = keep(out, n, values[i++]);
+                k++;
+            }
+        }
+    }
+    return n;
+}
+
+/** Keep only the values of array container c which are in other. */
+static void
+filterArray(Container* c, const Container* other) {
+    c->n = c->card = matchArray(c, other, c->values);
+}
+
+/** Return # of set bits in words[BITMAP_WORDS] from start through
+ *  last.
+ */
+static int
+countBitsRange(const uint64_t* words, int start, int last) {
+    int n = 0;
+    for (int w = start/64; w <= last/64; w++) {
+        int lo = (w == start/64) ? start % 64 : 0;
+        int hi = (w == last/64) ? last % 64 : 63;
+        n += __builtin_popcountll(words[w] & (~0ull >> (63 - hi)) &
+                                  (~0ull << lo));
+    }
+    return n;
+}
+
+/** Return # of elements common to containers a and b. */
+static int
+containerIntersectionSize(const Container* a, const Container* b) {
+    if (b->type == ARRAY || (b->type == RUN && a->type != ARRAY)) {
+        const Container* t = a; a = b; b = t;
+    }
+    // now a is an array if either is, else a run if either is
+    if (a->type == ARRAY) return matchArray(a, b, NULL);
+    int n = 0;
+    if (a->type == BITMAP) {
+        for (int w = 0; w < BITMAP_WORDS; w++) {
+            n += __builtin_popcountll(a->words[w] & b->words[w]);
+        }
+    } else if (b->type == BITMAP) {
+        for (int k = 0; k < a->n; k++) {
+            n += countBitsRange(b->words, a->runs[k].start, a->runs[k].last);
+        }
+    } else {
+        for (int i = 0, k = 0; i < a->n && k < b->n; ) {
+            int start = a->runs[i].start > b->runs[k].start
+                ? a->runs[i].start : b->runs[k].start;
+            int last = a->runs[i].last < b->runs[k].last
+                ? a->runs[i].last : b->runs[k].last;
+            if (start <= last) n += last - start + 1;
+            if (a->runs[i].last < b->runs[k].last) {
+                i++;
+            } else {
+                k++;
+            }
+        }
+    }
+    return n;
+}
+
+/** Set a to the intersection of a and b, which may leave a empty.
+ *  Returns < 0 on error.
+ */
+static int
+containerIntersection(Container* a, const Container* b) {
+    if (a->type == ARRAY) {
+        filterArray(a, b);
+        return 0;
+    }
+    if (b->type == ARRAY) {
+        Container c;
+        if (copyContainer(&c, b) < 0) return -1;
+        filterArray(&c, a);
+        freeContainer(a);
+        *a = c;
+        return 0;
+    }
+    uint64_t* words = a->type == BITMAP ? a->words : toBitmap(a);
+    if (words == NULL) return -1;
+    if (b->type == BITMAP) {
+        for (int w = 0; w < BITMAP_WORDS; w++) words[w] &= b->words[w];
+    } else {
+        uint64_t* bWords = toBitmap(b);
+        if (bWords == NULL) {
+            if (words != a->words) free(words);
+            return -1;
+        }
+        for (int w = 0; w < BITMAP_WORDS; w++) words[w] &= bWords[w];
+        free(bWords);
+    }
+    return setFromBitmap(a, words);
+}
+
+/** Remove from array container c the values which are in other,
+ *  stepping through both in order; may leave c empty.
+ */
+static void
+subtractArray(Container* c, const Container* other) {
+    uint16_t* values = c->values;
+    int n = 0;
+    for (int i = 0, k = 0; i < c->n; i++) {
+        uint16_t v = values[i];
+        int isIn;
+        if (other->type == BITMAP) {
+            isIn = (other->words[v/64] >> (v % 64)) & 1;
+        } else if (other->type == RUN) {
+            while (k < other->n && other->runs[k].last < v) k++;
+            isIn = k < other->n && other->runs[k].start <= v;
+        } else {
+            k = gallop16(other->values, k, other->n, v);
+            isIn = k < other->n && other->values[k] == v;
+        }
+        if (!isIn) values[n++] = v;
+    }
+    c->n = c->card = n;
+}
+
+/** Set a to the elements of a which are not in b, which may leave a
+ *  empty.  Returns < 0 on error.
+ */
+static int
+containerDifference(Container* a, const Container* b) {
+    if (a->type == ARRAY) {
+        subtractArray(a, b);
+        return 0;
+    }
+    uint64_t* words = a->type == BITMAP ? a->words : toBitmap(a);
+    if (words == NULL) return -1;
+    combineContainer(words, b, AND_NOT);
+    return setFromBitmap(a, words);
+}
+
+/** Set a to the elements in exactly one of a and b, which may leave a
+ *  empty.  Returns < 0 on error.
+ */
+static int
+containerSymmetricDifference(Container* a, const Container* b) {
+    if (a->type == ARRAY && b->type == ARRAY && a->n + b->n <= MAX_ARRAY) {
+        uint16_t* values = malloc((a->n + b->n)*sizeof(uint16_t));
+        if (values == NULL) return -1;
+        int iA = 0, iB = 0, n = 0;
+        while (iA < a->n && iB < b->n) {
+            if (a->values[iA] < b->values[iB]) {
+                values[n++] = a->values[iA++];
+            } else if (a->values[iA] > b->values[iB]) {
+                values[n++] = b->values[iB++];
+            } else {
+                iA++;
+                iB++;
+            }
+        }
+        while (iA < a->n) values[n++] = a->values[iA++];
+        while (iB < b->n) values[n++] = b->values[iB++];
+        free(a->values);
+        a->size = a->n + b->n;
+        a->values = values;
+        a->n = a->card = n;
+        return 0;
+    }
+    uint64_t* words = a->type == BITMAP ? a->words : toBitmap(a);
+    if (words == NULL) return -1;
+    combineContainer(words, b, XOR);
+    return setFromBitmap(a, words);
+}
+
+/*************************** Bitmap operations *************************/
+
+/** Return index of first container of r with key >= key. */
+static int
+findContainer(const Roaring* r, uint16_t key) {
+    int lo = 0, hi = r->nContainers;
+    while (lo < hi) {
+        int mid = lo + (hi - lo)/2;
+        if (r->containers[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void
+dropElements(Roaring* r) {
+    free(r->elements);
+    r->elements = NULL;
+}
+
+/** Return a new empty bitmap, NULL on error. */
+Roaring *newRoaring(void) {
+    return calloc(1, sizeof(Roaring));
+}
+
+/** Free all resources used by r. */
+void freeRoaring(Roaring *r) {
+    for (int i = 0; i < r->nContainers; i++) freeContainer(&r->containers[i]);
+    free(r->containers);
+    free(r->elements);
+    free(r);
+}
+
+/** Return # of elements in r. */
+int nElementsRoaring(const Roaring *r) {
+    return r->len;
+}
+
+/** Return non-zero iff r contains element. */
+int isInRoaring(const Roaring *r, int element) {
+    uint32_t u = biased(element);
+    int i = findContainer(r, u >> 16);
+    return i < r->nContainers && r->containers[i].key == u >> 16 &&
+        containerContains(&r->containers[i], u & 0xffff);
+}
+
+/** Add element to r.  Returns # of elements in r after addition. */
+int addRoaring(Roaring *r, int element) {
+    uint32_t u = biased(element);
+    int i = findContainer(r, u >> 16);
+    if (i == r->nContainers || r->containers[i].key != u >> 16) {
+        uint16_t* values = malloc(sizeof(uint16_t));
+        if (values == NULL) return -1;
+        if (reserve(&r->containers, &r->size, r->nContainers + 1,
+                    sizeof(Container), CHUNK_SIZE) < 0) {
+            free(values);
+            return -1;
+        }
+        memmove(&r->containers[i + 1], &r->containers[i],
+                (r->nContainers - i)*sizeof(Container));
+        values[0] = u & 0xffff;
+        r->containers[i] = (Container) {
+            .key = u >> 16, .type = ARRAY, .card = 1, .n = 1, .size = 1,
+            .values = values,
+        };
+        r->nContainers++;
+        dropElements(r);
+        return ++r->len;
+    }
+    int ret = containerAdd(&r->containers[i], u & 0xffff);
+    if (ret < 0) return -1;
+    if (ret > 0) {
+        dropElements(r);
+        r->len++;
+    }
+    return r->len;
+}
+
+/** Empty r */
+static int
+clearRoaring(Roaring* r) {
+    for (int i = 0; i < r->nContainers; i++) freeContainer(&r->containers[i]);
+    r->nContainers = r->len = 0;
+    dropElements(r);
+    return 0;
+}
+
+/** Set a to the union of a and b if isUnion, else to their symmetric
+ *  difference, in one pass over the containers of both.  Returns # of
+ *  elements in a.
+ */
+static int
+mergeRoaring(Roaring* a, const Roaring* b, int isUnion) {
+    if (a == b) return isUnion ? a->len : clearRoaring(a);
+    int n = a->nContainers + b->nContainers;
+    Container* containers = malloc((n + 1)*sizeof(Container));
+    Container* copies = malloc((b->nContainers + 1)*sizeof(Container));
+    if (containers == NULL || copies == NULL) {
+        free(containers);
+        free(copies);
+        return -1;
+    }
+
+    // copy the containers of b with keys not in a first, so a is still
+    // unchanged if that fails
+    int nCopies = 0;
+    for (int iA = 0, iB = 0; iB < b->nContainers; iB++) {
+        const Container* cB = &b->containers[iB];
+        while (iA < a->nContainers && a->containers[iA].key < cB->key) iA++;
+        if (iA < a->nContainers && a->containers[iA].key == cB->key) continue;
+        if (copyContainer(&copies[nCopies], cB) < 0) {
+            for (int i = 0; i < nCopies; i++) freeContainer(&copies[i]);
+            free(copies);
+            free(containers);
+            return -1;
+        }
+        nCopies++;
+    }
+
+    // a container of a which fails to merge is left as it was
+    int iA = 0, iB = 0, iCopy = 0, out = 0, len = 0, ret = 0;
+    while (iA < a->nContainers || iCopy < nCopies) {
+        int isFromA = iCopy == nCopies ||
+            (iA < a->nContainers && a->containers[iA].key < copies[iCopy].key);
+        if (isFromA) {
+            Container* cA = &a->containers[iA++];
+            while (iB < b->nContainers && b->containers[iB].key < cA->key) iB++;
+            if (ret == 0 && iB < b->nContainers &&
+                b->containers[iB].key == cA->key) {
+                const Container* cB = &b->containers[iB];
+                int r = isUnion ? containerUnion(cA, cB)
+                                : containerSymmetricDifference(cA, cB);
+                if (r < 0) ret = -1;
+            }
+            if (cA->card == 0) {
+                freeContainer(cA);
+                continue;
+            }
+            containers[out] = *cA;
+        } else {
+            containers[out] = copies[iCopy++];
+        }
+        len += containers[out++].card;
+    }
+    free(copies);
+    free(a->containers);
+    a->containers = containers;
+    a->nContainers = out;
+    a->size = n + 1;
+    a->len = len;
+    dropElements(a);
+    return ret < 0 ? ret : a->len;
+}
+
+/** Set a to the union of a and b.  Returns # of elements in a. */
+int unionRoaring(Roaring *a, const Roaring *b) {
+    return mergeRoaring(a, b, 1);
+}
+
+/** Set a to the elements in exactly one of a and b.  Returns # of
+ *  elements in a.
+ */
+int symmetricDifferenceRoaring(Roaring *a, const Roaring *b) {
+    return mergeRoaring(a, b, 0);
+}
+
+/** Set a to the intersection of a and b if isIntersection, else to
+ *  the elements of a not in b, in one pass over the containers of
+ *  both.  Returns # of elements in a.
+ */
+static int
+filterRoaring(Roaring* a, const Roaring* b, int isIntersection) {
+    if (a == b) return isIntersection ? a->len : clearRoaring(a);
+    int iB = 0, out = 0, len = 0, ret = 0;
+    for (int iA = 0; iA < a->nContainers; iA++) {
+        Container* cA = &a->containers[iA];
+        while (iB < b->nContainers && b->containers[iB].key < cA->key) iB++;
+        if (ret == 0 && iB < b->nContainers &&
+            b->containers[iB].key == cA->key) {
+            const Container* cB = &b->containers[iB];
+            int r = isIntersection ? containerIntersection(cA, cB)
+                                   : containerDifference(cA, cB);
+            if (r < 0) ret = -1;
+        } else if (ret == 0 && isIntersection) {
+            cA->card = 0;
+        }
+        if (cA->card == 0) {
+            freeContainer(cA);
+        } else {
+            len += cA->card;
+            a->containers[out++] = *cA;
+        }
+    }
+    a->nContainers = out;
+    a->len = len;
+    dropElements(a);
+    return ret < 0 ? ret : a->len;
+}
+
+/** Set a to the intersection of a and b.  Returns # of elements in
+ *  a.
+ */
+int intersectionRoaring(Roaring *a, const Roaring *b) {
+    return filterRoaring(a, b, 1);
+}
+
+/** Set a to the elements of a which are not in b.  Returns # of
+ *  elements in a.
+ */
+int differenceRoaring(Roaring *a, const Roaring *b) {
+    return filterRoaring(a, b, 0);
+}
+
+/** Return # of elements in the intersection of a and b. */
+int intersectionSizeRoaring(const Roaring *a, const Roaring *b) {
+    int n = 0;
+    for (int iA = 0, iB = 0; iA < a->nContainers && iB < b->nContainers; ) {
+        const Container* cA = &a->containers[iA];
+        const Container* cB = &b->containers[iB];
+        if (cA->key < cB->key) {
+            iA++;
+        } else if (cA->key > cB->key) {
+            iB++;
+        } else {
+            n += containerIntersectionSize(cA, cB);
+            iA++;
+            iB++;
+        }
+    }
+    return n;
+}
+
+/** Return the elements of r in increasing order, followed by a copy
+ *  of the last one.  The array is owned by r and is valid until r is
+ *  next changed.  Returns NULL on error.
+ */
+const int *elementsRoaring(Roaring *r) {
+    if (r->elements != NULL) return r->elements;
+    int* elements = malloc((r->len + 1)*sizeof(int));
+    if (elements == NULL) return NULL;
+    int n = 0;
+    for (int i = 0; i < r->nContainers; i++) {
+        const Container* c = &r->containers[i];
+        uint32_t high = (uint32_t)c->key << 16;
+        switch (c->type) {
+        case ARRAY:
+            for (int k = 0; k < c->n; k++) {
+                elements[n++] = unbiased(high | c->values[k]);
+            }
+            break;
+        case BITMAP:
+            for (int w = 0; w < BITMAP_WORDS; w++) {
+                for (uint64_t word = c->words[w]; word != 0; word &= word - 1) {
+                    elements[n++] =
+                        unbiased(high | (w*64 + __builtin_ctzll(word)));
+                }
+            }
+            break;
+        default:
+            for (int k = 0; k < c->n; k++) {
+                for (int v = c->runs[k].start; v <= c->runs[k].last; v++) {
+                    elements[n++] = unbiased(high | v);
+                }
+            }
+            break;
+        }
+    }
+    elements[n] = n > 0 ? elements[n - 1] : 0;
+    r->elements = elements;
+    return elements;
+}
@@ -0,0 +1,57 @@
+#ifndef ROARING_H_
+#define ROARING_H_
+
+/** Compressed bitmap of a set of int's in the style of Roaring
+ *  bitmaps, used for int-sets created with kind INT_SET_BITMAP.  The
+ *  ints are split into chunks of 64K consecutive values, and each
+ *  non-empty chunk is held in the smallest of three containers: a
+ *  sorted array of 16-bit offsets for sparse chunks, a 64K-bit bitmap
+ *  for dense ones, or a sorted array of runs of consecutive offsets.
+ *
+ *  Functions returning int return < 0 on error with errno set.
+ */
+typedef struct RoaringStruct Roaring;
+
+/** Return a new empty bitmap, NULL on error. */
+Roaring *newRoaring(void);
+
+/** Free all resources used by r. */
+void freeRoaring(Roaring *r);
+
+/** Return # of elements in r. */
+int nElementsRoaring(const Roaring *r);
+
+/** Return non-zero iff r contains element. */
+int isInRoaring(const Roaring *r, int element);
+
+/** Add element to r.  Returns # of elements in r after addition. */
+int addRoaring(Roaring *r, int element);
+
+/** Set a to the union of a and b.  Returns # of elements in a. */
+int unionRoaring(Roaring *a, const Roaring *b);
+
+/** Set a to the intersection of a and b.  Returns # of elements in
+ *  a.
+ */
+int intersectionRoaring(Roaring *a, const Roaring *b);
+
+/** Set a to the elements of a which are not in b.  Returns # of
+ *  elements in a.
+ */
+int differenceRoaring(Roaring *a, const Roaring *b);
+
+/** Set a to the elements in exactly one of a and b.  Returns # of
+ *  elements in a.
+ */
+int symmetricDifferenceRoaring(Roaring *a, const Roaring *b);
+
+/** Return # of elements in the intersection of a and b. */
+int intersectionSizeRoaring(const Roaring *a, const Roaring *b);
+
+/** Return the elements of r in increasing order, followed by a copy
+ *  of the last one.  The array is owned by r and is valid until r is
+ *  next changed.  Returns NULL on error.
+ */
+const int *elementsRoaring(Roaring *r);
+
+#endif //ifndef ROARING_H_
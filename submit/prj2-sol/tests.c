@@ -1,9 +1,11 @@
 #include "int-set.h"
 #include "int-set-strings.h"
+#include "intersect.h"
 
 #include <check.h>
 
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 
 /*************************** newIntSet() Tests *************************/
@@ -97,6 +99,75 @@ START_TEST(multiAdd)
 }
 END_TEST
 
+static int
+compareInts(const void *p1, const void *p2)
+{
+  int i1 = *(const int *)p1, i2 = *(const int *)p2;
+  return (i1 > i2) - (i1 < i2);
+}
+
+/** Check that adding elements[n] to set, which already contains
+ *  old[nOld] in order, gives the sorted union of the two.
+ */
+static void
+checkAddMultiple(void *set, const int old[], int nOld,
+                 const int elements[], int n)
+{
+  int *expected = malloc((nOld + n) * sizeof(int));
+  ck_assert_ptr_ne(expected, NULL);
+  for (int i = 0; i < nOld; i++) expected[i] = old[i];
+  for (int i = 0; i < n; i++) expected[nOld + i] = elements[i];
+  qsort(expected, nOld + n, sizeof(int), compareInts);
+  int nExpected = 0;
+  for (int i = 0; i < nOld + n; i++) {
+    if (nExpected == 0 || expected[i] != expected[nExpected - 1]) {
+      expected[nExpected++] = expected[i];
+    }
+  }
+  ck_assert_int_eq(addMultipleIntSet(set, elements, n), nExpected);
+  int i = 0;
+  for (const void *iter = newIntSetIterator(set); iter != NULL;
+       iter = stepIntSetIterator(iter)) {
+    ck_assert_int_lt(i, nExpected);
+    ck_assert_int_eq(intSetIteratorElement(iter), expected[i++]);
+  }
+  ck_assert_int_eq(i, nExpected);
+  free(expected);
+}
+
+/** Add many unsorted elements with duplicates, spanning all of int and
+ *  overlapping the existing elements, to sets of each kind.
+ */
+START_TEST(bulkAdd)
+{
+  enum { N = 20000 };
+  static int elements[N];
+  const int old[] = { -70000, 0, 3, 1000, 65536, 200000 };
+  const int nOld = sizeof(old)/sizeof(old[0]);
+  srand(7);
+  for (int i = 0; i < N; i++) {
+    switch (i % 4) {
+    case 0: elements[i] = rand() % 1000 - 500; break;       //duplicates
+    case 1: elements[i] = (int)((unsigned)rand() << 16 ^ rand()); break;
+    case 2: elements[i] = -(rand() % 300000); break;
+    default: elements[i] = old[i % nOld]; break;
+    }
+  }
+  elements[N/2] = INT_MIN;
+  elements[N/3] = INT_MAX;
+  for (IntSetKind kind = INT_SET_ARRAY; kind <= INT_SET_BITMAP; kind++) {
+    void *set = newIntSetOfKind(kind);
+    checkAddMultiple(set, NULL, 0, old, nOld);    //already sorted
+    checkAddMultiple(set, old, nOld, elements, N);
+    freeIntSet(set);
+    set = newIntSetOfKind(kind);
+    checkAddMultiple(set, NULL, 0, elements, 10);  //small
+    ck_assert_int_eq(addMultipleIntSet(set, elements, 0),
+                     nElementsIntSet(set));
+    freeIntSet(set);
+  }
+}
+END_TEST
 
 static Suite *
 addMultipleIntSetSuite(void)
@@ -104,6 +175,7 @@ addMultipleIntSetSuite(void)
   Suite *suite = suite_create("addMultipleIntSet");
   TCase *tests = tcase_create("addMultiple");
   tcase_add_test(tests, multiAdd);
+  tcase_add_test(tests, bulkAdd);
   suite_add_tcase(suite, tests);
   return suite;
 }
@@ -481,6 +553,27 @@ START_TEST(interleavedUnion)
 }
 END_TEST
 
+/** A set much larger than the other, so its elements are skipped by
+ *  galloping
+ */
+START_TEST(skewedUnion)
+{
+  int elements1[1000];
+  for (int i = 0; i < 1000; i++) elements1[i] = 2*i;
+  const int elements2[] = { -1, 0, 501, 998, 2001 };
+  int unionElements[1003];
+  int n = 0;
+  unionElements[n++] = -1;
+  for (int i = 0; i < 1000; i++) {
+    unionElements[n++] = 2*i;
+    if (2*i == 500) unionElements[n++] = 501;
+  }
+  unionElements[n++] = 2001;
+  unionTest(elements1, 1000, elements2, 5, unionElements, n);
+  unionTest(elements2, 5, elements1, 1000, unionElements, n);
+}
+END_TEST
+
 static Suite *
 unionIntSetSuite(void)
 {
@@ -493,6 +586,7 @@ unionIntSetSuite(void)
   tcase_add_test(unionTests, largerSmallerUnion);
   tcase_add_test(unionTests, equalUnion);
   tcase_add_test(unionTests, interleavedUnion);
+  tcase_add_test(unionTests, skewedUnion);
   suite_add_tcase(suite, unionTests);
   return suite;
 }
@@ -546,6 +640,91 @@ START_TEST(disjointNonEmptySet)
 }
 END_TEST
 
+START_TEST(skewedIntersection)
+{
+  int elements1[1000];
+  for (int i = 0; i < 1000; i++) elements1[i] = 2*i;
+  const int elements2[] = { -1, 0, 501, 998, 1998, 2001 };
+  const int nElements2 = sizeof(elements2)/sizeof(elements2[0]);
+  const int intersectionElements[] = { 0, 998, 1998 };
+  intersectionTest(elements1, 1000, elements2, nElements2,
+                   intersectionElements, 3);
+  intersectionTest(elements2, nElements2, elements1, 1000,
+                   intersectionElements, 3);
+}
+END_TEST
+
+START_TEST(intersectionSize)
+{
+  void *set1 = newIntSet();
+  void *set2 = newIntSet();
+  for (int i = 0; i < 1000; i++) addIntSet(set1, 2*i);
+  for (int i = 0; i < 1000; i++) addIntSet(set2, 3*i);
+  ck_assert_int_eq(intersectionSizeIntSet(set1, set2), 334);
+  ck_assert_int_eq(nElementsIntSet(set1), 1000);
+  ck_assert_int_eq(nElementsIntSet(set2), 1000);
+  ck_assert_int_eq(intersectionIntSet(set1, set2), 334);
+  freeIntSet(set1);
+  freeIntSet(set2);
+}
+END_TEST
+
+/** Fill a[n] with sorted distinct pseudo-random ints, about density
+ *  of 1 in each k
+ */
+static void
+randomSorted(int a[], int n, int k)
+{
+  int v = -n*k/2;
+  for (int i = 0; i < n; i++) {
+    v += 1 + rand() % (2*k - 1);
+    a[i] = v;
+  }
+}
+
+/** Check each intersection kernel against a plain merge, over arrays
+ *  of all lengths up to a few blocks, which exercises the handling of
+ *  partial blocks at the ends, both into a separate array and in
+ *  place.
+ */
+START_TEST(intersectionKernels)
+{
+  enum { MAX_N = 40, MAX_OUT = MAX_N + INTERSECT_SLACK };
+  srand(11);
+  for (int kernel = INTERSECT_SCALAR; kernel <= INTERSECT_AVX2; kernel++) {
+    if (useIntersectKernel(kernel) != kernel) continue;
+    for (int nA = 0; nA <= MAX_N; nA++) {
+      for (int nB = 0; nB <= MAX_N; nB++) {
+        int a[MAX_N], b[MAX_N], out[MAX_OUT], expected[MAX_N];
+        randomSorted(a, nA, 1 + nA % 3);
+        randomSorted(b, nB, 1 + nB % 4);
+        int nExpected = 0;
+        for (int i = 0, j = 0; i < nA && j < nB; ) {
+          if (a[i] < b[j]) {
+            i++;
+          }
+          else if (a[i] > b[j]) {
+            j++;
+          }
+          else {
+            expected[nExpected++] = a[i++];
+            j++;
+          }
+        }
+        int n = intersectSorted(a, nA, b, nB, out);
+        ck_assert_int_eq(n, nExpected);
+        for (int i = 0; i < n; i++) ck_assert_int_eq(out[i], expected[i]);
+        ck_assert_int_eq(countIntersectSorted(a, nA, b, nB), nExpected);
+        n = intersectSorted(a, nA, b, nB, a);   //in place
+        ck_assert_int_eq(n, nExpected);
+        for (int i = 0; i < n; i++) ck_assert_int_eq(a[i], expected[i]);
+      }
+    }
+  }
+  useIntersectKernel(INTERSECT_AVX2);   //best available
+}
+END_TEST
+
 static Suite *
 intersectionIntSetSuite(void)
 {
@@ -554,12 +733,389 @@ intersectionIntSetSuite(void)
   tcase_add_test(intersectionTests, emptyEmptyIntersection);
   tcase_add_test(intersectionTests, emptyNonEmptyIntersection);
   tcase_add_test(intersectionTests, disjointNonEmptySet);
+  tcase_add_test(intersectionTests, skewedIntersection);
+  tcase_add_test(intersectionTests, intersectionSize);
+  tcase_add_test(intersectionTests, intersectionKernels);
   //TODO: for each test added above tcase_add_test(intersectionTests, ...)
 
   suite_add_tcase(suite, intersectionTests);
   return suite;
 }
 
+/************************* bitmap IntSet Tests *************************/
+
+/** Check that set contains exactly elements[n] in order */
+static void
+checkElements(const void *set, const int elements[], int n)
+{
+  ck_assert_int_eq(nElementsIntSet((void *)set), n);
+  int i = 0;
+  for (const void *iter = newIntSetIterator(set); iter != NULL;
+       iter = stepIntSetIterator(iter)) {
+    ck_assert_int_lt(i, n);
+    ck_assert_int_eq(intSetIteratorElement(iter), elements[i++]);
+  }
+  ck_assert_int_eq(i, n);
+}
+
+/** Check that sets a and b have the same elements */
+static void
+checkSameElements(void *a, void *b)
+{
+  int n = nElementsIntSet(b);
+  int *elements = malloc((n + 1) * sizeof(int));
+  int i = 0;
+  for (const void *iter = newIntSetIterator(b); iter != NULL;
+       iter = stepIntSetIterator(iter)) {
+    elements[i++] = intSetIteratorElement(iter);
+  }
+  checkElements(a, elements, i);
+  free(elements);
+}
+
+START_TEST(bitmapAddIsIn)
+{
+  void *set = newIntSetOfKind(INT_SET_BITMAP);
+  const int elements[] = { 33, -53, 54, 2, 0, -1, 33, 70000, -70000, };
+  const int nElements = sizeof(elements)/sizeof(elements[0]);
+  int n = addMultipleIntSet(set, elements, nElements);
+  ck_assert_int_eq(n, nElements - 1);
+  for (int i = 0; i < nElements; i++) {
+    ck_assert_int_eq(isInIntSet(set, elements[i]), 1);
+  }
+  ck_assert_int_eq(isInIntSet(set, 1), 0);
+  ck_assert_int_eq(isInIntSet(set, 65536 + 33), 0);
+  checkElements(set, (int[8]) { -70000, -53, -1, 0, 2, 33, 54, 70000 }, 8);
+  freeIntSet(set);
+}
+END_TEST
+
+START_TEST(bitmapExtremes)
+{
+  void *set = newIntSetOfKind(INT_SET_BITMAP);
+  const int elements[] = { 2147483647, -2147483647 - 1, 0, -1 };
+  addMultipleIntSet(set, elements, 4);
+  checkElements(set, (int[4]) { -2147483647 - 1, -1, 0, 2147483647 }, 4);
+  freeIntSet(set);
+}
+END_TEST
+
+/** Add the same pseudo-random ints to a bitmap and an array set,
+ *  dense enough to give array, bitmap and run containers, and check
+ *  that they stay equal.
+ */
+START_TEST(bitmapMatchesArray)
+{
+  void *bitmap = newIntSetOfKind(INT_SET_BITMAP);
+  void *array = newIntSet();
+  srand(42);
+  for (int i = 0; i < 200000; i++) {
+    int v;
+    switch (i % 4) {
+    case 0: v = rand() % 1000000; break;              //sparse
+    case 1: v = 300000 + rand() % 20000; break;        //dense
+    default: v = -100000 + i/2; break;                 //one long run
+    }
+    ck_assert_int_eq(addIntSet(bitmap, v), addIntSet(array, v));
+  }
+  checkSameElements(bitmap, array);
+  for (int v = -200000; v < 1100000; v += 7) {
+    ck_assert_int_eq(isInIntSet(bitmap, v), isInIntSet(array, v));
+  }
+  freeIntSet(bitmap);
+  freeIntSet(array);
+}
+END_TEST
+
+/** Fill set with n pseudo-random ints in [lo, lo + range) */
+static void
+addRandom(void *set, int n, int lo, int range)
+{
+  for (int i = 0; i < n; i++) addIntSet(set, lo + rand() % range);
+}
+
+/** Check bitmap union and intersection against those of array sets,
+ *  for all combinations of kinds.
+ */
+static void
+bitmapOpTest(int isUnion)
+{
+  int (*op)(void *, void *) = isUnion ? unionIntSet : intersectionIntSet;
+  srand(7);
+  for (int kinds = 0; kinds < 4; kinds++) {
+    void *a = newIntSetOfKind(kinds & 1 ? INT_SET_BITMAP : INT_SET_ARRAY);
+    void *b = newIntSetOfKind(kinds & 2 ? INT_SET_BITMAP : INT_SET_ARRAY);
+    void *a0 = newIntSet();
+    void *b0 = newIntSet();
+    for (int k = 0; k < 2; k++) {
+      void *set = k == 0 ? a : b, *set0 = k == 0 ? a0 : b0;
+      unsigned seed = rand();
+      for (int pass = 0; pass < 2; pass++) {
+        srand(seed);
+        void *s = pass == 0 ? set : set0;
+        addRandom(s, 3000, -70000, 140000);        //sparse
+        addRandom(s, 30000, 200000, 40000);        //dense
+        for (int v = 655360 + k*20000; v < 655360 + 70000; v++) {
+          addIntSet(s, v);                         //runs
+        }
+      }
+    }
+    if (!isUnion) {
+      ck_assert_int_eq(intersectionSizeIntSet(a, b),
+                       intersectionSizeIntSet(a0, b0));
+    }
+    int n = op(a, b);
+    ck_assert_int_eq(n, op(a0, b0));
+    checkSameElements(a, a0);
+    freeIntSet(a);
+    freeIntSet(b);
+    freeIntSet(a0);
+    freeIntSet(b0);
+  }
+}
+
+START_TEST(bitmapUnion)
+{
+  bitmapOpTest(1);
+}
+END_TEST
+
+/** Intersection of bitmaps with array containers of very different
+ *  sizes
+ */
+START_TEST(bitmapSkewedIntersection)
+{
+  void *a = newIntSetOfKind(INT_SET_BITMAP);
+  void *b = newIntSetOfKind(INT_SET_BITMAP);
+  for (int i = 0; i < 4000; i++) addIntSet(a, 7*i);
+  const int elements[] = { -7, 0, 700, 701, 27993, 28000 };
+  addMultipleIntSet(b, elements, sizeof(elements)/sizeof(elements[0]));
+  void *c = newIntSetOfKind(INT_SET_BITMAP);
+  unionIntSet(c, b);
+  ck_assert_int_eq(intersectionIntSet(c, a), 3);
+  checkElements(c, (int[3]) { 0, 700, 27993 }, 3);
+  ck_assert_int_eq(intersectionIntSet(a, b), 3);
+  checkElements(a, (int[3]) { 0, 700, 27993 }, 3);
+  freeIntSet(a);
+  freeIntSet(b);
+  freeIntSet(c);
+}
+END_TEST
+
+START_TEST(bitmapIntersection)
+{
+  bitmapOpTest(0);
+}
+END_TEST
+
+static Suite *
+bitmapIntSetSuite(void)
+{
+  Suite *suite = suite_create("bitmapIntSet");
+  TCase *tests = tcase_create("bitmap");
+  tcase_add_test(tests, bitmapAddIsIn);
+  tcase_add_test(tests, bitmapExtremes);
+  tcase_add_test(tests, bitmapMatchesArray);
+  tcase_add_test(tests, bitmapUnion);
+  tcase_add_test(tests, bitmapIntersection);
+  tcase_add_test(tests, bitmapSkewedIntersection);
+  suite_add_tcase(suite, tests);
+  return suite;
+}
+
+/************************** set algebra Tests **************************/
+
+/** Return a new set of kind with the ints in [lo, hi) which are
+ *  multiples of k
+ */
+static void *
+multiplesSet(IntSetKind kind, int lo, int hi, int k)
+{
+  void *set = newIntSetOfKind(kind);
+  for (int v = lo; v < hi; v++) {
+    if (v % k == 0) addIntSet(set, v);
+  }
+  return set;
+}
+
+/** Return # of ints in [lo, hi) which are multiples of k */
+static int
+nMultiples(int lo, int hi, int k)
+{
+  int n = 0;
+  for (int v = lo; v < hi; v++) n += v % k == 0;
+  return n;
+}
+
+/** Check difference and symmetric difference of the even and the
+ *  multiple of 3 ints in ranges chosen to give all kinds of bitmap
+ *  containers, over all combinations of kinds, against membership.
+ */
+START_TEST(differences)
+{
+  enum { LO = -100000, HI = 300000 };
+  for (int kinds = 0; kinds < 4; kinds++) {
+    IntSetKind kindA = kinds & 1 ? INT_SET_BITMAP : INT_SET_ARRAY;
+    IntSetKind kindB = kinds & 2 ? INT_SET_BITMAP : INT_SET_ARRAY;
+    void *a = multiplesSet(kindA, LO, HI, 2);
+    void *b = multiplesSet(kindB, 0, HI + 100000, 3);
+    addIntSet(b, -7);
+    ck_assert_int_eq(differenceIntSet(a, b),
+                     nMultiples(LO, HI, 2) - nMultiples(0, HI, 6));
+    for (int v = LO - 10; v < HI + 10; v += 1) {
+      ck_assert_int_eq(isInIntSet(a, v), v >= LO && v < HI && v % 2 == 0 &&
+                       !(v >= 0 && v % 3 == 0));
+    }
+    freeIntSet(a);
+
+    a = multiplesSet(kindA, LO, HI, 2);
+    int n = symmetricDifferenceIntSet(a, b);
+    int nExpected = 0;
+    for (int v = LO - 10; v < HI + 100010; v += 1) {
+      int inA = v >= LO && v < HI && v % 2 == 0;
+      int inB = (v >= 0 && v < HI + 100000 && v % 3 == 0) || v == -7;
+      ck_assert_int_eq(isInIntSet(a, v), inA != inB);
+      nExpected += inA != inB;
+    }
+    ck_assert_int_eq(n, nExpected);
+    freeIntSet(a);
+    freeIntSet(b);
+  }
+}
+END_TEST
+
+/** Differences of a set with itself and with much smaller sets */
+START_TEST(skewedDifferences)
+{
+  for (IntSetKind kind = INT_SET_ARRAY; kind <= INT_SET_BITMAP; kind++) {
+    void *a = multiplesSet(kind, 0, 10000, 1);
+    ck_assert_int_eq(differenceIntSet(a, a), 0);
+    ck_assert_ptr_eq((void *)newIntSetIterator(a), NULL);
+    freeIntSet(a);
+    a = multiplesSet(kind, 0, 10000, 1);
+    ck_assert_int_eq(symmetricDifferenceIntSet(a, a), 0);
+    freeIntSet(a);
+
+    a = multiplesSet(kind, 0, 10000, 1);
+    void *b = newIntSetOfKind(kind);
+    const int elements[] = { -5, 0, 17, 5000, 9999, 10000 };
+    addMultipleIntSet(b, elements, sizeof(elements)/sizeof(elements[0]));
+    ck_assert_int_eq(differenceIntSet(a, b), 10000 - 4);
+    for (int v = -10; v < 10010; v++) {
+      ck_assert_int_eq(isInIntSet(a, v), v > 0 && v < 9999 && v != 17 &&
+                       v != 5000);
+    }
+    freeIntSet(a);
+    a = multiplesSet(kind, 0, 10000, 1);
+    ck_assert_int_eq(differenceIntSet(b, a), 2);
+    checkElements(b, (int[2]) { -5, 10000 }, 2);
+    freeIntSet(a);
+    freeIntSet(b);
+  }
+}
+END_TEST
+
+START_TEST(subsetAndEquals)
+{
+  for (int kinds = 0; kinds < 4; kinds++) {
+    IntSetKind kindA = kinds & 1 ? INT_SET_BITMAP : INT_SET_ARRAY;
+    IntSetKind kindB = kinds & 2 ? INT_SET_BITMAP : INT_SET_ARRAY;
+    void *a = multiplesSet(kindA, -1000, 100000, 6);
+    void *b = multiplesSet(kindB, -1000, 100000, 3);
+    void *c = multiplesSet(kindB, -1000, 100000, 6);
+    ck_assert_int_eq(isSubsetIntSet(a, b), 1);
+    ck_assert_int_eq(isSubsetIntSet(b, a), 0);
+    ck_assert_int_eq(isSubsetIntSet(a, c), 1);
+    ck_assert_int_eq(equalsIntSet(a, c), 1);
+    ck_assert_int_eq(equalsIntSet(a, b), 0);
+    addIntSet(c, 1);
+    ck_assert_int_eq(isSubsetIntSet(a, c), 1);
+    ck_assert_int_eq(isSubsetIntSet(c, a), 0);
+    ck_assert_int_eq(equalsIntSet(a, c), 0);
+    addIntSet(a, 5);
+    ck_assert_int_eq(nElementsIntSet(a), nElementsIntSet(c));
+    ck_assert_int_eq(equalsIntSet(a, c), 0);
+    ck_assert_int_eq(isSubsetIntSet(a, b), 0);
+    freeIntSet(a);
+    freeIntSet(b);
+    freeIntSet(c);
+  }
+}
+END_TEST
+
+enum { N_ALL = 5 };
+
+/** Return sets of alternating kinds of the multiples of 2, 3, 5, 7 and
+ *  11 in overlapping ranges.
+ */
+static void
+allSets(void *sets[N_ALL])
+{
+  const int ks[N_ALL] = { 2, 3, 5, 7, 11 };
+  for (int i = 0; i < N_ALL; i++) {
+    IntSetKind kind = i % 2 ? INT_SET_BITMAP : INT_SET_ARRAY;
+    sets[i] = multiplesSet(kind, -20000*i, 100000 - 10000*i, ks[i]);
+  }
+}
+
+START_TEST(unionAll)
+{
+  for (IntSetKind kind = INT_SET_ARRAY; kind <= INT_SET_BITMAP; kind++) {
+    void *sets[N_ALL];
+    allSets(sets);
+    void *set = multiplesSet(kind, 90000, 200000, 13);
+    void *expected = newIntSet();
+    unionIntSet(expected, set);
+    for (int i = 0; i < N_ALL; i++) unionIntSet(expected, sets[i]);
+    ck_assert_int_eq(unionAllIntSet(set, sets, N_ALL),
+                     nElementsIntSet(expected));
+    checkSameElements(set, expected);
+    ck_assert_int_eq(unionAllIntSet(set, NULL, 0), nElementsIntSet(expected));
+    freeIntSet(set);
+    freeIntSet(expected);
+    for (int i = 0; i < N_ALL; i++) freeIntSet(sets[i]);
+  }
+}
+END_TEST
+
+START_TEST(intersectionAll)
+{
+  for (IntSetKind kind = INT_SET_ARRAY; kind <= INT_SET_BITMAP; kind++) {
+    void *sets[N_ALL];
+    allSets(sets);
+    void *set = multiplesSet(kind, -100000, 100000, 1);
+    void *expected = newIntSet();
+    unionIntSet(expected, set);
+    for (int i = 0; i < N_ALL; i++) intersectionIntSet(expected, sets[i]);
+    ck_assert_int_gt(nElementsIntSet(expected), 0);
+    ck_assert_int_eq(intersectionAllIntSet(set, sets, N_ALL),
+                     nElementsIntSet(expected));
+    checkSameElements(set, expected);
+    void *last = sets[N_ALL - 1];
+    sets[N_ALL - 1] = newIntSet();        //empty
+    ck_assert_int_eq(intersectionAllIntSet(set, sets, N_ALL), 0);
+    freeIntSet(last);
+    freeIntSet(set);
+    freeIntSet(expected);
+    for (int i = 0; i < N_ALL; i++) freeIntSet(sets[i]);
+  }
+}
+END_TEST
+
+static Suite *
+setAlgebraIntSetSuite(void)
+{
+  Suite *suite = suite_create("setAlgebraIntSet");
+  TCase *tests = tcase_create("setAlgebra");
+  tcase_add_test(tests, differences);
+  tcase_add_test(tests, skewedDifferences);
+  tcase_add_test(tests, subsetAndEquals);
+  tcase_add_test(tests, unionAll);
+  tcase_add_test(tests, intersectionAll);
+  suite_add_tcase(suite, tests);
+  return suite;
+}
+
 /*************************** Main Test Function ************************/
 
 
@@ -575,6 +1131,8 @@ static SuiteMaker *makers[] = {
   snprintIntSetSuite,
   unionIntSetSuite,
   intersectionIntSetSuite,
+  bitmapIntSetSuite,
+  setAlgebraIntSetSuite,
 };
 
 
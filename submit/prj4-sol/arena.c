@@ -0,0 +1,65 @@
+#include "arena.h"
+
+#include "memalloc.h"
+
+#include <stdalign.h>
+#include <stdlib.h>
+
+/** Arena memory is carved from a list of chunks, most recent first.
+ *  Only the first chunk is ever allocated from.
+ */
+struct ArenaChunk {
+  ArenaChunk *next;
+  size_t size, used;        //bytes in data[], bytes handed out
+  max_align_t data[];
+};
+
+enum { ARENA_CHUNK_SIZE = 64*1024 };
+
+/** Return size bytes from arena, aligned for any type.  Never returns
+ *  NULL: running out of memory is fatal.
+ */
+void *
+arena_alloc(Arena *arena, size_t size)
+{
+  const size_t align = alignof(max_align_t);
+  size = (size + align - 1) & ~(align - 1);
+  ArenaChunk *chunk = arena->chunks;
+  if (chunk == NULL || chunk->size - chunk->used < size) {
+    size_t chunkSize = (size > ARENA_CHUNK_SIZE) ? size : ARENA_CHUNK_SIZE;
+    chunk = mallocChk(sizeof(ArenaChunk) + chunkSize);
+    chunk->size = chunkSize;
+    chunk->used = 0;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+  }
+  void *p = (char *)chunk->data + chunk->used;
+  chunk->used += size;
+  return p;
+}
+
+/** Move all memory allocated from arena from into arena to, leaving
+ *  from empty.
+ */
+void
+move_arena(Arena *to, Arena *from)
+{
+  if (from->chunks == NULL) return;
+  ArenaChunk *last = from->chunks;
+  while (last->next != NULL) last = last->next;
+  last->next = to->chunks;
+  to->chunks = from->chunks;
+  from->chunks = NULL;
+}
+
+/** Free all memory allocated from arena, leaving it empty. */
+void
+free_arena(Arena *arena)
+{
+  ArenaChunk *next;
+  for (ArenaChunk *chunk = arena->chunks; chunk != NULL; chunk = next) {
+    next = chunk->next;
+    free(chunk);
+  }
+  arena->chunks = NULL;
+}
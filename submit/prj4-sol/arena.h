@@ -0,0 +1,32 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+
+typedef struct ArenaChunk ArenaChunk;
+
+/** Bump allocator for many small objects which all live until the
+ *  arena itself is freed.  An arena is not thread-safe: each thread
+ *  should allocate from its own arena and hand its memory over with
+ *  move_arena().  Initialize with ARENA_INIT.
+ */
+typedef struct {
+  ArenaChunk *chunks;
+} Arena;
+
+#define ARENA_INIT { NULL }
+
+/** Return size bytes from arena, aligned for any type.  Never returns
+ *  NULL: running out of memory is fatal.
+ */
+void *arena_alloc(Arena *arena, size_t size);
+
+/** Move all memory allocated from arena from into arena to, leaving
+ *  from empty.
+ */
+void move_arena(Arena *to, Arena *from);
+
+/** Free all memory allocated from arena, leaving it empty. */
+void free_arena(Arena *arena);
+
+#endif //ifndef ARENA_H_
@@ -0,0 +1,659 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "elf-file.h"
+
+#include "memalloc.h"
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** An ELF file mapped read-only in its entirety.  Sections and
+ *  segments are accessed in place; nothing is copied.
+ */
+typedef struct {
+  Elf64_Addr slot;           //vaddr of relocated pointer
+  Elf64_Addr target;         //vaddr it will hold once relocated
+} SlotTarget;
+
+struct ElfFileImpl {
+  const unsigned char *bytes;
+  size_t size;
+  const Elf64_Ehdr *ehdr;
+  const Elf64_Shdr *shdrs;   //NULL if no section headers
+  const Elf64_Phdr *phdrs;
+  SlotTarget *slots;         //sorted by slot; only this is not in place
+  int nSlots;
+};
+
+static void index_slots(ElfFile *elfFile);
+
+/** Map ELF file path.  Returns NULL with errno set on error; errno is
+ *  ENOEXEC if path is not a 64-bit x86-64 ELF file.
+ */
+ElfFile *
+open_elf_file(const char *path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return NULL;
+  }
+  size_t size = st.st_size;
+  void *bytes = (size < sizeof(Elf64_Ehdr))
+    ? MAP_FAILED
+    : mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (bytes == MAP_FAILED) {
+    if (size < sizeof(Elf64_Ehdr)) errno = ENOEXEC;
+    return NULL;
+  }
+  const Elf64_Ehdr *ehdr = bytes;
+  if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+      ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+      ehdr->e_machine != EM_X86_64 ||
+      ehdr->e_phoff + (size_t)ehdr->e_phnum*sizeof(Elf64_Phdr) > size ||
+      ehdr->e_shoff + (size_t)ehdr->e_shnum*sizeof(Elf64_Shdr) > size) {
+    munmap(bytes, size);
+    errno = ENOEXEC;
+    return NULL;
+  }
+  ElfFile *elfFile = mallocChk(sizeof(ElfFile));
+  elfFile->bytes = bytes;
+  elfFile->size = size;
+  elfFile->ehdr = ehdr;
+  elfFile->shdrs = (ehdr->e_shnum == 0)
+    ? NULL
+    : (const Elf64_Shdr *)(elfFile->bytes + ehdr->e_shoff);
+  elfFile->phdrs = (const Elf64_Phdr *)(elfFile->bytes + ehdr->e_phoff);
+  index_slots(elfFile);
+  return elfFile;
+}
+
+/** Unmap elfFile and free all its resources.  Pointers returned by
+ *  the functions below are invalid after this call.
+ */
+void
+close_elf_file(ElfFile *elfFile)
+{
+  munmap((void *)elfFile->bytes, elfFile->size);
+  free(elfFile->slots);
+  free(elfFile);
+}
+
+/** Return true iff section shdr lies within the file */
+static bool
+is_in_file(const ElfFile *elfFile, const Elf64_Shdr *shdr)
+{
+  return shdr->sh_type != SHT_NOBITS &&
+    shdr->sh_offset <= elfFile->size &&
+    shdr->sh_size <= elfFile->size - shdr->sh_offset;
+}
+
+
+/** Look for defined symbol name in symbol-table section symtab.
+ *  Returns pointer to its symbol entry, NULL if not found.
+ */
+static const Elf64_Sym *
+find_symbol(const ElfFile *elfFile, const Elf64_Shdr *symtab,
+            const char *name)
+{
+  if (symtab->sh_link >= elfFile->ehdr->e_shnum) return NULL;
+  const Elf64_Shdr *strtab = &elfFile->shdrs[symtab->sh_link];
+  if (!is_in_file(elfFile, symtab) || !is_in_file(elfFile, strtab)) {
+    return NULL;
+  }
+  const Elf64_Sym *syms =
+    (const Elf64_Sym *)(elfFile->bytes + symtab->sh_offset);
+  const char *strs = (const char *)(elfFile->bytes + strtab->sh_offset);
+  size_t nSyms = symtab->sh_size/sizeof(Elf64_Sym);
+  size_t nName = strlen(name);
+  for (size_t i = 0; i < nSyms; i++) {
+    const Elf64_Sym *sym = &syms[i];
+    if (sym->st_shndx == SHN_UNDEF || sym->st_shndx >= SHN_LORESERVE ||
+        sym->st_name + nName >= strtab->sh_size) {
+      continue;
+    }
+    if (strcmp(strs + sym->st_name, name) == 0) return sym;
+  }
+  return NULL;
+}
+
+/** Return pointer to the code of the defined symbol name, looked up
+ *  in .symtab and then .dynsym.  If codeLoP and codeHiP are not NULL,
+ *  set them to the bounds of the mapped executable segment containing
+ *  the symbol.  Returns NULL if there is no such symbol.
+ */
+void *
+elf_file_symbol(const ElfFile *elfFile, const char *name,
+                void **codeLoP, void **codeHiP)
+{
+  if (elfFile->shdrs == NULL) return NULL;
+  const Elf64_Sym *sym = NULL;
+  const Elf64_Word types[] = { SHT_SYMTAB, SHT_DYNSYM };
+  for (int t = 0; sym == NULL && t < sizeof(types)/sizeof(types[0]); t++) {
+    for (int i = 0; sym == NULL && i < elfFile->ehdr->e_shnum; i++) {
+      if (elfFile->shdrs[i].sh_type == types[t]) {
+        sym = find_symbol(elfFile, &elfFile->shdrs[i], name);
+      }
+    }
+  }
+  return (sym == NULL) ? NULL
+    : elf_file_code(elfFile, sym->st_value, codeLoP, codeHiP);
+}
+
+/** Return pointer to the mapped code at virtual address vaddr.  If
+ *  codeLoP and codeHiP are not NULL, set them to the bounds of the
+ *  mapped executable segment containing vaddr.  Returns NULL if vaddr
+ *  is not within the file part of an executable segment.
+ */
+void *
+elf_file_code(const ElfFile *elfFile, unsigned long vaddr,
+              void **codeLoP, void **codeHiP)
+{
+  for (int i = 0; i < elfFile->ehdr->e_phnum; i++) {
+    const Elf64_Phdr *phdr = &elfFile->phdrs[i];
+    if (phdr->p_type == PT_LOAD && (phdr->p_flags & PF_X) &&
+        phdr->p_vaddr <= vaddr && vaddr < phdr->p_vaddr + phdr->p_filesz &&
+        phdr->p_offset <= elfFile->size &&
+        phdr->p_filesz <= elfFile->size - phdr->p_offset) {
+      const unsigned char *lo = elfFile->bytes + phdr->p_offset;
+      if (codeLoP) *codeLoP = (void *)lo;
+      if (codeHiP) *codeHiP = (void *)(lo + phdr->p_filesz);
+      return (void *)(lo + (vaddr - phdr->p_vaddr));
+    }
+  }
+  return NULL;
+}
+
+/** Return true iff sym is a function defined in and exported by the
+ *  file.
+ */
+static bool
+is_export(const Elf64_Sym *sym)
+{
+  int bind = ELF64_ST_BIND(sym->st_info);
+  int visibility = ELF64_ST_VISIBILITY(sym->st_other);
+  return ELF64_ST_TYPE(sym->st_info) == STT_FUNC &&
+    (bind == STB_GLOBAL || bind == STB_WEAK) &&
+    (visibility == STV_DEFAULT || visibility == STV_PROTECTED) &&
+    sym->st_shndx != SHN_UNDEF && sym->st_shndx < SHN_LORESERVE;
+}
+
+/** Set *vaddrsP to a newly allocated array containing the virtual
+ *  addresses of all functions exported by elfFile, as listed in
+ *  .dynsym (or in .symtab if there is no .dynsym), and return its
+ *  length.  The caller must free() *vaddrsP.
+ */
+int
+elf_file_exports(const ElfFile *elfFile, unsigned long **vaddrsP)
+{
+  const Elf64_Shdr *symtab = NULL;
+  for (int i = 0; elfFile->shdrs && i < elfFile->ehdr->e_shnum; i++) {
+    const Elf64_Shdr *section = &elfFile->shdrs[i];
+    if (section->sh_type == SHT_DYNSYM ||
+        (section->sh_type == SHT_SYMTAB && symtab == NULL)) {
+      symtab = section;
+    }
+  }
+  int n = 0;
+  unsigned long *vaddrs = NULL;
+  if (symtab && is_in_file(elfFile, symtab)) {
+    const Elf64_Sym *syms =
+      (const Elf64_Sym *)(elfFile->bytes + symtab->sh_offset);
+    size_t nSyms = symtab->sh_size/sizeof(Elf64_Sym);
+    vaddrs = mallocChk((nSyms + 1)*sizeof(unsigned long));
+    for (size_t i = 0; i < nSyms; i++) {
+      if (is_export(&syms[i])) vaddrs[n++] = syms[i].st_value;
+    }
+  }
+  *vaddrsP = vaddrs;
+  return n;
+}
+
+typedef struct {
+  unsigned long vaddr, size;
+} FnSymbol;
+
+static int
+compare_fn_symbols(const void *p1, const void *p2)
+{
+  unsigned long v1 = ((const FnSymbol *)p1)->vaddr;
+  unsigned long v2 = ((const FnSymbol *)p2)->vaddr;
+  return (v1 > v2) - (v1 < v2);
+}
+
+/** Return the string at offset in string-table section strtab, which
+ *  must lie within the file, NULL if it does not lie within strtab.
+ */
+static const char *
+str_at(const ElfFile *elfFile, const Elf64_Shdr *strtab, Elf64_Word offset)
+{
+  const char *strs = (const char *)(elfFile->bytes + strtab->sh_offset);
+  if (offset >= strtab->sh_size ||
+      memchr(strs + offset, '\0', strtab->sh_size - offset) == NULL) {
+    return NULL;
+  }
+  return strs + offset;
+}
+
+/** Return true iff name is among the NULL-terminated names */
+static bool
+is_named(const char *name, const char *const names[])
+{
+  for (int i = 0; names[i] != NULL; i++) {
+    if (strcmp(name, names[i]) == 0) return true;
+  }
+  return false;
+}
+
+/** Return true iff name is that of a part split off from a function by
+ *  the compiler: NAME.cold or NAME.cold.N, as emitted by GCC and clang
+ *  for code they expect to be rarely run.
+ */
+static bool
+is_fn_part(const char *name)
+{
+  return strstr(name, ".cold") != NULL;
+}
+
+/** Set *fnsP to a newly allocated array containing the distinct
+ *  virtual addresses of functions defined in elfFile according to
+ *  .symtab and .dynsym, in increasing order, with the largest size
+ *  given for each, and return its length.  Only parts of functions are
+ *  included if isPart, and only functions with one of the
+ *  NULL-terminated names unless names is NULL.
+ */
+static int
+get_fn_symbols(const ElfFile *elfFile, bool isPart, const char *const names[],
+               FnSymbol **fnsP)
+{
+  bool isByName = isPart || names != NULL;
+  int n = 0;
+  FnSymbol *fns = NULL;
+  for (int i = 0; elfFile->shdrs && i < elfFile->ehdr->e_shnum; i++) {
+    const Elf64_Shdr *symtab = &elfFile->shdrs[i];
+    if ((symtab->sh_type != SHT_SYMTAB && symtab->sh_type != SHT_DYNSYM) ||
+        !is_in_file(elfFile, symtab) ||
+        symtab->sh_link >= elfFile->ehdr->e_shnum) {
+      continue;
+    }
+    const Elf64_Shdr *strtab = &elfFile->shdrs[symtab->sh_link];
+    if (isByName && !is_in_file(elfFile, strtab)) continue;
+    const Elf64_Sym *syms =
+      (const Elf64_Sym *)(elfFile->bytes + symtab->sh_offset);
+    size_t nSyms = symtab->sh_size/sizeof(Elf64_Sym);
+    fns = reallocChk(fns, (n + nSyms + 1)*sizeof(FnSymbol));
+    for (size_t j = 0; j < nSyms; j++) {
+      const Elf64_Sym *sym = &syms[j];
+      if (ELF64_ST_TYPE(sym->st_info) != STT_FUNC ||
+          sym->st_shndx == SHN_UNDEF || sym->st_shndx >= SHN_LORESERVE) {
+        continue;
+      }
+      const char *name = isByName ? str_at(elfFile, strtab, sym->st_name) : NULL;
+      if (isByName && (name == NULL || (isPart && !is_fn_part(name)) ||
+                       (names != NULL && !is_named(name, names)))) {
+        continue;
+      }
+      fns[n++] = (FnSymbol) { sym->st_value, sym->st_size };
+    }
+  }
+  if (n > 0) {
+    qsort(fns, n, sizeof(FnSymbol), compare_fn_symbols);
+    int nUnique = 1;
+    for (int i = 1; i < n; i++) {
+      if (fns[i].vaddr != fns[nUnique - 1].vaddr) {
+        fns[nUnique++] = fns[i];
+      }
+      else if (fns[i].size > fns[nUnique - 1].size) {
+        fns[nUnique - 1].size = fns[i].size;
+      }
+    }
+    n = nUnique;
+  }
+  *fnsP = fns;
+  return n;
+}
+
+/** Set *vaddrsP to a newly allocated array containing the distinct
+ *  virtual addresses of all functions defined in elfFile according to
+ *  .symtab and .dynsym, in increasing order, and return its length.
+ *  If sizesP is not NULL, *sizesP is set to a newly allocated array
+ *  of their sizes in bytes, 0 where unknown.  The caller must free()
+ *  *vaddrsP and *sizesP.
+ */
+int
+elf_file_functions(const ElfFile *elfFile, unsigned long **vaddrsP,
+                   unsigned long **sizesP)
+{
+  FnSymbol *fns;
+  int n = get_fn_symbols(elfFile, false, NULL, &fns);
+  unsigned long *vaddrs = mallocChk((n + 1)*sizeof(unsigned long));
+  unsigned long *sizes =
+    sizesP ? mallocChk((n + 1)*sizeof(unsigned long)) : NULL;
+  for (int i = 0; i < n; i++) {
+    vaddrs[i] = fns[i].vaddr;
+    if (sizes) sizes[i] = fns[i].size;
+  }
+  free(fns);
+  *vaddrsP = vaddrs;
+  if (sizesP) *sizesP = sizes;
+  return n;
+}
+
+/** Set *vaddrsP to a newly allocated array containing the distinct
+ *  virtual addresses of the parts split off from functions by the
+ *  compiler, such as GCC's NAME.cold partitions, in increasing order,
+ *  and return its length.  They are among those returned by
+ *  elf_file_functions(), but a part is only entered by jumps from the
+ *  function it belongs to.  The caller must free() *vaddrsP.
+ */
+int
+elf_file_fn_parts(const ElfFile *elfFile, unsigned long **vaddrsP)
+{
+  FnSymbol *fns;
+  int n = get_fn_symbols(elfFile, true, NULL, &fns);
+  unsigned long *vaddrs = mallocChk((n + 1)*sizeof(unsigned long));
+  for (int i = 0; i < n; i++) vaddrs[i] = fns[i].vaddr;
+  free(fns);
+  *vaddrsP = vaddrs;
+  return n;
+}
+
+/** Set *vaddrsP to a newly allocated array containing the distinct
+ *  virtual addresses of the functions defined in elfFile under one of
+ *  the NULL-terminated names, in increasing order, and return its
+ *  length.  The caller must free() *vaddrsP.
+ */
+int
+elf_file_named_fns(const ElfFile *elfFile, const char *const names[],
+                   unsigned long **vaddrsP)
+{
+  FnSymbol *fns;
+  int n = get_fn_symbols(elfFile, false, names, &fns);
+  unsigned long *vaddrs = mallocChk((n + 1)*sizeof(unsigned long));
+  for (int i = 0; i < n; i++) vaddrs[i] = fns[i].vaddr;
+  free(fns);
+  *vaddrsP = vaddrs;
+  return n;
+}
+
+static int
+compare_vaddrs(const void *p1, const void *p2)
+{
+  unsigned long v1 = *(const unsigned long *)p1;
+  unsigned long v2 = *(const unsigned long *)p2;
+  return (v1 > v2) - (v1 < v2);
+}
+
+/** Set *vaddrsP to a newly allocated array containing the distinct
+ *  virtual addresses of the pointer slots (for example GOT entries)
+ *  which the dynamic linker fills with the address of a symbol with
+ *  one of the NULL-terminated names, defined in elfFile or not, in
+ *  increasing order, and return its length.  The caller must free()
+ *  *vaddrsP.
+ */
+int
+elf_file_named_slots(const ElfFile *elfFile, const char *const names[],
+                     unsigned long **vaddrsP)
+{
+  int n = 0;
+  unsigned long *vaddrs = mallocChk(sizeof(unsigned long));
+  for (int i = 0; elfFile->shdrs && i < elfFile->ehdr->e_shnum; i++) {
+    const Elf64_Shdr *rela = &elfFile->shdrs[i];
+    if (rela->sh_type != SHT_RELA || !is_in_file(elfFile, rela) ||
+        rela->sh_link >= elfFile->ehdr->e_shnum) {
+      continue;
+    }
+    const Elf64_Shdr *symtab = &elfFile->shdrs[rela->sh_link];
+    if (!is_in_file(elfFile, symtab) ||
+        symtab->sh_link >= elfFile->ehdr->e_shnum ||
+        !is_in_file(elfFile, &elfFile->shdrs[symtab->sh_link])) {
+      continue;
+    }
+    const Elf64_Shdr *strtab = &elfFile->shdrs[symtab->sh_link];
+    const Elf64_Sym *syms =
+      (const Elf64_Sym *)(elfFile->bytes + symtab->sh_offset);
+    size_t nSyms = symtab->sh_size/sizeof(Elf64_Sym);
+    const Elf64_Rela *relas =
+      (const Elf64_Rela *)(elfFile->bytes + rela->sh_offset);
+    size_t nRelas = rela->sh_size/sizeof(Elf64_Rela);
+    vaddrs = reallocChk(vaddrs, (n + nRelas + 1)*sizeof(unsigned long));
+    for (size_t j = 0; j < nRelas; j++) {
+      const Elf64_Rela *r = &relas[j];
+      int type = ELF64_R_TYPE(r->r_info);
+      size_t symIndex = ELF64_R_SYM(r->r_info);
+      if ((type != R_X86_64_JUMP_SLOT && type != R_X86_64_GLOB_DAT &&
+           type != R_X86_64_64) || symIndex == 0 || symIndex >= nSyms) {
+        continue;
+      }
+      const char *name = str_at(elfFile, strtab, syms[symIndex].st_name);
+      if (name != NULL && is_named(name, names)) vaddrs[n++] = r->r_offset;
+    }
+  }
+  if (n > 0) {
+    qsort(vaddrs, n, sizeof(unsigned long), compare_vaddrs);
+    int nUnique = 1;
+    for (int i = 1; i < n; i++) {
+      if (vaddrs[i] != vaddrs[nUnique - 1]) vaddrs[nUnique++] = vaddrs[i];
+    }
+    n = nUnique;
+  }
+  *vaddrsP = vaddrs;
+  return n;
+}
+
+static int
+compare_slots(const void *p1, const void *p2)
+{
+  const SlotTarget *s1 = p1, *s2 = p2;
+  return (s1->slot > s2->slot) - (s1->slot < s2->slot);
+}
+
+/** Build the sorted index of pointer slots which the dynamic linker
+ *  will fill with addresses defined within elfFile.  Slots filled with
+ *  addresses from other modules are not included.
+ */
+static void
+index_slots(ElfFile *elfFile)
+{
+  elfFile->slots = NULL;
+  elfFile->nSlots = 0;
+  for (int i = 0; elfFile->shdrs && i < elfFile->ehdr->e_shnum; i++) {
+    const Elf64_Shdr *rela = &elfFile->shdrs[i];
+    if (rela->sh_type != SHT_RELA || !is_in_file(elfFile, rela) ||
+        rela->sh_link >= elfFile->ehdr->e_shnum) {
+      continue;
+    }
+    const Elf64_Shdr *symtab = &elfFile->shdrs[rela->sh_link];
+    const Elf64_Sym *syms = is_in_file(elfFile, symtab)
+      ? (const Elf64_Sym *)(elfFile->bytes + symtab->sh_offset) : NULL;
+    size_t nSyms = syms ? symtab->sh_size/sizeof(Elf64_Sym) : 0;
+    const Elf64_Rela *relas =
+      (const Elf64_Rela *)(elfFile->bytes + rela->sh_offset);
+    size_t nRelas = rela->sh_size/sizeof(Elf64_Rela);
+    elfFile->slots = reallocChk(elfFile->slots,
+                                (elfFile->nSlots + nRelas)*sizeof(SlotTarget));
+    for (size_t j = 0; j < nRelas; j++) {
+      const Elf64_Rela *r = &relas[j];
+      size_t symIndex = ELF64_R_SYM(r->r_info);
+      const Elf64_Sym *sym = (symIndex < nSyms) ? &syms[symIndex] : NULL;
+      bool isDefined = sym && sym->st_shndx != SHN_UNDEF;
+      Elf64_Addr target;
+      switch (ELF64_R_TYPE(r->r_info)) {
+      case R_X86_64_RELATIVE:
+        target = r->r_addend;
+        break;
+      case R_X86_64_JUMP_SLOT: case R_X86_64_GLOB_DAT:
+        if (!isDefined) continue;
+        target = sym->st_value;
+        break;
+      case R_X86_64_64:
+        if (!isDefined) continue;
+        target = sym->st_value + r->r_addend;
+        break;
+      default:
+        continue;
+      }
+      elfFile->slots[elfFile->nSlots++] = (SlotTarget){ r->r_offset, target };
+    }
+  }
+  if (elfFile->nSlots > 0) {
+    qsort(elfFile->slots, elfFile->nSlots, sizeof(SlotTarget), compare_slots);
+  }
+}
+
+/** Return the index entry of the pointer slot at virtual address vaddr,
+ *  NULL if it is not filled with an address defined within elfFile.
+ */
+static const SlotTarget *
+find_slot(const ElfFile *elfFile, Elf64_Addr vaddr)
+{
+  int lo = 0, hi = elfFile->nSlots;
+  while (lo < hi) {
+    int mid = lo + (hi - lo)/2;
+    if (elfFile->slots[mid].slot < vaddr) lo = mid + 1; else hi = mid;
+  }
+  return (lo < elfFile->nSlots && elfFile->slots[lo].slot == vaddr)
+    ? &elfFile->slots[lo] : NULL;
+}
+
+/** Return the virtual address which the dynamic linker will store in
+ *  the pointer slot (for example a GOT entry) at virtual address
+ *  slotVaddr, 0 if that is unknown or not defined within elfFile.
+ */
+unsigned long
+elf_file_slot_target(const ElfFile *elfFile, unsigned long slotVaddr)
+{
+  const SlotTarget *slot = find_slot(elfFile, slotVaddr);
+  return slot ? slot->target : 0;
+}
+
+/** Set *loP and *hiP to the virtual addresses bounding the PLT sections
+ *  of elfFile (.plt, .plt.got and .plt.sec), which hold the stubs
+ *  calling functions through pointer slots.  Returns false, setting
+ *  both to 0, if it has none.
+ */
+bool
+elf_file_plt(const ElfFile *elfFile, unsigned long *loP, unsigned long *hiP)
+{
+  unsigned long lo = 0, hi = 0;
+  const Elf64_Ehdr *ehdr = elfFile->ehdr;
+  const Elf64_Shdr *shstrtab =
+    (elfFile->shdrs && ehdr->e_shstrndx < ehdr->e_shnum &&
+     is_in_file(elfFile, &elfFile->shdrs[ehdr->e_shstrndx]))
+    ? &elfFile->shdrs[ehdr->e_shstrndx] : NULL;
+  for (int i = 0; shstrtab && i < ehdr->e_shnum; i++) {
+    const Elf64_Shdr *section = &elfFile->shdrs[i];
+    const char *name = str_at(elfFile, shstrtab, section->sh_name);
+    if (name == NULL || section->sh_size == 0 ||
+        (strcmp(name, ".plt") != 0 && strncmp(name, ".plt.", 5) != 0)) {
+      continue;
+    }
+    if (lo == hi || section->sh_addr < lo) lo = section->sh_addr;
+    if (section->sh_addr + section->sh_size > hi) {
+      hi = section->sh_addr + section->sh_size;
+    }
+  }
+  *loP = lo;
+  *hiP = hi;
+  return lo != hi;
+}
+
+/** Return pointer to the mapped code whose address will be held, once
+ *  the file is loaded, by the pointer slot (for example a GOT entry)
+ *  addressed relative to mapped code, as by a RIP-relative operand.
+ *  Returns NULL if that is unknown or not code within the file, for
+ *  example when the dynamic linker fills slot with an address from
+ *  another module.
+ */
+void *
+elf_file_slot(const ElfFile *elfFile, const void *slot)
+{
+  //file offsets and vaddrs differ by a different amount in each
+  //segment, so first recover the vaddr the code would compute
+  const Elf64_Phdr *code = NULL;
+  for (int i = 0; code == NULL && i < elfFile->ehdr->e_phnum; i++) {
+    const Elf64_Phdr *phdr = &elfFile->phdrs[i];
+    if (phdr->p_type == PT_LOAD && (phdr->p_flags & PF_X)) code = phdr;
+  }
+  if (code == NULL) return NULL;
+  Elf64_Addr vaddr = code->p_vaddr +
+    ((const unsigned char *)slot - (elfFile->bytes + code->p_offset));
+  const SlotTarget *target = find_slot(elfFile, vaddr);
+  if (target) return elf_file_code(elfFile, target->target, NULL, NULL);
+  if (elfFile->ehdr->e_type != ET_EXEC) return NULL;
+  //not relocated: the slot already holds its link-time value
+  for (int i = 0; i < elfFile->ehdr->e_phnum; i++) {
+    const Elf64_Phdr *phdr = &elfFile->phdrs[i];
+    if (phdr->p_type == PT_LOAD && phdr->p_vaddr <= vaddr &&
+        vaddr + sizeof(Elf64_Addr) <= phdr->p_vaddr + phdr->p_filesz &&
+        phdr->p_offset + phdr->p_filesz <= elfFile->size) {
+      Elf64_Addr target;
+      memcpy(&target, elfFile->bytes + phdr->p_offset +
+             (vaddr - phdr->p_vaddr), sizeof(target));
+      return elf_file_code(elfFile, target, NULL, NULL);
+    }
+  }
+  return NULL;
+}
+
+/** Return the virtual address in the ELF file of mapped code p. */
+unsigned long
+elf_file_vaddr(const ElfFile *elfFile, const void *p)
+{
+  size_t offset = (const unsigned char *)p - elfFile->bytes;
+  const Elf64_Phdr *phdrs = elfFile->phdrs;
+  for (int i = 0; i < elfFile->ehdr->e_phnum; i++) {
+    const Elf64_Phdr *phdr = &phdrs[i];
+    if (phdr->p_type == PT_LOAD && phdr->p_offset <= offset &&
+        offset < phdr->p_offset + phdr->p_filesz) {
+      return phdr->p_vaddr + (offset - phdr->p_offset);
+    }
+  }
+  return offset;
+}
+
+/** Set *idP to the GNU build-id of elfFile: the bytes of the
+ *  NT_GNU_BUILD_ID note written by the linker, which identify the
+ *  file's contents.  Returns their #, 0 if the file has no build-id.
+ *  *idP points into the mapped file.
+ */
+int
+elf_file_build_id(const ElfFile *elfFile, const unsigned char **idP)
+{
+  for (int i = 0; i < elfFile->ehdr->e_phnum; i++) {
+    const Elf64_Phdr *phdr = &elfFile->phdrs[i];
+    if (phdr->p_type != PT_NOTE || phdr->p_offset > elfFile->size ||
+        phdr->p_filesz > elfFile->size - phdr->p_offset) {
+      continue;
+    }
+    //notes are a header, then name and descriptor each padded to 4
+    const unsigned char *p = elfFile->bytes + phdr->p_offset;
+    const unsigned char *end = p + phdr->p_filesz;
+    while (end - p >= (long)sizeof(Elf64_Nhdr)) {
+      Elf64_Nhdr nhdr;
+      memcpy(&nhdr, p, sizeof(nhdr));
+      size_t nameSize = (nhdr.n_namesz + 3) & ~3UL;
+      size_t descSize = (nhdr.n_descsz + 3) & ~3UL;
+      const unsigned char *name = p + sizeof(nhdr);
+      if (nameSize + descSize > (size_t)(end - name)) break;
+      if (nhdr.n_type == NT_GNU_BUILD_ID && nhdr.n_descsz > 0 &&
+          nhdr.n_namesz == sizeof(ELF_NOTE_GNU) &&
+          memcmp(name, ELF_NOTE_GNU, sizeof(ELF_NOTE_GNU)) == 0) {
+        *idP = name + nameSize;
+        return nhdr.n_descsz;
+      }
+      p = name + nameSize + descSize;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,116 @@
+#ifndef ELF_FILE_H_
+#define ELF_FILE_H_
+
+#include <stdbool.h>
+
+/** Read-only view of an x86-64 ELF shared object or executable which
+ *  is mapped directly from its file, without loading it: no
+ *  relocation is done and no code in the file is ever run.
+ */
+typedef struct ElfFileImpl ElfFile;
+
+/** Map ELF file path.  Returns NULL with errno set on error; errno is
+ *  ENOEXEC if path is not a 64-bit x86-64 ELF file.
+ */
+ElfFile *open_elf_file(const char *path);
+
+/** Unmap elfFile and free all its resources.  Pointers returned by
+ *  the functions below are invalid after this call.
+ */
+void close_elf_file(ElfFile *elfFile);
+
+/** Return pointer to the code of the defined symbol name, looked up
+ *  in .symtab and then .dynsym.  If codeLoP and codeHiP are not NULL,
+ *  set them to the bounds of the mapped executable segment containing
+ *  the symbol.  Returns NULL if there is no such symbol.
+ */
+void *elf_file_symbol(const ElfFile *elfFile, const char *name,
+                      void **codeLoP, void **codeHiP);
+
+/** Return pointer to the mapped code at virtual address vaddr.  If
+ *  codeLoP and codeHiP are not NULL, set them to the bounds of the
+ *  mapped executable segment containing vaddr.  Returns NULL if vaddr
+ *  is not within the file part of an executable segment.
+ */
+void *elf_file_code(const ElfFile *elfFile, unsigned long vaddr,
+                    void **codeLoP, void **codeHiP);
+
+/** Set *vaddrsP to a newly allocated array containing the virtual
+ *  addresses of all functions exported by elfFile, as listed in
+ *  .dynsym (or in .symtab if there is no .dynsym), and return its
+ *  length.  The caller must free() *vaddrsP.
+ */
+int elf_file_exports(const ElfFile *elfFile, unsigned long **vaddrsP);
+
+/** Set *vaddrsP to a newly allocated array containing the distinct
+ *  virtual addresses of all functions defined in elfFile according to
+ *  .symtab and .dynsym, in increasing order, and return its length.
+ *  If sizesP is not NULL, *sizesP is set to a newly allocated array
+ *  of their sizes in bytes, 0 where unknown.  The caller must free()
+ *  *vaddrsP and *sizesP.
+ */
+int elf_file_functions(const ElfFile *elfFile, unsigned long **vaddrsP,
+                       unsigned long **sizesP);
+
+/** Set *vaddrsP to a newly allocated array containing the distinct
+ *  virtual addresses of the parts split off from functions by the
+ *  compiler, such as GCC's NAME.cold partitions, in increasing order,
+ *  and return its length.  They are among those returned by
+ *  elf_file_functions(), but a part is only entered by jumps from the
+ *  function it belongs to.  The caller must free() *vaddrsP.
+ */
+int elf_file_fn_parts(const ElfFile *elfFile, unsigned long **vaddrsP);
+
+/** Set *vaddrsP to a newly allocated array containing the distinct
+ *  virtual addresses of the functions defined in elfFile under one of
+ *  the NULL-terminated names, in increasing order, and return its
+ *  length.  The caller must free() *vaddrsP.
+ */
+int elf_file_named_fns(const ElfFile *elfFile, const char *const names[],
+                       unsigned long **vaddrsP);
+
+/** Set *vaddrsP to a newly allocated array containing the distinct
+ *  virtual addresses of the pointer slots (for example GOT entries)
+ *  which the dynamic linker fills with the address of a symbol with
+ *  one of the NULL-terminated names, defined in elfFile or not, in
+ *  increasing order, and return its length.  The caller must free()
+ *  *vaddrsP.
+ */
+int elf_file_named_slots(const ElfFile *elfFile, const char *const names[],
+                         unsigned long **vaddrsP);
+
+/** Return pointer to the mapped code whose address will be held, once
+ *  the file is loaded, by the pointer slot (for example a GOT entry)
+ *  addressed relative to mapped code, as by a RIP-relative operand.
+ *  Returns NULL if that is unknown or not code within the file, for
+ *  example when the dynamic linker fills slot with an address from
+ *  another module.
+ */
+void *elf_file_slot(const ElfFile *elfFile, const void *slot);
+
+/** Return the virtual address which the dynamic linker will store in
+ *  the pointer slot (for example a GOT entry) at virtual address
+ *  slotVaddr, 0 if that is unknown or not defined within elfFile.
+ */
+unsigned long elf_file_slot_target(const ElfFile *elfFile,
+                                   unsigned long slotVaddr);
+
+/** Set *loP and *hiP to the virtual addresses bounding the PLT sections
+ *  of elfFile (.plt, .plt.got and .plt.sec), which hold the stubs
+ *  calling functions through pointer slots.  Returns false, setting
+ *  both to 0, if it has none.
+ */
+bool elf_file_plt(const ElfFile *elfFile, unsigned long *loP,
+                  unsigned long *hiP);
+
+/** Return the virtual address in the ELF file of mapped code p. */
+unsigned long elf_file_vaddr(const ElfFile *elfFile, const void *p);
+
+/** Set *idP to the GNU build-id of elfFile: the bytes of the
+ *  NT_GNU_BUILD_ID note written by the linker, which identify the
+ *  file's contents.  Returns their #, 0 if the file has no build-id.
+ *  *idP points into the mapped file.
+ */
+int elf_file_build_id(const ElfFile *elfFile, const unsigned char **idP);
+
+#endif //ifndef ELF_FILE_H_
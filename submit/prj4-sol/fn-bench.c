@@ -0,0 +1,114 @@
+#include "fn-trace.h"
+
+#include "errors.h"
+#include "memalloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/** Benchmark of new_fns_data() over synthetic call graphs of
+ *  increasing size.  Each graph has n functions, each of which calls
+ *  two others and returns, forming a complete binary tree of calls.
+ *  The functions are placed in memory in random order, so they are
+ *  discovered out of address order, which is the worst case for
+ *  putting them in order afterwards.
+ *
+ *  Usage: fn-bench [N_THREADS [N...]]; sizes default to powers of 10
+ *  from 1e3 to 1e6.
+ */
+
+enum {
+  FN_SIZE = 16,              //bytes of code per function
+  CALL_SIZE = 5,             //e8 rel32
+  CALL = 0xe8,
+  RET = 0xc3,
+  N_RUNS = 3,                //best of
+};
+
+static void
+put_call(unsigned char *code, unsigned char *target)
+{
+  int rel = (int) (target - (code + CALL_SIZE));
+  code[0] = CALL;
+  memcpy(&code[1], &rel, sizeof(rel));
+}
+
+/** Return code for n functions calling each other as described above;
+ *  *rootP is set to the root of the tree.
+ */
+static unsigned char *
+make_graph(int n, void **rootP)
+{
+  unsigned char *code = mallocChk((size_t) n * FN_SIZE);
+  memset(code, RET, (size_t) n * FN_SIZE);
+  //slots[i] is the position in code of the i'th function of the tree
+  int *slots = mallocChk(n * sizeof(int));
+  for (int i = 0; i < n; i++) slots[i] = i;
+  for (int i = n - 1; i > 0; i--) {
+    int j = rand() % (i + 1);
+    int t = slots[i]; slots[i] = slots[j]; slots[j] = t;
+  }
+  for (int i = 0; i < n; i++) {
+    unsigned char *fn = &code[(size_t) slots[i] * FN_SIZE];
+    for (int k = 1; k <= 2; k++) {
+      long child = 2L * i + k;
+      if (child < n) {
+        put_call(fn, &code[(size_t) slots[child] * FN_SIZE]);
+        fn += CALL_SIZE;
+      }
+    }
+  }
+  *rootP = &code[(size_t) slots[0] * FN_SIZE];
+  free(slots);
+  return code;
+}
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/** Trace a graph of n functions and print the best of N_RUNS times */
+static void
+bench(int n, int nThreads)
+{
+  void *root;
+  unsigned char *code = make_graph(n, &root);
+  const unsigned char *codeHi = code + (size_t) n * FN_SIZE;
+  double best = 0;
+  for (int run = 0; run < N_RUNS; run++) {
+    double t0 = now();
+    const FnsData *fnsData = new_fns_data_range(root, code, codeHi, nThreads);
+    double t = now() - t0;
+    if (n_fn_infos(fnsData) != n) {
+      fatal("traced %d functions instead of %d", n_fn_infos(fnsData), n);
+    }
+    free_fns_data((FnsData *) fnsData);
+    fn_trace_unload(code, codeHi);   //so each run decodes from scratch
+    if (run == 0 || t < best) best = t;
+  }
+  printf("%9d %10.4f %10.1f\n", n, best, best * 1e9 / n);
+  free(code);
+}
+
+int
+main(int argc, const char *argv[])
+{
+  int nThreads = (argc > 1) ? atoi(argv[1]) : 1;
+  if (nThreads < 1) fatal("usage: %s [N_THREADS [N...]]", argv[0]);
+  srand(1);
+  printf("%9s %10s %10s  (%d thread%s)\n", "n", "seconds", "ns/fn",
+         nThreads, (nThreads == 1) ? "" : "s");
+  if (argc > 2) {
+    for (int i = 2; i < argc; i++) bench(atoi(argv[i]), nThreads);
+  }
+  else {
+    for (int n = 1000; n <= 1000000; n *= 10) bench(n, nThreads);
+  }
+  return 0;
+}
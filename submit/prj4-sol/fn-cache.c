@@ -0,0 +1,229 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "fn-cache.h"
+
+#include "memalloc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Cache file format, in host byte order: a CacheHeader, then the
+ *  build-id and key bytes padded with 0's to a multiple of 8, then
+ *  nFns CacheFn records in address order, then the nFns + 1 uint32_t
+ *  row starts and the nEdges uint32_t callee positions of the calls
+ *  made by each function, as returned by fn_callees().  A graph is
+ *  only loaded by a tracer of the FN_TRACE_VERSION which saved it, so
+ *  that changes to what is traced never leave stale graphs in use.
+ */
+#define CACHE_MAGIC "FNCACHE2"
+typedef struct {
+  char magic[8];         /** CACHE_MAGIC without its terminating NUL */
+  uint32_t traceVersion; /** FN_TRACE_VERSION of the tracer */
+  uint32_t reserved;
+  uint32_t idLen, keyLen;
+  uint64_t nFns, nEdges;
+} CacheHeader;
+typedef struct {
+  uint64_t vaddr;
+  uint32_t length, nInCalls, nOutCalls, reserved;
+} CacheFn;
+
+static size_t
+align8(size_t n)
+{
+  return (n + 7) & ~(size_t)7;
+}
+
+/** Return the newly allocated path of the cache file in dir for the
+ *  module with build-id id of idLen bytes and key.
+ */
+static char *
+cache_path(const char *dir, const unsigned char *id, int idLen,
+           const char *key)
+{
+  //key may contain anything, so the name only has its FNV-1a hash;
+  //the key itself is checked on loading
+  uint64_t hash = 0xcbf29ce484222325;
+  for (const char *p = key; *p != '\0'; p++) {
+    hash = (hash ^ (unsigned char)*p) * 0x100000001b3;
+  }
+  size_t size = strlen(dir) + 2*idLen + 32;
+  char *path = mallocChk(size);
+  int n = sprintf(path, "%s/", dir);
+  for (int i = 0; i < idLen; i++) n += sprintf(path + n, "%02x", id[i]);
+  sprintf(path + n, "-%016llx.fncache", (unsigned long long)hash);
+  return path;
+}
+
+/** Return the graph in the size bytes of cache file contents bytes,
+ *  NULL if they are not a valid graph for build-id id and key.
+ */
+static const FnsData *
+read_graph(const unsigned char *bytes, size_t size,
+           const unsigned char *id, int idLen, const char *key,
+           intptr_t delta)
+{
+  CacheHeader header;
+  if (size < sizeof(header)) return NULL;
+  memcpy(&header, bytes, sizeof(header));
+  size_t keyLen = strlen(key);
+  if (memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.traceVersion != FN_TRACE_VERSION || header.idLen != idLen || header.keyLen != keyLen ||
+      header.nFns > INT_MAX || header.nEdges > INT_MAX) {
+    return NULL;
+  }
+  size_t nFns = header.nFns, nEdges = header.nEdges;
+  size_t fnsOffset = align8(sizeof(header) + idLen + keyLen);
+  size_t startsOffset = fnsOffset + nFns*sizeof(CacheFn);
+  size_t calleesOffset = startsOffset + (nFns + 1)*sizeof(uint32_t);
+  if (size != calleesOffset + nEdges*sizeof(uint32_t) ||
+      memcmp(bytes + sizeof(header), id, idLen) != 0 ||
+      memcmp(bytes + sizeof(header) + idLen, key, keyLen) != 0) {
+    return NULL;
+  }
+  const CacheFn *cacheFns = (const CacheFn *)(bytes + fnsOffset);
+  const uint32_t *starts = (const uint32_t *)(bytes + startsOffset);
+  const uint32_t *callees = (const uint32_t *)(bytes + calleesOffset);
+  if (starts[0] != 0 || starts[nFns] != nEdges) return NULL;
+  for (size_t i = 0; i < nFns; i++) {
+    if (starts[i] > starts[i + 1] ||
+        (i > 0 && cacheFns[i - 1].vaddr >= cacheFns[i].vaddr)) {
+      return NULL;
+    }
+  }
+  for (size_t e = 0; e < nEdges; e++) {
+    if (callees[e] >= nFns) return NULL;
+  }
+  FnInfo *fns = mallocChk((nFns + 1)*sizeof(FnInfo));
+  for (size_t i = 0; i < nFns; i++) {
+    fns[i] = (FnInfo) {
+      .address = (void *)(cacheFns[i].vaddr + delta),
+      .length = cacheFns[i].length,
+      .nInCalls = cacheFns[i].nInCalls,
+      .nOutCalls = cacheFns[i].nOutCalls,
+    };
+  }
+  //uint32_t positions below INT_MAX have the same representation as int
+  const FnsData *fnsData =
+    new_fns_data_graph(fns, nFns, (const int *)starts, (const int *)callees);
+  free(fns);
+  return fnsData;
+}
+
+/** Return the call graph saved in directory dir by save_fn_cache()
+ *  for the module with ELF file elfFile and key, NULL if there is none
+ *  or the saved file is not valid.
+ */
+const FnsData *
+load_fn_cache(const char *dir, const ElfFile *elfFile, const char *key,
+              intptr_t delta)
+{
+  const unsigned char *id;
+  int idLen = elf_file_build_id(elfFile, &id);
+  if (idLen == 0) return NULL;
+  char *path = cache_path(dir, id, idLen, key);
+  int fd = open(path, O_RDONLY);
+  free(path);
+  if (fd < 0) return NULL;
+  struct stat st;
+  void *bytes = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    bytes = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (bytes == MAP_FAILED) return NULL;
+  const FnsData *fnsData =
+    read_graph(bytes, st.st_size, id, idLen, key, delta);
+  munmap(bytes, st.st_size);
+  return fnsData;
+}
+
+/** Write the cache file for fnsData on out; returns false on error. */
+static bool
+write_graph(FILE *out, const FnsData *fnsData, const unsigned char *id,
+            int idLen, const char *key, intptr_t delta)
+{
+  int nFns = n_fn_infos(fnsData);
+  CacheHeader header = {
+    .traceVersion = FN_TRACE_VERSION,
+    .idLen = idLen, .keyLen = strlen(key), .nFns = nFns, .nEdges = 0,
+  };
+  memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+  for (int i = 0; i < nFns; i++) {
+    const int *callees;
+    header.nEdges += fn_callees(fnsData, i, &callees);
+  }
+  size_t nPad = align8(sizeof(header) + idLen + header.keyLen) -
+    (sizeof(header) + idLen + header.keyLen);
+  const char pad[8] = { 0 };
+  fwrite(&header, sizeof(header), 1, out);
+  fwrite(id, 1, idLen, out);
+  fwrite(key, 1, header.keyLen, out);
+  fwrite(pad, 1, nPad, out);
+  for (int i = 0; i < nFns; i++) {
+    const FnInfo *fnInfo = fn_info_at(fnsData, i);
+    CacheFn fn = {
+      .vaddr = (uintptr_t)fnInfo->address - delta,
+      .length = fnInfo->length,
+      .nInCalls = fnInfo->nInCalls,
+      .nOutCalls = fnInfo->nOutCalls,
+    };
+    fwrite(&fn, sizeof(fn), 1, out);
+  }
+  uint32_t start = 0;
+  fwrite(&start, sizeof(start), 1, out);
+  for (int i = 0; i < nFns; i++) {
+    const int *callees;
+    start += fn_callees(fnsData, i, &callees);
+    fwrite(&start, sizeof(start), 1, out);
+  }
+  for (int i = 0; i < nFns; i++) {
+    const int *callees;
+    int nCallees = fn_callees(fnsData, i, &callees);
+    for (int c = 0; c < nCallees; c++) {
+      uint32_t callee = callees[c];
+      fwrite(&callee, sizeof(callee), 1, out);
+    }
+  }
+  return !ferror(out);
+}
+
+/** Save the call graph in fnsData, traced from the module with ELF
+ *  file elfFile, in directory dir under key, creating dir if needed.
+ *  The file is written under a temporary name and then renamed, so
+ *  concurrent runs never see a partial file.  Does nothing if elfFile
+ *  has no build-id.  Returns false with errno set on error.
+ */
+bool
+save_fn_cache(const char *dir, const ElfFile *elfFile, const char *key,
+              intptr_t delta, const FnsData *fnsData)
+{
+  const unsigned char *id;
+  int idLen = elf_file_build_id(elfFile, &id);
+  if (idLen == 0) return true;
+  if (mkdir(dir, 0777) < 0 && errno != EEXIST) return false;
+  char *path = cache_path(dir, id, idLen, key);
+  char *tmpPath = mallocChk(strlen(path) + 32);
+  sprintf(tmpPath, "%s.%ld.tmp", path, (long)getpid());
+  FILE *out = fopen(tmpPath, "w");
+  bool isOk = out != NULL;
+  if (isOk) {
+    bool isWritten = write_graph(out, fnsData, id, idLen, key, delta);
+    isOk = fclose(out) == 0 && isWritten && rename(tmpPath, path) == 0;
+    if (!isOk) {
+      int err = errno;
+      unlink(tmpPath);
+      errno = err;
+    }
+  }
+  free(tmpPath);
+  free(path);
+  return isOk;
+}
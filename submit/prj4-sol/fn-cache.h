@@ -0,0 +1,44 @@
+#ifndef FN_CACHE_H_
+#define FN_CACHE_H_
+
+#include "elf-file.h"
+#include "fn-trace.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Persistent cache of traced call graphs, so that tracing the same
+ *  unchanged module again only maps a file.  Each graph is saved in
+ *  its own file in a cache directory, named by the build-id of the
+ *  module's ELF file and a key naming what was traced, for example
+ *  the root function and the way the module was read.  A module which
+ *  is rebuilt gets a new build-id, so its old graphs are never found;
+ *  modules without a build-id are not cached.  A graph saved by a
+ *  tracer of another FN_TRACE_VERSION is ignored and replaced.
+ *
+ *  Code addresses are saved as virtual addresses within the ELF file;
+ *  delta is added to one to get the address of its code in this
+ *  process (the load address of a loaded module, or the distance from
+ *  a virtual address to its mapped code in the file).
+ *
+ *  Only the functions and calls are cached, not CFGs or instruction
+ *  mixes.
+ */
+
+/** Return the call graph saved in directory dir by save_fn_cache()
+ *  for the module with ELF file elfFile and key, NULL if there is none
+ *  or the saved file is not valid.
+ */
+const FnsData *load_fn_cache(const char *dir, const ElfFile *elfFile,
+                             const char *key, intptr_t delta);
+
+/** Save the call graph in fnsData, traced from the module with ELF
+ *  file elfFile, in directory dir under key, creating dir if needed.
+ *  The file is written under a temporary name and then renamed, so
+ *  concurrent runs never see a partial file.  Does nothing if elfFile
+ *  has no build-id.  Returns false with errno set on error.
+ */
+bool save_fn_cache(const char *dir, const ElfFile *elfFile, const char *key,
+                   intptr_t delta, const FnsData *fnsData);
+
+#endif //ifndef FN_CACHE_H_
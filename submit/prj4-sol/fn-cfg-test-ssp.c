@@ -0,0 +1,24 @@
+#include <stdio.h>
+
+/** Code traced by fn-cfg-test, compiled by the Makefile with -O2
+ *  -fstack-protector-all -fno-toplevel-reorder: ssp_fn() ends with the
+ *  call to __stack_chk_fail() of its stack-protector check, which is
+ *  followed directly by data in .text, as in a stripped library where
+ *  the next known function start may be far away.  The data is a call
+ *  followed by an undecodable byte.
+ */
+
+int
+ssp_fn(int n)
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%d", n);
+  return buf[n & 63];
+}
+
+__asm__(".text\n"
+        ".globl ssp_data\n"
+        "ssp_data:\n"
+        "  .byte 0xe8, 0, 0, 0, 0, 0x06\n"
+        ".globl ssp_data_end\n"
+        "ssp_data_end:\n");
@@ -0,0 +1,208 @@
+#include "elf-file.h"
+#include "fn-trace.h"
+
+#include "errors.h"
+#include "memalloc.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Regression tests of the control-flow graphs built when tracing with
+ *  the isCfg option, over synthetic functions made of chains of
+ *  conditional branches: the worst case for the work arrays of the
+ *  loop analysis, since every instruction but the first starts a
+ *  block.  Best run in a build with -fsanitize=address, which reports
+ *  any overrun of those arrays.
+ *
+ *  Also traces ssp_fn() of fn-cfg-test-ssp.c, compiled by gcc -O2,
+ *  whose code ends with a call to __stack_chk_fail() followed by data.
+ *
+ *  Usage: fn-cfg-test; exits with status 1 if any check fails.
+ */
+
+enum {
+  TEST_EDI = 0x85,           //85 ff: test %edi,%edi
+  JCC_REL8 = 0x70,           //70+cc rel8
+  RET = 0xc3,
+  MAX_CHAIN = 60,            //so that every jcc reaches with a rel8
+};
+
+static int nFailures = 0;
+
+/** Report a failed check of the chain of n jccs described by what */
+static void
+check(bool isOk, const char *what, int n, const char *field)
+{
+  if (isOk) return;
+  printf("%s chain of %d jcc: %s wrong\n", what, n, field);
+  nFailures++;
+}
+
+/** Return the CFG of the function at code[size], traced into *fnsDataP */
+static const FnCfg *
+trace_cfg(unsigned char *code, int size, const FnsData **fnsDataP)
+{
+  FnTraceOptions options = {
+    .codeLo = code, .codeHi = code + size, .nThreads = 1, .isCfg = true,
+  };
+  void *root = code;
+  const FnsData *fnsData = new_fns_data_options(&root, 1, &options);
+  if (n_fn_infos(fnsData) != 1) {
+    fatal("traced %d functions instead of 1", n_fn_infos(fnsData));
+  }
+  *fnsDataP = fnsData;
+  return fn_cfg(fnsData, 0);
+}
+
+/** test; n jccs all to the ret which follows them: n + 1 blocks, each
+ *  jcc ending one, and no loops.
+ */
+static void
+test_forward_chain(int n)
+{
+  unsigned char code[2 + 2*MAX_CHAIN + 1];
+  int size = 0;
+  code[size++] = TEST_EDI; code[size++] = 0xff;
+  for (int i = 0; i < n; i++) {
+    code[size++] = JCC_REL8 + i % 16;
+    code[size++] = 2*(n - i - 1);
+  }
+  code[size++] = RET;
+  const FnsData *fnsData;
+  const FnCfg *cfg = trace_cfg(code, size, &fnsData);
+  check(cfg->nBlocks == n + 1, "forward", n, "nBlocks");
+  check(cfg->nInsns == n + 2, "forward", n, "nInsns");
+  check(cfg->nBranches == n, "forward", n, "nBranches");
+  check(cfg->nLoops == 0, "forward", n, "nLoops");
+  for (int b = 0; b < cfg->nBlocks - 1; b++) {
+    const BasicBlock *block = &cfg->blocks[b];
+    check(block->nSuccs == 2 && block->succs[0] == n && block->succs[1] == b + 1,
+          "forward", n, "succs");
+  }
+  free_fns_data((FnsData *)fnsData);
+  fn_trace_unload(code, code + size);
+}
+
+/** test; n jccs all back to the test; ret: every jcc closes the one
+ *  loop headed by the entry, so all blocks but the ret are in it.
+ */
+static void
+test_backward_chain(int n)
+{
+  unsigned char code[2 + 2*MAX_CHAIN + 1];
+  int size = 0;
+  code[size++] = TEST_EDI; code[size++] = 0xff;
+  for (int i = 0; i < n; i++) {
+    code[size] = JCC_REL8 + i % 16;
+    code[size + 1] = -(size + 2);
+    size += 2;
+  }
+  code[size++] = RET;
+  const FnsData *fnsData;
+  const FnCfg *cfg = trace_cfg(code, size, &fnsData);
+  check(cfg->nBlocks == n + 1, "backward", n, "nBlocks");
+  check(cfg->nBranches == n, "backward", n, "nBranches");
+  check(cfg->nLoops == 1, "backward", n, "nLoops");
+  check(cfg->hotDepth == 1, "backward", n, "hotDepth");
+  free_fns_data((FnsData *)fnsData);
+  fn_trace_unload(code, code + size);
+}
+
+int ssp_fn(int n);
+extern const unsigned char ssp_data[], ssp_data_end[];
+
+/** Return the FnInfo of the function at address in fnsData, NULL if
+ *  it was not traced.
+ */
+static const FnInfo *
+find_fn_info(const FnsData *fnsData, const void *address)
+{
+  for (const FnInfo *fnInfo = next_fn_info(fnsData, NULL); fnInfo != NULL;
+       fnInfo = next_fn_info(fnsData, fnInfo)) {
+    if (fnInfo->address == address) return fnInfo;
+  }
+  return NULL;
+}
+
+/** Report a failed check of ssp_fn() traced as described by what */
+static void
+check_ssp(bool isOk, const char *what, const char *field)
+{
+  if (isOk) return;
+  printf("ssp_fn traced %s: %s wrong\n", what, field);
+  nFailures++;
+}
+
+/** ssp_fn(), traced within this executable up to the end of the data
+ *  following it, as in a stripped library.  Knowing the GOT slot of
+ *  __stack_chk_fail(), its code must end with the call through its PLT
+ *  stub; not knowing it, decoding runs into the data, but must end at
+ *  its undecodable byte instead of failing.
+ */
+static void
+test_ssp_tail(void)
+{
+  ElfFile *elfFile = open_elf_file("/proc/self/exe");
+  if (!elfFile) fatal("cannot map /proc/self/exe: %s", strerror(errno));
+  void *codeLo, *codeHi;
+  void *mapped = elf_file_symbol(elfFile, "ssp_fn", &codeLo, &codeHi);
+  if (!mapped) fatal("no ssp_fn symbol in /proc/self/exe");
+  const unsigned char *entry = (const unsigned char *)ssp_fn;
+  intptr_t base = (intptr_t)entry - elf_file_vaddr(elfFile, mapped);
+  const char *const names[] = { "__stack_chk_fail", NULL };
+  unsigned long *vaddrs;
+  int nSlots = elf_file_named_slots(elfFile, names, &vaddrs);
+  void **slots = mallocChk((nSlots + 1)*sizeof(void *));
+  for (int i = 0; i < nSlots; i++) slots[i] = (void *)(base + vaddrs[i]);
+  check_ssp(nSlots > 0, "", "__stack_chk_fail slots");
+
+  void *root = (void *)entry;
+  for (int isKnown = 1; isKnown >= 0; isKnown--) {
+    FnTraceOptions options = {
+      .codeLo = (char *)base + elf_file_vaddr(elfFile, codeLo),
+      .codeHi = ssp_data_end, .nThreads = 1, .isCfg = true,
+      .noReturnSlots = isKnown ? slots : NULL, .nNoReturnSlots = nSlots,
+    };
+    const char *what = isKnown ? "knowing __stack_chk_fail"
+                               : "not knowing __stack_chk_fail";
+    const FnsData *fnsData = new_fns_data_options(&root, 1, &options);
+    const FnInfo *fnInfo = find_fn_info(fnsData, entry);
+    if (fnInfo == NULL) fatal("ssp_fn not traced");
+    const FnCfg *cfg = fn_cfg(fnsData, fn_info_index(fnsData, fnInfo));
+    const BasicBlock *last = &cfg->blocks[cfg->nBlocks - 1];
+    const unsigned char *end = (const unsigned char *)last->address +
+      last->length;
+    if (isKnown) {
+      //snprintf() and __stack_chk_fail()
+      check_ssp(fnInfo->nOutCalls == 2, what, "nOutCalls");
+      check_ssp(end == ssp_data && last->nSuccs == 0, what, "end");
+    }
+    else {
+      //the call in the data, but not the undecodable byte after it
+      check_ssp(end == ssp_data + 5, what, "end");
+    }
+    free_fns_data((FnsData *)fnsData);
+  }
+  free(slots);
+  free(vaddrs);
+  close_elf_file(elfFile);
+}
+
+int
+main(int argc, const char *argv[])
+{
+  if (argc != 1) fatal("usage: %s", argv[0]);
+  int nTests = 0;
+  for (int n = 1; n <= MAX_CHAIN; n++) {
+    test_forward_chain(n);
+    test_backward_chain(n);
+    nTests += 2;
+  }
+  test_ssp_tail();
+  nTests++;
+  printf("%d functions traced; %d checks failed\n", nTests, nFailures);
+  return nFailures != 0;
+}
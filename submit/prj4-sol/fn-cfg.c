@@ -0,0 +1,285 @@
+#include "fn-cfg.h"
+
+#include "memalloc.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Record instruction at address, in any order, for the function whose
+ *  CFG will next be built using scratch.
+ */
+void
+add_cfg_insn(CfgScratch *scratch, const unsigned char *address,
+             unsigned length, CfgFlow flow, const unsigned char *target,
+             bool isBranch)
+{
+  if (scratch->nInsns >= scratch->insnsCap) {
+    scratch->insnsCap = (scratch->insnsCap == 0) ? 64 : 2*scratch->insnsCap;
+    scratch->insns =
+      reallocChk(scratch->insns, scratch->insnsCap*sizeof(CfgInsn));
+  }
+  scratch->insns[scratch->nInsns++] = (CfgInsn) {
+    .address = address, .target = target, .length = length,
+    .flow = flow, .isBranch = isBranch,
+  };
+}
+
+static int
+compare_insns(const void *p1, const void *p2)
+{
+  const CfgInsn *a = p1, *b = p2;
+  return (a->address > b->address) - (a->address < b->address);
+}
+
+/** Return the distance of address past the entry, insns[0], wrapping
+ *  around for code placed before the entry.
+ */
+static uintptr_t
+entry_offset(const CfgInsn insns[], const unsigned char *address)
+{
+  return (uintptr_t)address - (uintptr_t)insns[0].address;
+}
+
+/** Return index of instruction at address in insns, which are sorted by
+ *  entry_offset(), -1 if none.
+ */
+static int
+find_insn(const CfgInsn insns[], int nInsns, const unsigned char *address)
+{
+  if (nInsns == 0) return -1;
+  uintptr_t offset = entry_offset(insns, address);
+  int lo = 0, hi = nInsns;
+  while (lo < hi) {
+    int mid = lo + (hi - lo)/2;
+    if (entry_offset(insns, insns[mid].address) < offset) lo = mid + 1;
+    else hi = mid;
+  }
+  return (lo < nInsns && insns[lo].address == address) ? lo : -1;
+}
+
+static void
+reverse_insns(CfgInsn insns[], int n)
+{
+  for (int i = 0, j = n - 1; i < j; i++, j--) {
+    CfgInsn t = insns[i];
+    insns[i] = insns[j];
+    insns[j] = t;
+  }
+}
+
+/** Rotate insns[nInsns], sorted by address, so that those from entry on
+ *  come first, followed by those of parts of the function placed
+ *  before it.
+ */
+static void
+rotate_to_entry(CfgInsn insns[], int nInsns, const unsigned char *entry)
+{
+  int k = 0;
+  while (k < nInsns && insns[k].address < entry) k++;
+  if (k == 0 || k == nInsns) return;
+  reverse_insns(insns, k);
+  reverse_insns(insns + k, nInsns - k);
+  reverse_insns(insns, nInsns);
+}
+
+/** Return true iff insns[i + 1] directly follows insns[i] */
+static bool
+falls_into(const CfgInsn insns[], int nInsns, int i)
+{
+  return i + 1 < nInsns &&
+    insns[i].address + insns[i].length == insns[i + 1].address;
+}
+
+static void
+add_succ(BasicBlock *block, int succ)
+{
+  if (succ >= 0 && block->nSuccs < 2) block->succs[block->nSuccs++] = succ;
+}
+
+/** Count the loops of cfg, taking each target of a back edge found by a
+ *  depth-first search from the entry as a loop header, and set each
+ *  block's depth[] to the # of natural loops containing it.  work must
+ *  have room for LOOP_WORK_INTS(cfg->nBlocks) ints.
+ */
+#define LOOP_WORK_INTS(n) (12*(n) + 1)
+static int
+find_loops(const FnCfg *cfg, int depth[], int work[])
+{
+  int n = cfg->nBlocks;
+  const BasicBlock *blocks = cfg->blocks;
+  int *state = work;             //0 unseen, 1 on DFS stack, 2 done
+  int *isHeader = state + n;
+  int *predStart = isHeader + n; //n + 1 entries
+  int *stack = predStart + n + 1;//DFS stack of blocks ...
+  int *next = stack + n;         //... and the next succ of each to visit
+  int *preds = next + n;         //2*n entries
+  int *back = preds + 2*n;       //sources and targets of back edges
+  int *mark = back + 4*n;
+  memset(work, 0, (3*n + 1)*sizeof(int));
+
+  int nLoops = 0, nBack = 0, top = 0;
+  state[0] = 1;
+  stack[top] = 0; next[top++] = 0;
+  while (top > 0) {
+    int b = stack[top - 1];
+    if (next[top - 1] < blocks[b].nSuccs) {
+      int s = blocks[b].succs[next[top - 1]++];
+      if (state[s] == 0) {
+        state[s] = 1;
+        stack[top] = s; next[top++] = 0;
+      }
+      else if (state[s] == 1) {
+        back[2*nBack] = b; back[2*nBack + 1] = s;
+        nBack++;
+        if (!isHeader[s]) nLoops++;
+        isHeader[s] = 1;
+      }
+    }
+    else {
+      state[b] = 2;
+      top--;
+    }
+  }
+
+  //predecessor lists, in compressed sparse row form
+  for (int b = 0; b < n; b++) {
+    for (int s = 0; s < blocks[b].nSuccs; s++) {
+      predStart[blocks[b].succs[s] + 1]++;
+    }
+  }
+  for (int b = 0; b < n; b++) predStart[b + 1] += predStart[b];
+  for (int b = 0; b < n; b++) next[b] = predStart[b];
+  for (int b = 0; b < n; b++) {
+    for (int s = 0; s < blocks[b].nSuccs; s++) {
+      preds[next[blocks[b].succs[s]]++] = b;
+    }
+  }
+
+  //body of the loop headed by h: h plus all blocks reaching a back edge
+  //into h without passing through h; stack is reused as the queue
+  for (int b = 0; b < n; b++) depth[b] = mark[b] = 0;
+  for (int h = 0; h < n; h++) {
+    if (!isHeader[h]) continue;
+    int stamp = h + 1, len = 0;
+    mark[h] = stamp;
+    depth[h]++;
+    for (int e = 0; e < nBack; e++) {
+      int u = back[2*e];
+      if (back[2*e + 1] == h && mark[u] != stamp) {
+        mark[u] = stamp;
+        depth[u]++;
+        stack[len++] = u;
+      }
+    }
+    for (int q = 0; q < len; q++) {
+      int x = stack[q];
+      for (int p = predStart[x]; p < predStart[x + 1]; p++) {
+        int u = preds[p];
+        if (mark[u] != stamp) {
+          mark[u] = stamp;
+          depth[u]++;
+          stack[len++] = u;
+        }
+      }
+    }
+  }
+  return nLoops;
+}
+
+/** Return the control-flow graph of the function at entry whose
+ *  instructions were added to scratch.  The graph is allocated in
+ *  arena; scratch is emptied for the next function.
+ */
+FnCfg *
+build_fn_cfg(Arena *arena, CfgScratch *scratch, const unsigned char *entry)
+{
+  CfgInsn *insns = scratch->insns;
+  int nInsns = scratch->nInsns;
+  qsort(insns, nInsns, sizeof(CfgInsn), compare_insns);
+  rotate_to_entry(insns, nInsns, entry);
+
+  //blockOf, then isLeader or depth plus the work of find_loops(); there
+  //are at most nInsns blocks
+  int nInts = (nInsns + 1) + nInsns + LOOP_WORK_INTS(nInsns);
+  if (nInts > scratch->intsCap) {
+    scratch->intsCap = nInts;
+    free(scratch->ints);
+    scratch->ints = mallocChk(nInts*sizeof(int));
+  }
+  int *blockOf = scratch->ints;       //block of each instruction
+  int *work = blockOf + nInsns + 1;
+
+  //leaders: the entry, branch targets and whatever follows a branch
+  int *isLeader = work;
+  memset(isLeader, 0, (nInsns + 1)*sizeof(int));
+  if (nInsns > 0) isLeader[0] = 1;
+  for (int i = 0; i < nInsns; i++) {
+    if (insns[i].flow == CFG_COND || insns[i].flow == CFG_JUMP) {
+      int t = find_insn(insns, nInsns, insns[i].target);
+      if (t >= 0) isLeader[t] = 1;
+    }
+    if (insns[i].flow != CFG_FALL || !falls_into(insns, nInsns, i)) {
+      isLeader[i + 1] = 1;
+    }
+  }
+  int nBlocks = 0;
+  for (int i = 0; i < nInsns; i++) {
+    if (isLeader[i]) nBlocks++;
+    blockOf[i] = nBlocks - 1;
+  }
+
+  FnCfg *cfg = arena_alloc(arena, sizeof(FnCfg));
+  BasicBlock *blocks = arena_alloc(arena, (nBlocks + 1)*sizeof(BasicBlock));
+  *cfg = (FnCfg) { .nBlocks = nBlocks, .blocks = blocks, .hotBlock = -1 };
+  for (int i = 0; i < nInsns; i++) {
+    BasicBlock *block = &blocks[blockOf[i]];
+    if (isLeader[i]) {
+      *block = (BasicBlock) { .address = (void *)insns[i].address };
+    }
+    block->length += insns[i].length;
+    block->nInsns++;
+    cfg->nInsns++;
+    if (insns[i].isBranch) cfg->nBranches++;
+    if (i + 1 < nInsns && !isLeader[i + 1]) continue;
+
+    //last instruction of block
+    int fall = falls_into(insns, nInsns, i) ? blockOf[i + 1] : -1;
+    int target = -1;
+    if (insns[i].flow == CFG_COND || insns[i].flow == CFG_JUMP) {
+      int t = find_insn(insns, nInsns, insns[i].target);
+      if (t >= 0) target = blockOf[t];
+    }
+    switch (insns[i].flow) {
+    case CFG_FALL: add_succ(block, fall); break;
+    case CFG_COND: add_succ(block, target); add_succ(block, fall); break;
+    case CFG_JUMP: add_succ(block, target); break;
+    case CFG_EXIT: break;
+    }
+  }
+
+  if (nBlocks > 0) {
+    int *depth = work;                //isLeader is no longer needed
+    cfg->nLoops = find_loops(cfg, depth, depth + nBlocks);
+    cfg->hotBlock = 0;
+    for (int b = 1; b < nBlocks; b++) {
+      if (depth[b] > depth[cfg->hotBlock] ||
+          (depth[b] == depth[cfg->hotBlock] &&
+           blocks[b].nInsns > blocks[cfg->hotBlock].nInsns)) {
+        cfg->hotBlock = b;
+      }
+    }
+    cfg->hotDepth = depth[cfg->hotBlock];
+  }
+  scratch->nInsns = 0;
+  return cfg;
+}
+
+/** Free the buffers in scratch. */
+void
+free_cfg_scratch(CfgScratch *scratch)
+{
+  free(scratch->insns);
+  free(scratch->ints);
+  *scratch = (CfgScratch) { NULL, 0, 0, NULL, 0 };
+}
@@ -0,0 +1,53 @@
+#ifndef FN_CFG_H_
+#define FN_CFG_H_
+
+#include "arena.h"
+#include "fn-trace.h"
+
+#include <stdbool.h>
+
+/** How control leaves an instruction of a function being traced. */
+typedef enum {
+  CFG_FALL,       /** to the next instruction only (includes calls) */
+  CFG_COND,       /** to target, which may be outside the function, or
+                   *  to the next instruction */
+  CFG_JUMP,       /** to target within the function only */
+  CFG_EXIT,       /** out of the function: ret, tail call, hlt, ... */
+} CfgFlow;
+
+typedef struct {
+  const unsigned char *address;
+  const unsigned char *target;  /** for CFG_COND and CFG_JUMP */
+  unsigned length;
+  CfgFlow flow;
+  bool isBranch;                /** any jcc or jmp */
+} CfgInsn;
+
+/** Buffers reused by build_fn_cfg() from one function to the next.
+ *  Initialize to all 0; one per thread.
+ */
+typedef struct {
+  CfgInsn *insns;       /** instructions of the current function */
+  int nInsns, insnsCap;
+  int *ints;            /** work arrays */
+  int intsCap;
+} CfgScratch;
+
+/** Record instruction at address, in any order, for the function whose
+ *  CFG will next be built using scratch.
+ */
+void add_cfg_insn(CfgScratch *scratch, const unsigned char *address,
+                  unsigned length, CfgFlow flow, const unsigned char *target,
+                  bool isBranch);
+
+/** Return the control-flow graph of the function at entry whose
+ *  instructions were added to scratch.  The graph is allocated in
+ *  arena; scratch is emptied for the next function.
+ */
+FnCfg *build_fn_cfg(Arena *arena, CfgScratch *scratch,
+                    const unsigned char *entry);
+
+/** Free the buffers in scratch. */
+void free_cfg_scratch(CfgScratch *scratch);
+
+#endif //ifndef FN_CFG_H_
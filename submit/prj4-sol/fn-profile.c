@@ -0,0 +1,546 @@
+#define _GNU_SOURCE
+
+#include "fn-profile.h"
+#include "x86-64_lde.h"
+
+#include "errors.h"
+#include "memalloc.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/** Entry counting and timing by patching function entries.
+ *
+ *  The first instructions of each function, at least JMP_SIZE bytes of
+ *  them, are replaced by a jmp rel32 to a stub of its own:
+ *
+ *    stub:    push $index
+ *             jmp fn_profile_enter
+ *    resume:  <the displaced instructions, relocated>
+ *             jmp entry + # of displaced bytes
+ *
+ *  fn_profile_enter counts the call in the function's ProfileRecord,
+ *  replaces the return address of the call with fn_profile_exit after
+ *  saving it with the time-stamp counter on a shadow stack, and
+ *  continues at resume.  When the function returns to fn_profile_exit,
+ *  the elapsed ticks are added to the record and the saved return
+ *  address is returned to.  A tail call from one patched function to
+ *  another pushes a second frame whose return address is
+ *  fn_profile_exit itself, so both frames are popped in turn.
+ *
+ *  The enter and exit routines only use registers which are not
+ *  preserved across calls and do not hold arguments or return values,
+ *  and the stubs are mapped within rel32 reach of the code so that
+ *  RIP-relative operands of displaced instructions can be relocated.
+ *
+ *  The shadow stack is global, so patched code must only run on one
+ *  thread, and it gets out of step if a longjmp() or exception skips
+ *  the return of patched functions.  Code which reads its own return
+ *  address sees fn_profile_exit.
+ */
+
+enum {
+  JMP_REL32 = 0xe9,
+  JMP_SIZE = 5,             //jmp rel32 patched over each entry
+  PUSH_IMM32 = 0x68,
+  ABS_JMP_SIZE = 14,        //jmp *0(%rip); .quad target
+  STUB_SIZE = 64,
+  MAX_DEPTH = 1 << 16,      //of shadow stack; deeper calls are counted
+                            //but not timed
+  NEAR_STEP = 1 << 20,      //granularity of search for stub memory
+};
+
+#define REL32_REACH 0x7fff0000L
+
+typedef struct {            //layout known to fn_profile_enter/exit
+  uint64_t nCalls;
+  uint64_t ticks;
+  const unsigned char *resume;
+  uint64_t pad;
+} ProfileRecord;
+
+typedef struct {            //layout known to fn_profile_enter/exit
+  void *returnAddress;
+  uint64_t start;           //time-stamp counter at entry
+  ProfileRecord *record;
+} ShadowFrame;
+
+struct FnProfileImpl {
+  int nFns;
+  ProfileRecord *records;   //of each function of the FnsData
+  unsigned char **entries;  //patched entries; NULL if not patched
+  unsigned char (*saved)[JMP_SIZE];  //original bytes at entries
+  unsigned char *stubs;     //STUB_SIZE bytes per function
+  size_t stubsSize;
+};
+
+//state of the one active profile, used by fn_profile_enter/exit;
+//global rather than static so that writes to it are never elided
+__attribute__((visibility("hidden"))) ProfileRecord *fn_profile_records;
+__attribute__((visibility("hidden"))) ShadowFrame *fn_profile_sp;
+__attribute__((visibility("hidden"))) ShadowFrame *fn_profile_sp_limit;
+static ShadowFrame shadowStack[MAX_DEPTH];
+static bool isActive = false;
+
+void fn_profile_enter(void);
+void fn_profile_exit(void);
+
+__asm__(
+  "  .text\n"
+  "  .p2align 4\n"
+  "  .globl fn_profile_enter\n"
+  "  .hidden fn_profile_enter\n"
+  "  .type fn_profile_enter, @function\n"
+  "fn_profile_enter:\n"             //(%rsp): index; 8(%rsp): return address
+  "  push %rax\n"
+  "  push %rcx\n"
+  "  push %rdx\n"
+  "  push %r11\n"
+  "  mov 32(%rsp), %rcx\n"
+  "  shl $5, %rcx\n"                //sizeof(ProfileRecord)
+  "  add fn_profile_records(%rip), %rcx\n"
+  "  incq (%rcx)\n"
+  "  mov 16(%rcx), %rax\n"
+  "  mov %rax, 32(%rsp)\n"          //ret below continues at resume
+  "  mov fn_profile_sp(%rip), %r11\n"
+  "  cmp fn_profile_sp_limit(%rip), %r11\n"
+  "  jae 1f\n"
+  "  mov 40(%rsp), %rax\n"
+  "  mov %rax, (%r11)\n"
+  "  mov %rcx, 16(%r11)\n"
+  "  lea fn_profile_exit(%rip), %rax\n"
+  "  mov %rax, 40(%rsp)\n"
+  "  add $24, %r11\n"               //sizeof(ShadowFrame)
+  "  mov %r11, fn_profile_sp(%rip)\n"
+  "  rdtsc\n"
+  "  shl $32, %rdx\n"
+  "  or %rdx, %rax\n"
+  "  mov %rax, -16(%r11)\n"
+  "1:\n"
+  "  pop %r11\n"
+  "  pop %rdx\n"
+  "  pop %rcx\n"
+  "  pop %rax\n"
+  "  ret\n"
+  "  .size fn_profile_enter, .-fn_profile_enter\n"
+  "\n"
+  "  .p2align 4\n"
+  "  .globl fn_profile_exit\n"
+  "  .hidden fn_profile_exit\n"
+  "  .type fn_profile_exit, @function\n"
+  "fn_profile_exit:\n"              //rax, rdx may hold the return value
+  "  push %rax\n"                   //replaced by saved return address
+  "  push %rax\n"
+  "  push %rdx\n"
+  "  rdtsc\n"
+  "  shl $32, %rdx\n"
+  "  or %rdx, %rax\n"
+  "  mov fn_profile_sp(%rip), %rcx\n"
+  "  sub $24, %rcx\n"
+  "  mov %rcx, fn_profile_sp(%rip)\n"
+  "  sub 8(%rcx), %rax\n"
+  "  mov 16(%rcx), %r11\n"
+  "  add %rax, 8(%r11)\n"
+  "  mov (%rcx), %rax\n"
+  "  mov %rax, 16(%rsp)\n"
+  "  pop %rdx\n"
+  "  pop %rax\n"
+  "  ret\n"
+  "  .size fn_profile_exit, .-fn_profile_exit\n"
+);
+
+/** Return true iff a rel32 jump between any address in [lo, hi) and
+ *  any address in [p, p + size) is possible.
+ */
+static bool
+is_near(const unsigned char *lo, const unsigned char *hi,
+        const unsigned char *p, size_t size)
+{
+  return (p >= hi) ? p + size - lo < REL32_REACH : hi - p < REL32_REACH;
+}
+
+/** Return size bytes of fresh read-write memory within rel32 reach of
+ *  [lo, hi), NULL with errno set if none could be found.
+ */
+static unsigned char *
+map_near(const unsigned char *lo, const unsigned char *hi, size_t size)
+{
+  uintptr_t above = ((uintptr_t)hi + NEAR_STEP - 1) & ~(uintptr_t)(NEAR_STEP - 1);
+  uintptr_t below = ((uintptr_t)lo & ~(uintptr_t)(NEAR_STEP - 1)) - size;
+  for (uintptr_t offset = 0; offset < REL32_REACH; offset += NEAR_STEP) {
+    uintptr_t hints[] = { above + offset, below - offset };
+    for (int i = 0; i < 2; i++) {
+      unsigned char *p = mmap((void *)hints[i], size, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED) return NULL;
+      if (is_near(lo, hi, p, size)) return p;
+      munmap(p, size);
+    }
+  }
+  errno = ENOMEM;
+  return NULL;
+}
+
+/** Write an absolute jmp to target at p, returning the address after it */
+static unsigned char *
+put_abs_jmp(unsigned char *p, const void *target)
+{
+  static const unsigned char jmp[] = { 0xff, 0x25, 0, 0, 0, 0 };
+  uint64_t addr = (uintptr_t)target;
+  memcpy(p, jmp, sizeof(jmp));
+  memcpy(p + sizeof(jmp), &addr, sizeof(addr));
+  return p + ABS_JMP_SIZE;
+}
+
+/** Return true iff rel32 displacement n fits in 32 bits, storing it at p */
+static bool
+put_rel32(unsigned char *p, long n)
+{
+  int32_t rel = n;
+  memcpy(p, &rel, sizeof(rel));
+  return rel == n;
+}
+
+/** Write the direct branch or call at p of length len to dst, with its
+ *  displacement adjusted for the new address and rel8 forms widened to
+ *  rel32, and return the length written; 0 if this is not possible.
+ */
+static int
+relocate_branch(const unsigned char *p, int len, unsigned char *dst)
+{
+  const unsigned char *op = p;
+  while (*op == 0xf2 || *op == 0xf3 || *op == 0x2e || *op == 0x3e) op++;
+  long target;
+  int n;
+  if (*op == 0xe8 || *op == 0xe9) {         //call, jmp rel32
+    int32_t rel;
+    memcpy(&rel, op + 1, sizeof(rel));
+    target = (long)(p + len) + rel;
+    dst[0] = *op;
+    n = 5;
+  }
+  else if (*op == 0xeb || (0x70 <= *op && *op <= 0x7f)) {   //rel8
+    target = (long)(p + len) + (signed char)op[1];
+    if (*op == 0xeb) {
+      dst[0] = 0xe9;
+      n = 5;
+    }
+    else {
+      dst[0] = 0x0f;
+      dst[1] = 0x80 | (*op & 0x0f);
+      n = 6;
+    }
+  }
+  else if (op[0] == 0x0f && (op[1] & 0xf0) == 0x80) {   //jcc rel32
+    int32_t rel;
+    memcpy(&rel, op + 2, sizeof(rel));
+    target = (long)(p + len) + rel;
+    dst[0] = 0x0f;
+    dst[1] = op[1];
+    n = 6;
+  }
+  else {     //loop, jrcxz or 16-bit operand size have no rel32 form
+    return 0;
+  }
+  return put_rel32(dst + n - 4, target - (long)(dst + n)) ? n : 0;
+}
+
+/** Copy the whole instructions covering the first JMP_SIZE bytes at
+ *  entry to resume, relocating their RIP-relative operands and direct
+ *  branches, and return their length; *nResumeP is set to the #
+ *  of bytes written to resume, which is followed by a jump back to the
+ *  rest of the code unless the last instruction does not fall through.
+ *  Returns 0 if they cannot be displaced: if they extend to limit (if
+ *  not NULL), a control transfer ends them short of JMP_SIZE bytes or
+ *  they are branched to according to cfg.
+ */
+static int
+displace_entry(const Lde *lde, const FnCfg *cfg, const unsigned char *entry,
+               const unsigned char *limit, unsigned char *resume,
+               int *nResumeP)
+{
+  int n = 0, m = 0;   //bytes displaced and written to resume
+  bool isEnd = false;
+  while (n < JMP_SIZE) {
+    if (isEnd) return 0;
+    const unsigned char *p = entry + n;
+    LdeOpClass opClass;
+    int len = get_op_info(lde, p, &opClass);
+    if (len <= 0) return 0;
+    if (limit != NULL && p + len > limit) return 0;
+    isEnd = (opClass == LDE_OP_RET || opClass == LDE_OP_JMP ||
+             opClass == LDE_OP_JMP_INDIRECT);
+    if (opClass == LDE_OP_CALL || opClass == LDE_OP_JMP ||
+        opClass == LDE_OP_JCC) {
+      int nBranch = relocate_branch(p, len, resume + m);
+      if (nBranch == 0) return 0;
+      m += nBranch;
+    }
+    else {
+      memcpy(resume + m, p, len);
+      int ripDisp = get_op_rip_disp(lde, p);
+      if (ripDisp > 0) {
+        int32_t disp;
+        memcpy(&disp, p + ripDisp, sizeof(disp));
+        if (!put_rel32(resume + m + ripDisp, disp + (p - (resume + m)))) {
+          return 0;
+        }
+      }
+      m += len;
+    }
+    n += len;
+  }
+  for (int b = 0; b < cfg->nBlocks; b++) {
+    const BasicBlock *block = &cfg->blocks[b];
+    const unsigned char *address = block->address;
+    if (entry < address && address < entry + n) return 0;
+    for (int s = 0; s < block->nSuccs; s++) {
+      if (block->succs[s] == 0) return 0;   //loops back to the entry
+    }
+  }
+  if (!isEnd) m = put_abs_jmp(resume + m, entry + n) - resume;
+  *nResumeP = m;
+  return n;
+}
+
+/** Set protection of pages [lo, hi) to prot; fatal on failure */
+static void
+set_protection(uintptr_t lo, uintptr_t hi, int prot)
+{
+  if (lo < hi && mprotect((void *)lo, hi - lo, prot) != 0) {
+    fatal("cannot change protection of code at %#lx:", lo);
+  }
+}
+
+/** Patch all entries of profile if isPatch, else restore their saved
+ *  code.  The pages containing them are assumed to be mapped
+ *  read-execute and are left that way.
+ */
+static void
+patch_entries(FnProfile *profile, bool isPatch)
+{
+  const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+  const int rwx = PROT_READ | PROT_WRITE | PROT_EXEC;
+  uintptr_t lo = 0, hi = 0;   //pages currently writable
+  for (int i = 0; i < profile->nFns; i++) {
+    unsigned char *entry = profile->entries[i];
+    if (entry == NULL) continue;
+    uintptr_t pageLo = (uintptr_t)entry & ~(pageSize - 1);
+    uintptr_t pageHi =
+      ((uintptr_t)entry + JMP_SIZE + pageSize - 1) & ~(pageSize - 1);
+    if (pageHi > hi) {
+      if (pageLo > hi) {
+        set_protection(lo, hi, PROT_READ | PROT_EXEC);
+        lo = pageLo;
+      }
+      set_protection(pageLo, pageHi, rwx);
+      hi = pageHi;
+    }
+    if (isPatch) {
+      unsigned char *stub = profile->stubs + (size_t)i * STUB_SIZE;
+      int32_t rel = stub - (entry + JMP_SIZE);
+      memcpy(profile->saved[i], entry, JMP_SIZE);
+      entry[0] = JMP_REL32;
+      memcpy(entry + 1, &rel, sizeof(rel));
+    }
+    else {
+      memcpy(entry, profile->saved[i], JMP_SIZE);
+    }
+  }
+  set_protection(lo, hi, PROT_READ | PROT_EXEC);
+}
+
+typedef struct {
+  const unsigned char *lo, *hi;   //code of a basic block
+  int fn;                         //position of its function
+} BlockExtent;
+
+static int
+compare_block_extents(const void *p1, const void *p2)
+{
+  const BlockExtent *a = p1, *b = p2;
+  return (a->lo > b->lo) - (a->lo < b->lo);
+}
+
+/** Return true iff p is one of the sorted starts[nStarts] */
+static bool
+is_start(void *const starts[], int nStarts, const void *p)
+{
+  int lo = 0, hi = nStarts;
+  while (lo < hi) {
+    int mid = lo + (hi - lo)/2;
+    if ((const char *)starts[mid] < (const char *)p) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo < nStarts && starts[lo] == p;
+}
+
+/** Set *extentsP to a newly allocated array of the blocks of all
+ *  functions in fnsData, sorted by address, and *maxHiP to one of the
+ *  greatest end of the blocks up to each of them, and return their #.
+ */
+static int
+get_block_extents(const FnsData *fnsData, BlockExtent **extentsP,
+                  const unsigned char ***maxHiP)
+{
+  int nFns = n_fn_infos(fnsData), n = 0;
+  for (int i = 0; i < nFns; i++) {
+    const FnCfg *cfg = fn_cfg(fnsData, i);
+    if (cfg != NULL) n += cfg->nBlocks;
+  }
+  BlockExtent *extents = mallocChk((n + 1)*sizeof(BlockExtent));
+  n = 0;
+  for (int i = 0; i < nFns; i++) {
+    const FnCfg *cfg = fn_cfg(fnsData, i);
+    for (int b = 0; cfg != NULL && b < cfg->nBlocks; b++) {
+      const unsigned char *lo = cfg->blocks[b].address;
+      extents[n++] = (BlockExtent) { lo, lo + cfg->blocks[b].length, i };
+    }
+  }
+  qsort(extents, n, sizeof(BlockExtent), compare_block_extents);
+  const unsigned char **maxHi = mallocChk((n + 1)*sizeof(unsigned char *));
+  for (int k = 0; k < n; k++) {
+    maxHi[k] = (k > 0 && maxHi[k - 1] > extents[k].hi)
+      ? maxHi[k - 1] : extents[k].hi;
+  }
+  *extentsP = extents;
+  *maxHiP = maxHi;
+  return n;
+}
+
+/** Return true iff entry, the start of the function at position fn,
+ *  is within a block of another function among extents[n]: a branch
+ *  target within it or code it runs into.  The blocks of fn itself
+ *  end at or before entry, except for the one starting there.
+ */
+static bool
+is_in_other_fn(const BlockExtent extents[], const unsigned char *maxHi[],
+               int n, int fn, const unsigned char *entry)
+{
+  int lo = 0, hi = n;
+  while (lo < hi) {
+    int mid = lo + (hi - lo)/2;
+    if (extents[mid].lo < entry) lo = mid + 1; else hi = mid;
+  }
+  if (lo > 0 && maxHi[lo - 1] > entry) return true;
+  for (int k = lo; k < n && extents[k].lo == entry; k++) {
+    if (extents[k].fn != fn) return true;
+  }
+  return false;
+}
+
+/** Patch the functions in fnsData, which must have been traced with
+ *  the isCfg option from loaded code.  Only functions whose entry is
+ *  among the nFnStarts sorted fnStarts, such as those in the symbol
+ *  table, are patched, unless fnStarts is NULL.  A function is also
+ *  left unpatched when its entry cannot be safely displaced: when its
+ *  first 5 bytes are not straight-line code of the function, or are a
+ *  branch target, or its entry is within the code of another traced
+ *  function.  Only one profile may exist at a time and the patched
+ *  code must only be run by one thread.  Returns NULL with errno set
+ *  if the trampolines could not be allocated near the code.
+ */
+FnProfile *
+new_fn_profile(const FnsData *fnsData, void *const fnStarts[], int nFnStarts)
+{
+  if (isActive) fatal("only one FnProfile may exist at a time\n");
+  int nFns = n_fn_infos(fnsData);
+  FnProfile *profile = callocChk(1, sizeof(FnProfile));
+  profile->nFns = nFns;
+  profile->records = callocChk(nFns + 1, sizeof(ProfileRecord));
+  profile->entries = callocChk(nFns + 1, sizeof(unsigned char *));
+  profile->saved = callocChk(nFns + 1, sizeof(*profile->saved));
+  if (nFns > 0) {
+    const FnInfo *last = fn_info_at(fnsData, nFns - 1);
+    const unsigned char *lo = fn_info_at(fnsData, 0)->address;
+    const unsigned char *hi =
+      (unsigned char *)last->address + last->length + JMP_SIZE;
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    profile->stubsSize =
+      ((size_t)nFns * STUB_SIZE + pageSize - 1) & ~(pageSize - 1);
+    profile->stubs = map_near(lo, hi, profile->stubsSize);
+    if (profile->stubs == NULL) {
+      int err = errno;
+      profile->stubsSize = 0;
+      free_fn_profile(profile);
+      errno = err;
+      return NULL;
+    }
+  }
+  BlockExtent *extents;
+  const unsigned char **maxHi;
+  int nExtents = get_block_extents(fnsData, &extents, &maxHi);
+  Lde *lde = new_lde();
+  for (int i = 0; i < nFns; i++) {
+    unsigned char *entry = fn_info_at(fnsData, i)->address;
+    if (fnStarts != NULL && !is_start(fnStarts, nFnStarts, entry)) continue;
+    if (is_in_other_fn(extents, maxHi, nExtents, i, entry)) continue;
+    const unsigned char *limit =
+      (i + 1 < nFns) ? fn_info_at(fnsData, i + 1)->address : NULL;
+    const FnCfg *cfg = fn_cfg(fnsData, i);
+    unsigned char *stub = profile->stubs + (size_t)i * STUB_SIZE;
+    unsigned char *resume = stub + 1 + sizeof(int32_t) + ABS_JMP_SIZE;
+    int nResume;
+    int n = (cfg == NULL)
+      ? 0 : displace_entry(lde, cfg, entry, limit, resume, &nResume);
+    if (n == 0) continue;
+    assert(resume + nResume <= stub + STUB_SIZE);
+    int32_t index = i;
+    stub[0] = PUSH_IMM32;
+    memcpy(stub + 1, &index, sizeof(index));
+    put_abs_jmp(stub + 1 + sizeof(index), fn_profile_enter);
+    profile->records[i].resume = resume;
+    profile->entries[i] = entry;
+  }
+  free_lde(lde);
+  free(extents);
+  free(maxHi);
+  if (profile->stubs != NULL &&
+      mprotect(profile->stubs, profile->stubsSize, PROT_READ | PROT_EXEC) != 0) {
+    fatal("cannot make profile trampolines executable:");
+  }
+  fn_profile_records = profile->records;
+  fn_profile_sp = shadowStack;
+  fn_profile_sp_limit = shadowStack + MAX_DEPTH;
+  isActive = true;
+  patch_entries(profile, true);
+  return profile;
+}
+
+/** If the function at position index in the FnsData profile was
+ *  created for was patched, set *nCallsP to the # of times it was
+ *  entered and *ticksP to the # of time-stamp counter ticks spent in
+ *  it, including in the functions it calls, and return true.  Time in
+ *  recursive calls is counted once per active call.  Otherwise return
+ *  false.
+ */
+bool
+fn_profile_counts(const FnProfile *profile, int index,
+                  unsigned long *nCallsP, unsigned long long *ticksP)
+{
+  if (profile->entries[index] == NULL) return false;
+  *nCallsP = profile->records[index].nCalls;
+  *ticksP = profile->records[index].ticks;
+  return true;
+}
+
+/** Restore the code patched by profile and free it. */
+void
+free_fn_profile(FnProfile *profile)
+{
+  if (isActive && fn_profile_records == profile->records) {
+    patch_entries(profile, false);
+    fn_profile_records = NULL;
+    isActive = false;
+  }
+  if (profile->stubsSize > 0) munmap(profile->stubs, profile->stubsSize);
+  free(profile->records);
+  free(profile->entries);
+  free(profile->saved);
+  free(profile);
+}
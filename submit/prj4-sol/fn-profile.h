@@ -0,0 +1,44 @@
+#ifndef FN_PROFILE_H_
+#define FN_PROFILE_H_
+
+#include "fn-trace.h"
+
+#include <stdbool.h>
+
+/** Dynamic call counts for traced functions.  Creating an FnProfile
+ *  patches the entry of each function of an FnsData with a jump to a
+ *  counting trampoline, so that the functions can then be run to
+ *  measure how often each is actually called and how long it runs.
+ *  The code must be loaded and writable with mprotect(); the original
+ *  code is restored when the profile is freed.
+ */
+typedef struct FnProfileImpl FnProfile;
+
+/** Patch the functions in fnsData, which must have been traced with
+ *  the isCfg option from loaded code.  Only functions whose entry is
+ *  among the nFnStarts sorted fnStarts, such as those in the symbol
+ *  table, are patched, unless fnStarts is NULL.  A function is also
+ *  left unpatched when its entry cannot be safely displaced: when its
+ *  first 5 bytes are not straight-line code of the function, or are a
+ *  branch target, or its entry is within the code of another traced
+ *  function.  Only one profile may exist at a time and the patched
+ *  code must only be run by one thread.  Returns NULL with errno set
+ *  if the trampolines could not be allocated near the code.
+ */
+FnProfile *new_fn_profile(const FnsData *fnsData, void *const fnStarts[],
+                          int nFnStarts);
+
+/** If the function at position index in the FnsData profile was
+ *  created for was patched, set *nCallsP to the # of times it was
+ *  entered and *ticksP to the # of time-stamp counter ticks spent in
+ *  it, including in the functions it calls, and return true.  Time in
+ *  recursive calls is counted once per active call.  Otherwise return
+ *  false.
+ */
+bool fn_profile_counts(const FnProfile *profile, int index,
+                       unsigned long *nCallsP, unsigned long long *ticksP);
+
+/** Restore the code patched by profile and free it. */
+void free_fn_profile(FnProfile *profile);
+
+#endif //ifndef FN_PROFILE_H_
@@ -1,35 +1,164 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "fn-trace.h"
+#include "arena.h"
+#include "fn-cfg.h"
 #include "x86-64_lde.h"
 
 #include "memalloc.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-static inline bool is_call(unsigned op);
-static inline bool is_ret(unsigned op);
-
-FnInfo* new_fn_info();
+FnInfo* new_fn_info(Arena*, void*, unsigned, unsigned, unsigned);
 FnsData* make_fns_data();
 void add_item(FnsData*, FnInfo*);
 void grow(FnsData*);
 int compare(const void*, const void*);
-bool contains_fn(FnsData*, void*);
+bool claim_fn(FnsData*, Arena*, void*, bool);
+
+static inline unsigned long hash_addr(void*);
+static FnInfo** index_slot(const FnsData*, void*);
+static void grow_index(FnsData*, int);
+
+typedef const unsigned char instruction;
+
+typedef struct { void *caller, *callee; } CallEdge;
+typedef struct { CallEdge *edges; int len, cap; } EdgeBuf;
+typedef struct { void *address; FnCfg *cfg; FnMix mix; } DetailEntry;
+typedef struct { DetailEntry *details; int len, cap; } DetailBuf;
+typedef struct { instruction *lo, *hi; } Extent;
+
+// forward jmp whose target is only known to be in the function or not
+// once the rest of it has been decoded; cfgInsn indexes its CfgInsn
+typedef struct { instruction* target; int cfgInsn; } Deferred;
+
+// register last loaded from (isLoad) or set to the address of (lea)
+// a RIP-relative operand, so that a following call/jmp through the
+// register can be resolved
+typedef struct { int reg; instruction* addr; bool isLoad; } RipReg;
 
-void traceFn(void*, Lde*, FnsData*);
+// per-thread state; the stack and extents are reused for each function
+typedef struct {
+	FnsData* fd;
+	Lde* lde;
+	EdgeBuf edges;
+	instruction** pending;   // branch targets in this function to decode
+	int nPending, pendingCap;
+	Extent* done;            // code of this function decoded so far, in
+	int nDone, doneCap;      // address order, adjacent extents merged
+	Deferred* deferred;      // forward jmps, when no starts are known
+	int nDeferred, deferredCap;
+	CfgScratch cfgScratch;   // only used when building CFGs ...
+	Arena arena;             // ... which are allocated here
+	FnMix mix;               // of the function being decoded, if isMix
+	DetailBuf details;       // CFGs and mixes of the functions decoded
+	Arena fnArena;           // FnInfo's of the functions this worker claims
+} Worker;
+
+void traceFn(void* const*, int, FnsData*, int);
+static void* trace_worker(void*);
+static FnInfo* next_work(FnsData*, FnInfo*);
+static void decode_fn(FnInfo*, Worker*);
+static instruction* decode_block(FnInfo*, Worker*, instruction*, instruction*,
+                                 instruction*);
+static void push_pending(Worker*, instruction*);
+static void defer_jmp(Worker*, instruction*);
+static int find_done(const Worker*, instruction*);
+static bool is_decoded(const Worker*, instruction*);
+static void add_done(Worker*, int, instruction*, instruction*);
+static void out_call(FnInfo*, Worker*, instruction*);
+static void add_edge(EdgeBuf*, void*, void*);
+static void add_details(DetailBuf*, void*, FnCfg*, const FnMix*);
+static void count_insn(FnMix*, LdeOpClass, unsigned);
+static instruction* fn_limit(const FnsData*, instruction*);
+static int find_start(void* const*, int, instruction*);
+static bool is_in_part(const FnsData*, instruction*);
+static bool is_inside_fn(const FnsData*, instruction*);
+static instruction* skip_prefixes(instruction*, unsigned*);
+static instruction* branch_target(instruction*, int);
+static RipReg rip_reg(instruction*, int);
+static instruction* indirect_target(const FnsData*, instruction*, int,
+                                    const RipReg*, instruction**, bool*);
+static instruction* plt_slot(const FnsData*, instruction*);
+static instruction* plt_target(const FnsData*, instruction*);
+static instruction* resolve_slot(const FnsData*, instruction*);
+static bool is_no_return(const FnsData*, instruction*, instruction*);
+static bool is_listed(void* const*, int, instruction*);
+static bool is_stop(instruction*);
+static bool is_padding(const Worker*, instruction*, instruction*);
+static bool is_nop(instruction*);
 
 void sort_fns(FnsData*);
+static void pack_fns(FnsData*);
+static int find_fn(const FnsData*, void*);
+static void build_adjacency(FnsData*);
+static void index_details(FnsData*);
+static int* csr_rows(const int*, const int*, int, int, int**);
+static int reachable(const int*, const int*, int, int, int*);
 
-enum { INIT_SIZE = 2 };
+enum { INIT_SIZE = 2, INIT_INDEX_SIZE = 16, MAX_THREADS = 64 };
 
 struct FnsDataImpl {
 	FnInfo **list;
 	int len, cap;
-};
+	int nDecoded;    // list[nDecoded..len) is the worklist of functions
+	                 // discovered but not yet decoded
+	int nBusy;       // # of workers currently decoding a function
+	pthread_mutex_t lock;  // guards list, len, cap, nDecoded, nBusy
+	pthread_cond_t hasWork;
 
-typedef const unsigned char instruction;
+	FnInfo **index;  // open-addressing hash table of list keyed by address;
+	                 // slots are filled by compare-and-swap
+	int indexCap;    // power of 2, always > 2*(indexLen + nThreads)
+	int indexLen;    // updated atomically; includes claims in progress
+	int maxFns;      // claims beyond this many are refused; 0 if no limit
+	bool isTruncated;  // set once a claim has been refused
+	int nThreads;
+	pthread_rwlock_t indexLock;  // write-locked only to grow index
+
+	const unsigned char *codeLo, *codeHi;  // only code in this range is
+	                                       // read and traced
+	void *const *fnStarts;  // sorted known entry points bounding functions
+	int nFnStarts;
+	void *const *fnEnds;    // symbol end of each of fnStarts, or NULL
+	void *const *fnParts;   // sorted entry points of parts of functions
+	int nFnParts;
+	void *const *noReturnFns;    // sorted entry points of functions and
+	int nNoReturnFns;            // pointer slots to functions which
+	void *const *noReturnSlots;  // never return
+	int nNoReturnSlots;
+	void *(*resolveSlot)(void *ctx, const void *slot);
+	void *resolveCtx;
+	bool isCfg;
+	bool isMix;
+
+	CallEdge *edges; // one per traced call site, merged from the workers
+	int nEdges;      // under lock; freed once the adjacency is built
+	DetailEntry *detailList;  // like edges, for CFGs and mixes when
+	int nDetails;             // isCfg or isMix
+	Arena arena;     // CFGs of all functions
+	Arena fnArena;   // FnInfo records in list, merged from the workers
+
+	FnInfo *fns;     // contiguous copy of list in address order, built
+	                 // once tracing is done; list, index and fnArena
+	                 // are then freed
+
+	// caller->callee graph in compressed sparse row form over indexes
+	// into fns: the callees of fns[i] are callees[calleeStart[i] ..
+	// calleeStart[i+1]), one entry per call site; callers is the
+	// transpose
+	int *calleeStart, *callees;
+	int *callerStart, *callers;
+
+	FnCfg **cfgs;    // CFG of fns[i], when isCfg
+	FnMix *mixes;    // instruction mix of fns[i], when isMix
+};
 
 /** Return pointer to opaque data structure containing collection of
  *  FnInfo's for functions which are callable directly or indirectly
@@ -38,13 +167,116 @@ typedef const unsigned char instruction;
 const FnsData *
 new_fns_data(void *rootFn)
 {
+	return new_fns_data_parallel(rootFn, 1);
+}
+
+/** Like new_fns_data(), but decodes function bodies using nThreads
+ *  worker threads.  The result is identical to that of new_fns_data(),
+ *  provided the pointer slots read to follow calls through the PLT and
+ *  GOT do not change meanwhile: lazily bound slots of a loaded module
+ *  do when the tracing threads are created, so they are best resolved
+ *  as by new_fns_data_options() with a resolveSlot which does not
+ *  depend on binding.
+ */
+const FnsData *
+new_fns_data_parallel(void *rootFn, int nThreads)
+{
+	return new_fns_data_range(rootFn, NULL, (void*) UINTPTR_MAX, nThreads);
+}
+
+/** Like new_fns_data_parallel(), but only code in [codeLo, codeHi) is
+ *  read: decoding stops at codeHi and calls to functions outside the
+ *  range are counted in nOutCalls but not traced.
+ */
+const FnsData *
+new_fns_data_range(void *rootFn, const void *codeLo, const void *codeHi,
+                   int nThreads)
+{
+	return new_fns_data_roots(&rootFn, 1, codeLo, codeHi, nThreads);
+}
+
+/** Like new_fns_data_range(), but traces from each of the nRoots
+ *  functions in roots into a single collection, decoding every function
+ *  once however many roots reach it.  Roots outside [codeLo, codeHi)
+ *  are ignored and a root is not counted as a call to itself.
+ */
+const FnsData *
+new_fns_data_roots(void *const roots[], int nRoots,
+                   const void *codeLo, const void *codeHi, int nThreads)
+{
+	FnTraceOptions options = {
+		.codeLo = codeLo, .codeHi = codeHi, .nThreads = nThreads,
+	};
+	return new_fns_data_options(roots, nRoots, &options);
+}
+
+/** Like new_fns_data_roots() with the code range and # of threads
+ *  given in options, which also supply the known function entry points
+ *  and the resolution of pointer slots used to follow calls through
+ *  the PLT and GOT.
+ */
+const FnsData *
+new_fns_data_options(void *const roots[], int nRoots,
+                     const FnTraceOptions *options)
+{
+	int nThreads = options->nThreads;
+	if (nThreads < 1) nThreads = 1;
+	if (nThreads > MAX_THREADS) nThreads = MAX_THREADS;
 	FnsData *fd = make_fns_data();
-	Lde* lde = new_lde();
-	traceFn(rootFn, lde, fd);
-	free_lde(lde);
+	fd->codeLo = options->codeLo;
+	fd->codeHi = (options->codeHi == NULL)
+		? (instruction*) UINTPTR_MAX : options->codeHi;
+	fd->fnStarts = options->fnStarts;
+	fd->nFnStarts = (options->fnStarts == NULL) ? 0 : options->nFnStarts;
+	fd->fnEnds = options->fnEnds;
+	fd->fnParts = options->fnParts;
+	fd->nFnParts = (options->fnParts == NULL) ? 0 : options->nFnParts;
+	fd->noReturnFns = options->noReturnFns;
+	fd->nNoReturnFns = (options->noReturnFns == NULL) ? 0 : options->nNoReturnFns;
+	fd->noReturnSlots = options->noReturnSlots;
+	fd->nNoReturnSlots =
+		(options->noReturnSlots == NULL) ? 0 : options->nNoReturnSlots;
+	fd->resolveSlot = options->resolveSlot;
+	fd->resolveCtx = options->resolveCtx;
+	fd->isCfg = options->isCfg;
+	fd->isMix = options->isMix;
+	fd->maxFns = (options->maxFns < 0) ? 0 : options->maxFns;
+	traceFn(roots, nRoots, fd, nThreads);
 
-//	qsort(fd->list, fd->len, sizeof(FnInfo*), compare);
 	sort_fns(fd);
+	pack_fns(fd);
+	build_adjacency(fd);
+	index_details(fd);
+	return (const FnsData*) fd;
+}
+
+/** Return an FnsData holding the call graph of the nFns functions in
+ *  fns, which must be in increasing address order, where the callees
+ *  of fns[i] are the positions callees[calleeStart[i] ..
+ *  calleeStart[i+1]), as returned by fn_callees(): for example a graph
+ *  traced and saved earlier.  The arrays are copied.  The result has
+ *  no CFGs or instruction mixes.
+ */
+const FnsData *
+new_fns_data_graph(const FnInfo fns[], int nFns, const int calleeStart[],
+                   const int callees[])
+{
+	FnsData *fd = make_fns_data();
+	pack_fns(fd);    // nothing traced: only releases the tracing state
+	free(fd->fns);
+	fd->len = nFns;
+	fd->fns = malloc((nFns + 1) * sizeof(FnInfo));
+	memcpy(fd->fns, fns, nFns * sizeof(FnInfo));
+	int nEdges = calleeStart[nFns];
+	int* from = malloc((nEdges + 1) * sizeof(int));
+	for (int i = 0; i < nFns; i++) {
+		for (int e = calleeStart[i]; e < calleeStart[i + 1]; e++) {
+			from[e] = i;
+		}
+	}
+	fd->calleeStart = csr_rows(from, callees, nEdges, nFns, &fd->callees);
+	fd->callerStart = csr_rows(callees, from, nEdges, nFns, &fd->callers);
+	free(from);
 	return (const FnsData*) fd;
 }
 
@@ -55,12 +287,14 @@ new_fns_data(void *rootFn)
 void
 free_fns_data(FnsData *fd)
 {
-	for (int i = 0; i < fd->len; i++) {
-		FnInfo* p = fd->list[i];
-		if (p != NULL)
-			free(p);
-	}
-	free(fd->list);
+	free(fd->fns);
+	free(fd->calleeStart);
+	free(fd->callees);
+	free(fd->callerStart);
+	free(fd->callers);
+	free(fd->cfgs);
+	free(fd->mixes);
+	free_arena(&fd->arena);
 	free(fd);
 }
 
@@ -80,62 +314,640 @@ free_fns_data(FnsData *fd)
 const FnInfo *
 next_fn_info(const FnsData *fd, const FnInfo *last)
 {
-	if (fd == NULL) {
+	if (fd == NULL || fd->len == 0) {
 		return NULL;
 	}
 	if (last == NULL) {
-		return fd->list[0];
+		return &fd->fns[0];
 	}
-	for (int i = 0; i < fd->len - 1; i++) {
-		if (!compare((const void*)fd->list[i], (const void*)last))
-			return fd->list[i+1];
+	// last always points into fd->fns, so its successor is adjacent
+	return (last + 1 < fd->fns + fd->len) ? last + 1 : NULL;
+}
+
+/** Return the control-flow graph of the function at position index in
+ *  fnsData, which must have been traced with the isCfg option; NULL
+ *  otherwise.  The graph belongs to fnsData.
+ */
+const FnCfg *
+fn_cfg(const FnsData *fd, int index)
+{
+	return (fd->cfgs == NULL) ? NULL : fd->cfgs[index];
+}
+
+/** Return the instruction mix of the function at position index in
+ *  fnsData, which must have been traced with the isMix option; NULL
+ *  otherwise.
+ */
+const FnMix *
+fn_mix(const FnsData *fd, int index)
+{
+	return (fd->mixes == NULL) ? NULL : &fd->mixes[index];
+}
+
+/** Return true iff tracing fnsData reached the maxFns limit of its
+ *  options, so that some called functions were not traced.
+ */
+bool
+fns_data_is_truncated(const FnsData *fd)
+{
+	return fd->isTruncated;
+}
+
+/** Return the # of FnInfo's in fnsData. */
+int
+n_fn_infos(const FnsData *fd)
+{
+	return (fd == NULL) ? 0 : fd->len;
+}
+
+/** Return the FnInfo at position index (0-based, in next_fn_info()
+ *  order) in fnsData.
+ */
+const FnInfo *
+fn_info_at(const FnsData *fd, int index)
+{
+	assert(0 <= index && index < fd->len);
+	return &fd->fns[index];
+}
+
+/** Return the position of fnInfo, which must have been returned by
+ *  next_fn_info() or fn_info_at() for fnsData.
+ */
+int
+fn_info_index(const FnsData *fd, const FnInfo *fnInfo)
+{
+	return fnInfo - fd->fns;
+}
+
+/** Set *calleesP to the positions of the functions called directly by
+ *  the function at position index and return their #.  There is one
+ *  entry per call site traced, in increasing order.  The array belongs
+ *  to fnsData.
+ */
+int
+fn_callees(const FnsData *fd, int index, const int **calleesP)
+{
+	*calleesP = &fd->callees[fd->calleeStart[index]];
+	return fd->calleeStart[index + 1] - fd->calleeStart[index];
+}
+
+/** Like fn_callees(), but for the functions calling the function at
+ *  position index.
+ */
+int
+fn_callers(const FnsData *fd, int index, const int **callersP)
+{
+	*callersP = &fd->callers[fd->callerStart[index]];
+	return fd->callerStart[index + 1] - fd->callerStart[index];
+}
+
+/** Store in result the positions of all functions reachable from the
+ *  function at position index by one or more calls and return their #.
+ *  result must have room for n_fn_infos(fnsData) entries.  The order
+ *  is breadth-first.
+ */
+int
+fn_transitive_callees(const FnsData *fd, int index, int result[])
+{
+	return reachable(fd->calleeStart, fd->callees, fd->len, index, result);
+}
+
+/** Like fn_transitive_callees(), but for all functions from which the
+ *  function at position index is reachable.
+ */
+int
+fn_transitive_callers(const FnsData *fd, int index, int result[])
+{
+	return reachable(fd->callerStart, fd->callers, fd->len, index, result);
+}
+
+
+/** Decoders are kept between traces so that their caches of decoded
+ *  instructions can be reused when the same code is traced again.
+ */
+static struct {
+	pthread_mutex_t lock;
+	Lde* idle[MAX_THREADS];
+	int nIdle;
+} ldePool = { PTHREAD_MUTEX_INITIALIZER, { NULL }, 0 };
+
+static Lde* acquire_lde(void) {
+	pthread_mutex_lock(&ldePool.lock);
+	Lde* lde = (ldePool.nIdle > 0) ? ldePool.idle[--ldePool.nIdle] : new_lde();
+	pthread_mutex_unlock(&ldePool.lock);
+	return lde;
+}
+
+static void release_lde(Lde* lde) {
+	pthread_mutex_lock(&ldePool.lock);
+	if (ldePool.nIdle < MAX_THREADS) {
+		ldePool.idle[ldePool.nIdle++] = lde;
+		lde = NULL;
+	}
+	pthread_mutex_unlock(&ldePool.lock);
+	if (lde != NULL) free_lde(lde);
+}
+
+/** Must be called before code in [lo, hi) is unmapped or modified
+ *  (for example by dlclose()) after it has been traced.
+ */
+void
+fn_trace_unload(const void *lo, const void *hi)
+{
+	pthread_mutex_lock(&ldePool.lock);
+	for (int i = 0; i < ldePool.nIdle; i++) {
+		lde_invalidate(ldePool.idle[i], lo, hi);
+	}
+	pthread_mutex_unlock(&ldePool.lock);
+}
+
+// Breadth-first traversal of the call graph from roots.  Functions are
+// appended to fd->list as they are discovered, so the undecoded tail of
+// the list serves as the work queue: no recursion and no memory beyond
+// the FnInfo records themselves, whose # is bounded by fd->maxFns.  Each
+// function is decoded exactly once, by whichever of the nThreads workers
+// takes it off the queue.
+void traceFn(void* const* roots, int nRoots, FnsData* fd, int nThreads) {
+	fd->nThreads = nThreads;
+	for (int r = 0; r < nRoots; r++) {
+		instruction* root = roots[r];
+		if (fd->codeLo <= root && root < fd->codeHi)
+			claim_fn(fd, &fd->fnArena, roots[r], false);
+	}
+	pthread_t threads[nThreads];
+	for (int t = 1; t < nThreads; t++) {
+		if (pthread_create(&threads[t], NULL, trace_worker, fd) != 0) {
+			fprintf(stderr, "cannot create trace thread\n");
+			exit(1);
+		}
+	}
+	trace_worker(fd);
+	for (int t = 1; t < nThreads; t++) {
+		pthread_join(threads[t], NULL);
 	}
-	return NULL;
 }
 
+// Each worker owns an Lde since capstone handles are not thread-safe
+static void* trace_worker(void* arg) {
+	Worker w = { .fd = arg, .lde = acquire_lde() };
+	FnsData* fd = w.fd;
+	for (FnInfo* fi = next_work(fd, NULL); fi != NULL; fi = next_work(fd, fi)) {
+		decode_fn(fi, &w);
+	}
+	release_lde(w.lde);
+	free(w.pending);
+	free(w.done);
+	free(w.deferred);
+	free_cfg_scratch(&w.cfgScratch);
 
-/** recognized opcodes for calls and returns */
-enum {
-  CALL_OP = 0xE8,    //used to identify an external call which is traced
+	// edges and CFGs are kept per worker while tracing and merged once
+	// at the end
+	EdgeBuf* buf = &w.edges;
+	pthread_mutex_lock(&fd->lock);
+	fd->edges = realloc(fd->edges, (fd->nEdges + buf->len + 1) * sizeof(CallEdge));
+	for (int e = 0; e < buf->len; e++) {
+		fd->edges[fd->nEdges++] = buf->edges[e];
+	}
+	fd->detailList = realloc(fd->detailList,
+	                         (fd->nDetails + w.details.len + 1) * sizeof(DetailEntry));
+	for (int c = 0; c < w.details.len; c++) {
+		fd->detailList[fd->nDetails++] = w.details.details[c];
+	}
+	move_arena(&fd->arena, &w.arena);
+	move_arena(&fd->fnArena, &w.fnArena);
+	pthread_mutex_unlock(&fd->lock);
+	free(buf->edges);
+	free(w.details.details);
+	return NULL;
+}
 
-  //used to recognize the end of a function
-  RET_FAR_OP = 0xCB,
-  RET_FAR_WITH_POP_OP = 0xCA,
-  RET_NEAR_OP = 0xC3,
-  RET_NEAR_WITH_POP_OP = 0xC2
-};
+// Mark done (if not NULL) as decoded and return the next undecoded
+// function, waiting while other workers may still queue more.
+// Returns NULL once the queue is empty and no worker is busy.
+static FnInfo* next_work(FnsData* fd, FnInfo* done) {
+	FnInfo* fi = NULL;
+	pthread_mutex_lock(&fd->lock);
+	if (done != NULL) fd->nBusy--;
+	while (fd->nDecoded == fd->len && fd->nBusy > 0) {
+		pthread_cond_wait(&fd->hasWork, &fd->lock);
+	}
+	if (fd->nDecoded < fd->len) {
+		fi = fd->list[fd->nDecoded++];
+		fd->nBusy++;
+	} else {
+		pthread_cond_broadcast(&fd->hasWork);  // all done; wake waiters
+	}
+	pthread_mutex_unlock(&fd->lock);
+	return fi;
+}
+
+// Decode all code of fi reachable from its entry by intra-function
+// branches, queueing newly seen callees and recording an edge for each
+// traced call.  A branch stays within fi if its target lies between the
+// entry and the next known function start (or the end of the code), or
+// within a part split off from a function; otherwise it is a tail call.
+// Without known starts the code is not bounded, so branches to before
+// the entry are tail calls and so is a forward jmp unless its target
+// turns out to be within the code reached from the entry by the other
+// branches: both the join of an if-else and the next function follow
+// a jmp.
+static void decode_fn(FnInfo* fi, Worker* w) {
+	instruction* entry = fi->address;
+	instruction* limit = fn_limit(w->fd, entry);
+	w->nPending = w->nDone = w->nDeferred = 0;
+	w->mix = (FnMix) { 0 };
+	push_pending(w, entry);
+	while (w->nPending > 0) {
+		instruction* start = w->pending[--w->nPending];
+		instruction* stop = (entry <= start && start < limit)
+			? limit : fn_limit(w->fd, start);  // in a part
+		int d = find_done(w, start);
+		if (d > 0 && start < w->done[d - 1].hi) continue;  // already decoded
+		if (d < w->nDone && w->done[d].lo < stop) stop = w->done[d].lo;
+		instruction* end = decode_block(fi, w, start, stop, limit);
+		add_done(w, d, start, end);
+	}
+	for (int d = 0; d < w->nDeferred; d++) {
+		Deferred* jmp = &w->deferred[d];
+		if (!is_decoded(w, jmp->target)) {
+			out_call(fi, w, jmp->target);  // tail call
+		} else if (w->fd->isCfg) {
+			CfgInsn* insn = &w->cfgScratch.insns[jmp->cfgInsn];
+			insn->flow = CFG_JUMP;
+			insn->target = jmp->target;
+		}
+	}
+	if (w->fd->isCfg || w->fd->isMix) {
+		FnCfg* cfg = w->fd->isCfg
+			? build_fn_cfg(&w->arena, &w->cfgScratch, entry) : NULL;
+		add_details(&w->details, fi->address, cfg, &w->mix);
+	}
+}
 
-static inline bool is_call(unsigned op) { return op == CALL_OP; }
-static inline bool is_ret(unsigned op) {
-  return
-    op == RET_NEAR_OP || op == RET_NEAR_WITH_POP_OP ||
-    op == RET_FAR_OP || op == RET_FAR_WITH_POP_OP;
-}
-
-//TODO: add auxiliary functions
-
-void traceFn(void* addr, Lde* lde, FnsData* fd) {
-	FnInfo* ret = new_fn_info(addr, 0, 0, 0);
-	add_item(fd, ret);
-
-	instruction* i = (instruction*) addr;
-	while (!is_ret(*i)) {
-		int l = get_op_length(lde, i);
-		ret->length += l;
-		if (is_call(*i)) {
-			int next_call_offset = *((int *)(i+1));
-			void* next_call = (void*)(i + l + next_call_offset);
-			if (!contains_fn(fd, next_call))
-				traceFn(next_call, lde, fd);
-			ret->nOutCalls += 1;
+// Decode straight-line code of fi from start until a ret, jmp, call
+// which does not return or stop, queueing intra-function branch
+// targets and, if building CFGs, recording each instruction.  Decoding
+// also ends before padding or an undecodable instruction: without
+// symbols, fall-through after an unrecognized noreturn call is the
+// only way into the padding, data or next function which follows.
+// Returns the end of the code decoded.  As before, ret instructions do
+// not count in fi->length.
+static instruction* decode_block(FnInfo* fi, Worker* w, instruction* start,
+                                 instruction* stop, instruction* limit) {
+	instruction* entry = fi->address;
+	bool isCfg = w->fd->isCfg;
+	bool isMix = w->fd->isMix;
+	RipReg ripReg = { -1, NULL, false };
+	instruction* i = start;
+	while (i < stop) {
+		LdeOpClass opClass;
+		unsigned kinds;
+		int l = isMix ? get_op_kinds(w->lde, i, &opClass, &kinds)
+		              : get_op_info(w->lde, i, &opClass);
+		if (l < 0 || l > (uintptr_t) stop - (uintptr_t) i) break;
+		if (is_padding(w, i, stop)) break;
+		CfgFlow flow = CFG_FALL;
+		instruction* target = NULL;
+		instruction* slot = NULL;
+		bool isKnown;
+		switch (opClass) {
+		case LDE_OP_RET:
+			flow = CFG_EXIT;
+			break;
+		case LDE_OP_CALL:
+			out_call(fi, w, branch_target(i, l));
+			if (is_no_return(w->fd, branch_target(i, l), NULL)) flow = CFG_EXIT;
+			break;
+		case LDE_OP_CALL_INDIRECT:
+		case LDE_OP_JMP_INDIRECT:
+			target = indirect_target(w->fd, i, l, &ripReg, &slot, &isKnown);
+			if (isKnown) out_call(fi, w, target);
+			if (opClass == LDE_OP_JMP_INDIRECT) flow = CFG_EXIT;  // or jump table
+			else if (isKnown && is_no_return(w->fd, target, slot)) flow = CFG_EXIT;
+			break;
+		case LDE_OP_JCC:
+		case LDE_OP_JMP:
+			target = branch_target(i, l);
+			if (opClass == LDE_OP_JMP && w->fd->nFnStarts == 0 && target > i) {
+				defer_jmp(w, target);
+				flow = CFG_EXIT;  // until known to be within fi
+			} else if ((entry <= target && target < limit) ||
+			           is_in_part(w->fd, target)) {
+				push_pending(w, target);
+				flow = (opClass == LDE_OP_JMP) ? CFG_JUMP : CFG_COND;
+			} else {
+				out_call(fi, w, target);  // tail call
+				flow = (opClass == LDE_OP_JMP) ? CFG_EXIT : CFG_COND;
+			}
+			break;
+		default:
+			if (is_stop(i)) flow = CFG_EXIT;
 		}
+		if (isCfg) {
+			bool isBranch = (opClass == LDE_OP_JCC || opClass == LDE_OP_JMP ||
+			                 opClass == LDE_OP_JMP_INDIRECT);
+			add_cfg_insn(&w->cfgScratch, i, l, flow, target, isBranch);
+		}
+		if (isMix) count_insn(&w->mix, opClass, kinds);
+		if (opClass != LDE_OP_RET) fi->length += l;
+		if (flow == CFG_EXIT || flow == CFG_JUMP) return i + l;
+		ripReg = rip_reg(i, l);
 		i += l;
 	}
-	return;
+	return i;
+}
+
+static void push_pending(Worker* w, instruction* target) {
+	if (w->nPending >= w->pendingCap) {
+		w->pendingCap = (w->pendingCap == 0) ? 16 : 2 * w->pendingCap;
+		w->pending = realloc(w->pending, w->pendingCap * sizeof(instruction*));
+	}
+	w->pending[w->nPending++] = target;
+}
+
+// Record a forward jmp to target, which must be the next instruction
+// added to the CFG scratch
+static void defer_jmp(Worker* w, instruction* target) {
+	if (w->nDeferred >= w->deferredCap) {
+		w->deferredCap = (w->deferredCap == 0) ? 16 : 2 * w->deferredCap;
+		w->deferred = realloc(w->deferred, w->deferredCap * sizeof(Deferred));
+	}
+	w->deferred[w->nDeferred++] = (Deferred) { target, w->cfgScratch.nInsns };
+}
+
+// Returns the index of the first extent decoded which starts after p
+static int find_done(const Worker* w, instruction* p) {
+	int lo = 0, hi = w->nDone;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (w->done[mid].lo <= p) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+// True iff p is within the code of the current function decoded so far
+static bool is_decoded(const Worker* w, instruction* p) {
+	int d = find_done(w, p);
+	return d > 0 && p < w->done[d - 1].hi;
+}
+
+// Insert [lo, hi) as done[d], where find_done(w, lo) is d, merging it
+// with the extents it abuts so that straight-line code split by
+// branches into it stays one extent
+static void add_done(Worker* w, int d, instruction* lo, instruction* hi) {
+	if (lo == hi) return;
+	bool isAfterPrev = d > 0 && w->done[d - 1].hi == lo;
+	bool isBeforeNext = d < w->nDone && w->done[d].lo == hi;
+	if (isAfterPrev && isBeforeNext) {
+		w->done[d - 1].hi = w->done[d].hi;
+		memmove(&w->done[d], &w->done[d + 1], (w->nDone - d - 1) * sizeof(Extent));
+		w->nDone--;
+	} else if (isAfterPrev) {
+		w->done[d - 1].hi = hi;
+	} else if (isBeforeNext) {
+		w->done[d].lo = lo;
+	} else {
+		if (w->nDone >= w->doneCap) {
+			w->doneCap = (w->doneCap == 0) ? 16 : 2 * w->doneCap;
+			w->done = realloc(w->done, w->doneCap * sizeof(Extent));
+		}
+		memmove(&w->done[d + 1], &w->done[d], (w->nDone - d) * sizeof(Extent));
+		w->done[d] = (Extent) { lo, hi };
+		w->nDone++;
+	}
+}
+
+// Count a call from fi to target (NULL if unknown), following a PLT stub
+// to the function it jumps to, and trace target if it is in range and
+// within the maxFns budget.  A target within the code of a known
+// function or part but not at its start is not traced: it is not the
+// entry of a function.
+static void out_call(FnInfo* fi, Worker* w, instruction* target) {
+	FnsData* fd = w->fd;
+	fi->nOutCalls += 1;
+	if (target != NULL) target = plt_target(fd, target);
+	if (target != NULL && fd->codeLo <= target && target < fd->codeHi &&
+	    !is_in_part(fd, target) && !is_inside_fn(fd, target)) {
+		if (claim_fn(fd, &w->fnArena, (void*) target, true))
+			add_edge(&w->edges, fi->address, (void*) target);
+	}
+}
+
+// Returns first known function start after entry, else end of the code
+static instruction* fn_limit(const FnsData* fd, instruction* entry) {
+	int lo = find_start(fd->fnStarts, fd->nFnStarts, entry);
+	return (lo < fd->nFnStarts && (instruction*) fd->fnStarts[lo] < fd->codeHi)
+		? fd->fnStarts[lo] : fd->codeHi;
+}
+
+// Returns the index of the first of the sorted starts[n] after p
+static int find_start(void* const* starts, int n, instruction* p) {
+	int lo = 0, hi = n;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if ((instruction*) starts[mid] <= p) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+// True iff p is within a part of a function, which extends from its
+// start to the next known function start
+static bool is_in_part(const FnsData* fd, instruction* p) {
+	int k = find_start(fd->fnParts, fd->nFnParts, p) - 1;
+	return k >= 0 && p < fn_limit(fd, fd->fnParts[k]);
+}
+
+// True iff p is within the code of a known function according to its
+// symbol's size, but not at its start
+static bool is_inside_fn(const FnsData* fd, instruction* p) {
+	if (fd->fnEnds == NULL) return false;
+	int k = find_start(fd->fnStarts, fd->nFnStarts, p) - 1;
+	return k >= 0 && (instruction*) fd->fnStarts[k] < p &&
+		p < (instruction*) fd->fnEnds[k];
+}
+
+// Returns the opcode of instruction i, setting *rexP to its REX prefix
+static instruction* skip_prefixes(instruction* i, unsigned* rexP) {
+	while (*i == 0x66 || *i == 0x67 || *i == 0xF0 || *i == 0xF2 || *i == 0xF3 ||
+	       *i == 0x2E || *i == 0x36 || *i == 0x3E || *i == 0x26 ||
+	       *i == 0x64 || *i == 0x65) {
+		i++;
+	}
+	*rexP = ((*i & 0xF0) == 0x40) ? *i++ : 0;
+	return i;
+}
+
+// Target of relative call/jmp/jcc i of length l; the displacement is
+// the last byte for the short forms, else the last 4 bytes
+static instruction* branch_target(instruction* i, int l) {
+	unsigned rex;
+	instruction* op = skip_prefixes(i, &rex);
+	if (*op == 0xEB || (*op & 0xF0) == 0x70 || (0xE0 <= *op && *op <= 0xE3))
+		return i + l + (signed char) i[l - 1];
+	return i + l + *((int *)(i + l - 4));
+}
+
+// mov reg, [rip+disp32] and lea reg, [rip+disp32] with REX.W
+static RipReg rip_reg(instruction* i, int l) {
+	unsigned rex;
+	instruction* op = skip_prefixes(i, &rex);
+	RipReg ripReg = { -1, NULL, false };
+	if ((rex & 0x08) && (op[0] == 0x8B || op[0] == 0x8D) &&
+	    (op[1] & 0xC7) == 0x05) {
+		ripReg.reg = ((rex & 0x04) << 1) | ((op[1] >> 3) & 7);
+		ripReg.addr = i + l + *((int *)(op + 2));
+		ripReg.isLoad = (op[0] == 0x8B);
+	}
+	return ripReg;
+}
+
+// Target of call/jmp through [rip+disp32] or through a register set by
+// the previous instruction ripReg, setting *slotP to the pointer slot
+// it was loaded from, if any.  *isKnownP is set iff the form is
+// recognized; the target is NULL if its pointer cannot be resolved.
+static instruction* indirect_target(const FnsData* fd, instruction* i, int l,
+                                    const RipReg* ripReg, instruction** slotP,
+                                    bool* isKnownP) {
+	unsigned rex;
+	instruction* op = skip_prefixes(i, &rex);
+	int reg = (op[1] >> 3) & 7;
+	*isKnownP = false;
+	*slotP = NULL;
+	if (op[0] != 0xFF || (reg != 2 && reg != 4)) return NULL;
+	if ((op[1] & 0xC7) == 0x05) {
+		*isKnownP = true;
+		*slotP = i + l + *((int *)(op + 2));
+		return resolve_slot(fd, *slotP);
+	}
+	if ((op[1] >> 6) == 3 && ripReg->reg == (((rex & 1) << 3) | (op[1] & 7))) {
+		*isKnownP = true;
+		if (!ripReg->isLoad) return ripReg->addr;
+		*slotP = ripReg->addr;
+		return resolve_slot(fd, *slotP);
+	}
+	return NULL;
+}
+
+// If target is a PLT stub, [endbr64;] [bnd] jmp [rip+disp32], return the
+// pointer slot it jumps through, else NULL
+static instruction* plt_slot(const FnsData* fd, instruction* target) {
+	enum { MAX_STUB_PREFIX = 16 };
+	if (target < fd->codeLo ||
+	    (uintptr_t) fd->codeHi - (uintptr_t) target < MAX_STUB_PREFIX)
+		return NULL;
+	instruction* p = target;
+	if (p[0] == 0xF3 && p[1] == 0x0F && p[2] == 0x1E && p[3] == 0xFA) p += 4;
+	if (p[0] == 0xF2) p++;
+	if (p[0] != 0xFF || p[1] != 0x25) return NULL;
+	return p + 6 + *((int *)(p + 2));
+}
+
+// If target is a PLT stub, return the function it jumps to (NULL if
+// unresolved), else target itself
+static instruction* plt_target(const FnsData* fd, instruction* target) {
+	instruction* slot = plt_slot(fd, target);
+	return (slot == NULL) ? target : resolve_slot(fd, slot);
+}
+
+// Function whose address is held by pointer slot, NULL if unknown
+static instruction* resolve_slot(const FnsData* fd, instruction* slot) {
+	if (fd->resolveSlot != NULL)
+		return fd->resolveSlot(fd->resolveCtx, slot);
+	return *(instruction* const*) slot;  // code is loaded and relocated
+}
+
+// True iff a call to target, through pointer slot if not NULL, does not
+// return: target, the slot or the slot of PLT stub target is known to
+// be or hold that of a function which never returns
+static bool is_no_return(const FnsData* fd, instruction* target,
+                         instruction* slot) {
+	if (fd->nNoReturnFns == 0 && fd->nNoReturnSlots == 0) return false;
+	if (target != NULL && is_listed(fd->noReturnFns, fd->nNoReturnFns, target))
+		return true;
+	if (slot == NULL && target != NULL) slot = plt_slot(fd, target);
+	if (slot == NULL) return false;
+	if (is_listed(fd->noReturnSlots, fd->nNoReturnSlots, slot)) return true;
+	target = resolve_slot(fd, slot);
+	return target != NULL && is_listed(fd->noReturnFns, fd->nNoReturnFns, target);
+}
+
+// True iff p is among the sorted starts[n]
+static bool is_listed(void* const* starts, int n, instruction* p) {
+	int k = find_start(starts, n, p) - 1;
+	return k >= 0 && (instruction*) starts[k] == p;
+}
+
+// hlt, int3 and ud2 end straight-line code
+static bool is_stop(instruction* i) {
+	unsigned rex;
+	instruction* op = skip_prefixes(i, &rex);
+	return op[0] == 0xF4 || op[0] == 0xCC || (op[0] == 0x0F && op[1] == 0x0B);
+}
+
+// True iff straight-line code of the current function cannot go on at
+// i, before stop: at 00 00, which compilers never emit as code but fills
+// gaps and data, or at a run of nops padding up to int3, 00 00 or the
+// endbr64 starting another function
+static bool is_padding(const Worker* w, instruction* i, instruction* stop) {
+	enum { MAX_PADDING = 64 };
+	instruction* p = i;
+	while (p < stop && p - i < MAX_PADDING && is_nop(p)) {
+		LdeOpClass opClass;
+		int l = get_op_info(w->lde, p, &opClass);
+		if (l < 0 || l > (uintptr_t) stop - (uintptr_t) p) return false;
+		p += l;
+	}
+	if (stop - p >= 2 && p[0] == 0x00 && p[1] == 0x00) return true;
+	if (p == i) return false;
+	return (stop - p >= 1 && p[0] == 0xCC) ||
+		(stop - p >= 4 && p[0] == 0xF3 && p[1] == 0x0F && p[2] == 0x1E &&
+		 p[3] == 0xFA);
 }
 
-FnInfo* new_fn_info(void* addr, unsigned len, unsigned in, unsigned out) {
-	FnInfo* ret = malloc(sizeof(FnInfo));
+// nop, xchg %eax,%eax and the multi-byte nops used for alignment, with
+// any prefixes
+static bool is_nop(instruction* i) {
+	unsigned rex;
+	instruction* op = skip_prefixes(i, &rex);
+	return (op[0] == 0x90 && !(rex & 0x01)) || (op[0] == 0x0F && op[1] == 0x1F);
+}
+
+static void add_edge(EdgeBuf* buf, void* caller, void* callee) {
+	if (buf->len >= buf->cap) {
+		buf->cap = (buf->cap == 0) ? 64 : 2 * buf->cap;
+		buf->edges = realloc(buf->edges, buf->cap * sizeof(CallEdge));
+	}
+	buf->edges[buf->len++] = (CallEdge) { caller, callee };
+}
+
+static void add_details(DetailBuf* buf, void* address, FnCfg* cfg,
+                        const FnMix* mix) {
+	if (buf->len >= buf->cap) {
+		buf->cap = (buf->cap == 0) ? 64 : 2 * buf->cap;
+		buf->details = realloc(buf->details, buf->cap * sizeof(DetailEntry));
+	}
+	buf->details[buf->len++] = (DetailEntry) { address, cfg, *mix };
+}
+
+static void count_insn(FnMix* mix, LdeOpClass opClass, unsigned kinds) {
+	mix->nInsns++;
+	if (kinds & LDE_LOAD) mix->nLoads++;
+	if (kinds & LDE_STORE) mix->nStores++;
+	if (opClass == LDE_OP_JCC || opClass == LDE_OP_JMP ||
+	    opClass == LDE_OP_JMP_INDIRECT)
+		mix->nBranches++;
+	if (kinds & (LDE_SSE | LDE_AVX)) mix->nSimd++;
+	if (kinds & LDE_X87) mix->nX87++;
+	if (kinds & LDE_SSE) mix->nSse++;
+	if (kinds & LDE_AVX) mix->nAvx++;
+	if (kinds & LDE_AVX512) mix->nAvx512++;
+}
+
+FnInfo* new_fn_info(Arena* arena, void* addr, unsigned len, unsigned in,
+                    unsigned out) {
+	FnInfo* ret = arena_alloc(arena, sizeof(FnInfo));
 	ret->address = addr;
 	ret->length = len;
 	ret->nInCalls = in;
@@ -146,62 +958,313 @@ FnInfo* new_fn_info(void* addr, unsigned len, unsigned in, unsigned out) {
 FnsData* make_fns_data() {
 	FnsData* ret = malloc(sizeof(FnsData));
 	ret->len = 0;
+	ret->nDecoded = 0;
 	ret->cap = INIT_SIZE;
 	ret->list = calloc(ret->cap, sizeof(FnInfo*));
+	ret->fns = NULL;
+	ret->fnStarts = NULL;
+	ret->nFnStarts = 0;
+	ret->fnEnds = NULL;
+	ret->fnParts = NULL;
+	ret->nFnParts = 0;
+	ret->resolveSlot = NULL;
+	ret->resolveCtx = NULL;
+	ret->isCfg = false;
+	ret->isMix = false;
+	ret->detailList = NULL;
+	ret->nDetails = 0;
+	ret->arena = (Arena) ARENA_INIT;
+	ret->fnArena = (Arena) ARENA_INIT;
+	ret->cfgs = NULL;
+	ret->mixes = NULL;
+	ret->edges = NULL;
+	ret->nEdges = 0;
+	ret->calleeStart = ret->callees = NULL;
+	ret->callerStart = ret->callers = NULL;
+	ret->codeLo = NULL;
+	ret->codeHi = (instruction*) UINTPTR_MAX;
+	ret->nBusy = 0;
+	pthread_mutex_init(&ret->lock, NULL);
+	pthread_cond_init(&ret->hasWork, NULL);
+	ret->indexCap = INIT_INDEX_SIZE;
+	ret->indexLen = 0;
+	ret->nThreads = 1;
+	ret->maxFns = 0;
+	ret->isTruncated = false;
+	ret->index = calloc(ret->indexCap, sizeof(FnInfo*));
+	pthread_rwlock_init(&ret->indexLock, NULL);
 	return ret;
 }
 
-// add
+// add to the work queue
 void add_item(FnsData* fd, FnInfo* fi) {
+	pthread_mutex_lock(&fd->lock);
 	if (fd->len >= fd->cap) {
 		grow(fd);
 	}
 	fd->list[fd->len] = fi;
 	fd->len += 1;
-
-	// sort
+	pthread_cond_signal(&fd->hasWork);
+	pthread_mutex_unlock(&fd->lock);
 }
 
+// double the capacity so that appending n functions costs O(n) in all
 void grow(FnsData* fd) {
-	FnInfo* list[fd->len];
-	for (int i = 0; i < fd->len; i++) {
-		list[i] = fd->list[i];
-	}
 	fd->cap *= 2;
-	fd->list = calloc(fd->cap, sizeof(FnInfo*));
-	for (int i = 0; i < fd->len; i++) {
-		fd->list[i] = list[i];
-	}
+	fd->list = realloc(fd->list, fd->cap * sizeof(FnInfo*));
 }
 
+// order FnInfo* elements by address; addresses are compared rather than
+// subtracted since their difference need not fit in an int
 int compare(const void* A, const void* B) {
-	FnInfo* a = (FnInfo*) A;
-	FnInfo* b = (FnInfo*) B;
-	long n1 = (long) a->address;
-	long n2 = (long) b->address;
-	int ret = n1 - n2;
-	return ret;
+	uintptr_t a = (uintptr_t) (*(FnInfo* const*) A)->address;
+	uintptr_t b = (uintptr_t) (*(FnInfo* const*) B)->address;
+	return (a > b) - (a < b);
 }
 
-// contains function to check if a function is present in the list or not
-bool contains_fn(FnsData* fd, void* addr) {
-	for (FnInfo *fip = next_fn_info(fd, NULL); fip != NULL; fip = next_fn_info(fd, fip)) {
-		if (fip->address == addr) {
-			fip->nInCalls += 1;
-			return true;
+// Count one more call to addr if isCall, and unless addr is already
+// known claim it with a new FnInfo from arena and queue it for
+// decoding, unless fd->maxFns functions are already claimed.  Returns
+// true iff addr is traced, whether claimed now or before.  Safe to call
+// from several workers at once, each with its own arena: the index slot
+// is taken by compare-and-swap, so exactly one caller claims addr, and
+// each new record is counted in indexLen before it is published, so
+// that the limit holds however the claims race.
+bool claim_fn(FnsData* fd, Arena* arena, void* addr, bool isCall) {
+	int cap;
+	pthread_rwlock_rdlock(&fd->indexLock);
+	while (2 * (__atomic_load_n(&fd->indexLen, __ATOMIC_RELAXED) + fd->nThreads)
+	       >= (cap = fd->indexCap)) {
+		pthread_rwlock_unlock(&fd->indexLock);
+		grow_index(fd, cap);
+		pthread_rwlock_rdlock(&fd->indexLock);
+	}
+	FnInfo* fi = NULL;
+	FnInfo* cur;
+	FnInfo** slot = index_slot(fd, addr);
+	for (;;) {
+		cur = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+		if (cur == NULL) {
+			if (fi == NULL) {
+				int n = __atomic_add_fetch(&fd->indexLen, 1, __ATOMIC_RELAXED);
+				if (fd->maxFns > 0 && n > fd->maxFns) {
+					__atomic_sub_fetch(&fd->indexLen, 1, __ATOMIC_RELAXED);
+					__atomic_store_n(&fd->isTruncated, true, __ATOMIC_RELAXED);
+					break;
+				}
+				fi = new_fn_info(arena, addr, 0, isCall ? 1 : 0, 0);
+			}
+			if (__atomic_compare_exchange_n(slot, &cur, fi, false,
+			                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+				break;
 		}
+		// slot is taken, possibly by another address since it was probed
+		if (cur->address == addr) break;
+		slot = index_slot(fd, addr);
+	}
+	bool isClaimed = (cur == NULL && fi != NULL);
+	if (cur != NULL) {
+		if (isCall) __atomic_add_fetch(&cur->nInCalls, 1, __ATOMIC_RELAXED);
+		// a record allocated for a lost race is left in the arena; races
+		// on a new address are rare enough that this is not worth reusing
+		if (fi != NULL) __atomic_sub_fetch(&fd->indexLen, 1, __ATOMIC_RELAXED);
 	}
-	return false;
+	pthread_rwlock_unlock(&fd->indexLock);
+	if (isClaimed) add_item(fd, fi);
+	return cur != NULL || isClaimed;
 }
 
+// Fibonacci hashing; code addresses differ mostly in their low bits
+static inline unsigned long hash_addr(void* addr) {
+	return ((unsigned long) addr * 0x9E3779B97F4A7C15UL) >> 20;
+}
+
+// Returns the slot holding addr, or the empty slot where it would go
+static FnInfo** index_slot(const FnsData* fd, void* addr) {
+	unsigned long mask = fd->indexCap - 1;
+	for (unsigned long i = hash_addr(addr) & mask; ; i = (i + 1) & mask) {
+		FnInfo** slot = &fd->index[i];
+		FnInfo* fi = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+		if (fi == NULL || fi->address == addr)
+			return slot;
+	}
+}
+
+// rehash all entries into a table twice the size, unless another
+// thread already grew it past oldCap
+static void grow_index(FnsData* fd, int oldCap) {
+	pthread_rwlock_wrlock(&fd->indexLock);
+	if (fd->indexCap == oldCap) {
+		FnInfo** old = fd->index;
+		fd->indexCap *= 2;
+		fd->index = calloc(fd->indexCap, sizeof(FnInfo*));
+		for (int i = 0; i < oldCap; i++) {
+			if (old[i] != NULL)
+				*index_slot(fd, old[i]->address) = old[i];
+		}
+		free(old);
+	}
+	pthread_rwlock_unlock(&fd->indexLock);
+}
+
+enum { RADIX_BITS = 8, RADIX = 1 << RADIX_BITS,
+       N_DIGITS = 64 / RADIX_BITS };
+
+// LSD radix sort of list by address, a byte at a time.  All digit
+// counts are taken in one pass up front, and a pass is skipped when all
+// addresses share its digit, which is the case for most of the high
+// bytes since traced code is usually within one module
 void sort_fns(FnsData* fd) {
+	int n = fd->len;
+	size_t counts[N_DIGITS][RADIX] = { { 0 } };
+	for (int i = 0; i < n; i++) {
+		uint64_t key = (uintptr_t) fd->list[i]->address;
+		for (int d = 0; d < N_DIGITS; d++) {
+			counts[d][(key >> (d * RADIX_BITS)) & (RADIX - 1)]++;
+		}
+	}
+	FnInfo** from = fd->list;
+	FnInfo** to = malloc((n + 1) * sizeof(FnInfo*));
+	for (int d = 0; d < N_DIGITS; d++) {
+		size_t* count = counts[d];
+		int shift = d * RADIX_BITS;
+		if (n == 0 || count[((uintptr_t) from[0]->address >> shift) & (RADIX - 1)] == n)
+			continue;
+		size_t start = 0;
+		for (int b = 0; b < RADIX; b++) {
+			size_t c = count[b];
+			count[b] = start;
+			start += c;
+		}
+		for (int i = 0; i < n; i++) {
+			uintptr_t key = (uintptr_t) from[i]->address;
+			to[count[(key >> shift) & (RADIX - 1)]++] = from[i];
+		}
+		FnInfo** t = from;
+		from = to;
+		to = t;
+	}
+	fd->list = from;
+	free(to);
+	for (int i = 1; i < n; i++) {
+		assert(compare(&from[i - 1], &from[i]) < 0);
+	}
+}
+
+// copy the sorted records into one array so next_fn_info() can step by
+// pointer arithmetic; the records themselves are then freed in one go
+static void pack_fns(FnsData* fd) {
+	fd->fns = malloc(fd->len * sizeof(FnInfo));
 	for (int i = 0; i < fd->len; i++) {
-		for (int j = 0; j < fd->len - i - 1; j++) {
-			if (fd->list[j]->address > fd->list[j+1]->address) {
-				FnInfo* temp = fd->list[j];
-				fd->list[j] = fd->list[j+1];
-				fd->list[j+1] = temp;
+		fd->fns[i] = *fd->list[i];
+	}
+	free_arena(&fd->fnArena);
+	free(fd->list);
+	fd->list = NULL;
+	free(fd->index);
+	fd->index = NULL;
+	pthread_mutex_destroy(&fd->lock);
+	pthread_cond_destroy(&fd->hasWork);
+	pthread_rwlock_destroy(&fd->indexLock);
+}
+
+// Returns the index in fns of the function at addr, -1 if not traced
+static int find_fn(const FnsData* fd, void* addr) {
+	int lo = 0, hi = fd->len;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (fd->fns[mid].address < addr) lo = mid + 1;
+		else hi = mid;
+	}
+	return (lo < fd->len && fd->fns[lo].address == addr) ? lo : -1;
+}
+
+// Turn the edge list into CSR adjacency in both directions
+static void build_adjacency(FnsData* fd) {
+	// every traced call is to a traced function, so both ends resolve
+	int nEdges = fd->nEdges;
+	int* from = malloc((nEdges + 1) * sizeof(int));
+	int* to = malloc((nEdges + 1) * sizeof(int));
+	for (int e = 0; e < nEdges; e++) {
+		from[e] = find_fn(fd, fd->edges[e].caller);
+		to[e] = find_fn(fd, fd->edges[e].callee);
+	}
+	free(fd->edges);
+	fd->edges = NULL;
+	fd->calleeStart = csr_rows(from, to, nEdges, fd->len, &fd->callees);
+	fd->callerStart = csr_rows(to, from, nEdges, fd->len, &fd->callers);
+	free(from);
+	free(to);
+}
+
+// Counting sort of edges (from[e], to[e]) by from; returns row starts
+// and sets *colsP to the to's of each row, sorted within the row
+static int* csr_rows(const int* from, const int* to, int nEdges, int nRows,
+                     int** colsP) {
+	int* start = calloc(nRows + 1, sizeof(int));
+	int* cols = malloc((nEdges + 1) * sizeof(int));
+	for (int e = 0; e < nEdges; e++) {
+		start[from[e] + 1]++;
+	}
+	for (int r = 0; r < nRows; r++) {
+		start[r + 1] += start[r];
+	}
+	int* next = malloc((nRows + 1) * sizeof(int));
+	for (int r = 0; r < nRows; r++) {
+		next[r] = start[r];
+	}
+	for (int e = 0; e < nEdges; e++) {
+		cols[next[from[e]]++] = to[e];
+	}
+	free(next);
+	for (int r = 0; r < nRows; r++) {
+		// rows are short, so insertion sort; makes the output independent
+		// of the order in which workers traced the calls
+		for (int i = start[r] + 1; i < start[r + 1]; i++) {
+			int c = cols[i], j = i;
+			for (; j > start[r] && cols[j - 1] > c; j--) cols[j] = cols[j - 1];
+			cols[j] = c;
+		}
+	}
+	*colsP = cols;
+	return start;
+}
+
+// Breadth-first search over CSR rows from node; result doubles as the
+// queue.  Returns # of nodes reached, excluding node unless on a cycle.
+static int reachable(const int* start, const int* cols, int nNodes, int node,
+                     int* result) {
+	bool* seen = calloc(nNodes + 1, sizeof(bool));
+	int n = 0;
+	for (int e = start[node]; e < start[node + 1]; e++) {
+		if (!seen[cols[e]]) {
+			seen[cols[e]] = true;
+			result[n++] = cols[e];
+		}
+	}
+	for (int head = 0; head < n; head++) {
+		int cur = result[head];
+		for (int e = start[cur]; e < start[cur + 1]; e++) {
+			if (!seen[cols[e]]) {
+				seen[cols[e]] = true;
+				result[n++] = cols[e];
 			}
 		}
 	}
+	free(seen);
+	return n;
+}
+
+// Index the CFGs collected by the workers by position in fns
+static void index_details(FnsData* fd) {
+	if (fd->isCfg) fd->cfgs = calloc(fd->len + 1, sizeof(FnCfg*));
+	if (fd->isMix) fd->mixes = calloc(fd->len + 1, sizeof(FnMix));
+	for (int d = 0; d < fd->nDetails; d++) {
+		DetailEntry* detail = &fd->detailList[d];
+		int i = find_fn(fd, detail->address);
+		if (fd->isCfg) fd->cfgs[i] = detail->cfg;
+		if (fd->isMix) fd->mixes[i] = detail->mix;
+	}
+	free(fd->detailList);
+	fd->detailList = NULL;
 }
@@ -1,12 +1,22 @@
 #ifndef FN_TRACE_H_
 #define FN_TRACE_H_
 
+#include <stdbool.h>
+
 //.1
+/** Version of what the tracer finds: incremented whenever a change may
+ *  alter the FnInfo's or calls traced from the same code, so that
+ *  results saved by another version can be told apart.
+ */
+#define FN_TRACE_VERSION 4
+
 /** Information associated with a function. */
 typedef struct {
   void *address;        /** start address of function */
   unsigned length;      /** # of bytes taken by function code. */
-  unsigned nInCalls;    /** # of direct calls to this function */
+  unsigned nInCalls;    /** # of direct calls to this function from
+                         *  traced functions, one per call site, as
+                         *  for fn_callers() */
   unsigned nOutCalls;   /** # of direct function calls in function body */
 } FnInfo;
 
@@ -22,6 +32,100 @@ typedef struct FnsDataImpl FnsData;
  */
 const FnsData *new_fns_data(void *rootFn);
 
+/** Like new_fns_data(), but decodes function bodies using nThreads
+ *  worker threads.  The result is identical to that of new_fns_data(),
+ *  provided the pointer slots read to follow calls through the PLT and
+ *  GOT do not change meanwhile: lazily bound slots of a loaded module
+ *  do when the tracing threads are created, so they are best resolved
+ *  as by new_fns_data_options() with a resolveSlot which does not
+ *  depend on binding.
+ */
+const FnsData *new_fns_data_parallel(void *rootFn, int nThreads);
+
+/** Like new_fns_data_parallel(), but only code in [codeLo, codeHi) is
+ *  read: decoding stops at codeHi and calls to functions outside the
+ *  range are counted in nOutCalls but not traced.  Used to trace code
+ *  which is mapped but not loaded, where addresses outside the range
+ *  are meaningless.
+ */
+const FnsData *new_fns_data_range(void *rootFn, const void *codeLo,
+                                  const void *codeHi, int nThreads);
+
+/** Like new_fns_data_range(), but traces from each of the nRoots
+ *  functions in roots into a single collection, decoding every function
+ *  once however many roots reach it.  Roots outside [codeLo, codeHi)
+ *  are ignored and a root is not counted as a call to itself.
+ */
+const FnsData *new_fns_data_roots(void *const roots[], int nRoots,
+                                  const void *codeLo, const void *codeHi,
+                                  int nThreads);
+
+/** Options for new_fns_data_options(); fields left 0 take defaults. */
+typedef struct {
+  /** only code in [codeLo, codeHi) is read and traced; a NULL codeHi
+   *  means no upper bound */
+  const void *codeLo, *codeHi;
+  /** known function entry points in increasing order, e.g. from the
+   *  symbol table; the code of a function is taken to end at the next
+   *  known entry point, so jumps beyond it are seen as tail calls */
+  void *const *fnStarts;
+  int nFnStarts;
+  /** if not NULL, fnEnds[i] is the end of the code of the function at
+   *  fnStarts[i] according to its symbol's size, or fnStarts[i] if
+   *  unknown: a branch into a function after its start is not traced
+   *  as a function of its own */
+  void *const *fnEnds;
+  /** those of fnStarts, in increasing order, which start parts split
+   *  off from functions, such as GCC's .cold partitions: a branch into
+   *  a part, up to the next known entry point, stays within the
+   *  function branching there, and parts are not traced as functions */
+  void *const *fnParts;
+  int nFnParts;
+  /** entry points, in increasing order, of functions which never
+   *  return, such as abort() and __stack_chk_fail(): straight-line
+   *  code ends after a call to one, as the compiler may have placed
+   *  anything after it */
+  void *const *noReturnFns;
+  int nNoReturnFns;
+  /** pointer slots (GOT entries), in increasing order, which will hold
+   *  the address of a function which never returns, for calls through
+   *  them or through the PLT stubs jumping through them */
+  void *const *noReturnSlots;
+  int nNoReturnSlots;
+  /** return the function whose address the pointer at slot (a GOT
+   *  entry) holds, NULL if unknown.  If NULL, slots are read directly,
+   *  which is only valid for loaded and relocated code, and only gives
+   *  the same graph from one run to the next if they are all bound */
+  void *(*resolveSlot)(void *ctx, const void *slot);
+  void *resolveCtx;     /** passed to resolveSlot() */
+  int nThreads;         /** # of worker threads */
+  /** # of functions traced at most, bounding the memory used; 0 for no
+   *  limit.  Calls to further functions are counted in nOutCalls but
+   *  not traced, as for code outside the range */
+  int maxFns;
+  bool isCfg;           /** build the control-flow graph of each function */
+  bool isMix;           /** count the kinds of instructions of each function */
+} FnTraceOptions;
+
+/** Like new_fns_data_roots() with the code range and # of threads
+ *  given in options, which also supply the known function entry points
+ *  and the resolution of pointer slots used to follow calls through
+ *  the PLT and GOT.
+ */
+const FnsData *new_fns_data_options(void *const roots[], int nRoots,
+                                    const FnTraceOptions *options);
+
+/** Return an FnsData holding the call graph of the nFns functions in
+ *  fns, which must be in increasing address order, where the callees
+ *  of fns[i] are the positions callees[calleeStart[i] ..
+ *  calleeStart[i+1]), as returned by fn_callees(): for example a graph
+ *  traced and saved earlier.  The arrays are copied.  The result has
+ *  no CFGs or instruction mixes.
+ */
+const FnsData *new_fns_data_graph(const FnInfo fns[], int nFns,
+                                  const int calleeStart[],
+                                  const int callees[]);
+
 /** Free all resources occupied by fnsData. fnsData must have been
  *  returned by new_fns_data().  It is not ok to use to fnsData after
  *  this call.
@@ -42,6 +146,105 @@ void free_fns_data(FnsData *fnsData);
  *
  */
 const FnInfo *next_fn_info(const FnsData *fnData, const FnInfo *lastFnInfo);
+
+/** Must be called before code in [lo, hi) is unmapped or modified
+ *  (for example by dlclose()) after it has been traced, since decoded
+ *  instructions are cached across calls to new_fns_data().
+ */
+void fn_trace_unload(const void *lo, const void *hi);
+
+/** A maximal straight-line run of a function's code. */
+typedef struct {
+  void *address;        /** of first instruction */
+  unsigned length;      /** # of bytes */
+  unsigned nInsns;      /** # of instructions */
+  int nSuccs;           /** # of successor blocks within the function */
+  int succs[2];         /** their indexes; jump tables are not followed */
+} BasicBlock;
+
+/** Control-flow graph of a function. */
+typedef struct {
+  int nBlocks;
+  const BasicBlock *blocks;  /** in address order from the entry,
+                              *  blocks[0], followed by any in parts of
+                              *  the function placed before it */
+  unsigned nInsns;      /** # of instructions in all blocks */
+  unsigned nBranches;   /** # of jcc and jmp instructions */
+  int nLoops;           /** # of loop headers, each a back-edge target */
+  int hotBlock;         /** index of the block nested in most loops,
+                         *  preferring the longest; -1 if no blocks */
+  int hotDepth;         /** # of loops containing hotBlock */
+} FnCfg;
+
+/** Return the control-flow graph of the function at position index in
+ *  fnsData, which must have been traced with the isCfg option; NULL
+ *  otherwise.  The graph belongs to fnsData.
+ */
+const FnCfg *fn_cfg(const FnsData *fnsData, int index);
+
+/** Instruction mix of a function: the # of its instructions of each
+ *  kind, as classified by the length decoder.  An instruction may be
+ *  of several kinds.
+ */
+typedef struct {
+  unsigned nInsns;
+  unsigned nLoads;      /** reading memory, including pops and rets */
+  unsigned nStores;     /** writing memory, including pushes and calls */
+  unsigned nBranches;   /** jcc, jmp and indirect jmp */
+  unsigned nSimd;       /** SSE, MMX, AVX or AVX-512 */
+  unsigned nX87;
+  unsigned nSse;        /** legacy-encoded SSE or MMX */
+  unsigned nAvx;        /** VEX-, EVEX- or XOP-encoded */
+  unsigned nAvx512;     /** EVEX-encoded */
+} FnMix;
+
+/** Return the instruction mix of the function at position index in
+ *  fnsData, which must have been traced with the isMix option; NULL
+ *  otherwise.  The mix belongs to fnsData.
+ */
+const FnMix *fn_mix(const FnsData *fnsData, int index);
+
+/** Return true iff tracing fnsData reached the maxFns limit of its
+ *  options, so that some called functions were not traced.
+ */
+bool fns_data_is_truncated(const FnsData *fnsData);
+
+/** Return the # of FnInfo's in fnsData. */
+int n_fn_infos(const FnsData *fnsData);
+
+/** Return the FnInfo at position index (0-based, in next_fn_info()
+ *  order) in fnsData.
+ */
+const FnInfo *fn_info_at(const FnsData *fnsData, int index);
+
+/** Return the position of fnInfo, which must have been returned by
+ *  next_fn_info() or fn_info_at() for fnsData.
+ */
+int fn_info_index(const FnsData *fnsData, const FnInfo *fnInfo);
+
+/** Set *calleesP to the positions of the functions called directly by
+ *  the function at position index and return their #.  There is one
+ *  entry per call site traced, in increasing order.  The array belongs
+ *  to fnsData.
+ */
+int fn_callees(const FnsData *fnsData, int index, const int **calleesP);
+
+/** Like fn_callees(), but for the functions calling the function at
+ *  position index.
+ */
+int fn_callers(const FnsData *fnsData, int index, const int **callersP);
+
+/** Store in result the positions of all functions reachable from the
+ *  function at position index by one or more calls and return their #.
+ *  result must have room for n_fn_infos(fnsData) entries.  The order
+ *  is breadth-first.
+ */
+int fn_transitive_callees(const FnsData *fnsData, int index, int result[]);
+
+/** Like fn_transitive_callees(), but for all functions from which the
+ *  function at position index is reachable.
+ */
+int fn_transitive_callers(const FnsData *fnsData, int index, int result[]);
 //.2
 
 #endif //#ifndef FN_TRACE_H_
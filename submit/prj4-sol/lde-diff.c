@@ -0,0 +1,133 @@
+#include "x86-64_lde.h"
+
+#include "errors.h"
+#include "memalloc.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Differential test for the x86-64 length decoder: decodes at every
+ *  byte offset of each file argument using both the native and the
+ *  capstone backends and reports offsets where the backends disagree
+ *  on the length or on whether the bytes form a valid instruction.
+ *  Any file serves as a corpus; shared objects and executables give
+ *  realistic code at instruction boundaries, everything in between
+ *  exercises unusual prefix and opcode combinations.  Also checks that
+ *  the native backend's get_op_lengths() agrees with decoding one
+ *  instruction at a time, each by a decoder of its own so that neither
+ *  answers from instructions cached by the other.
+ *
+ *  Exits with status 1 if any disagreement was found.
+ */
+
+enum { MAX_INSN_SIZE = 15, MAX_REPORTS = 20 };
+
+/** Return contents of file path padded with MAX_INSN_SIZE zero bytes;
+ *  sets *sizeP to the unpadded size.
+ */
+static unsigned char *
+read_file(const char *path, size_t *sizeP)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f) fatal("cannot read %s:", path);
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  rewind(f);
+  unsigned char *bytes = callocChk(size + MAX_INSN_SIZE, 1);
+  if (fread(bytes, 1, size, f) != size) fatal("cannot read %s:", path);
+  fclose(f);
+  *sizeP = size;
+  return bytes;
+}
+
+/** Compare backends at each offset in bytes[size], returning # of
+ *  disagreements.  *nReportsP is incremented for each one printed.
+ */
+static size_t
+diff_bytes(const char *path, const unsigned char *bytes, size_t size,
+           const Lde *native, const Lde *capstone, int *nReportsP)
+{
+  size_t nDiffs = 0;
+  for (size_t i = 0; i < size; i++) {
+    int n1 = try_op_length(native, &bytes[i]);
+    int n2 = try_op_length(capstone, &bytes[i]);
+    if (n1 == n2 || (n1 < 0 && n2 < 0)) continue;
+    nDiffs++;
+    if ((*nReportsP)++ < MAX_REPORTS) {
+      printf("%s+0x%zx: native %d, capstone %d:", path, i, n1, n2);
+      for (int j = 0; j < MAX_INSN_SIZE; j++) printf(" %02x", bytes[i + j]);
+      printf("\n");
+    }
+  }
+  return nDiffs;
+}
+
+/** Check get_op_lengths() by batch against get_op_info() one
+ *  instruction at a time by single over bytes[size], decoding runs
+ *  from offset 0 on and skipping a byte after each undecodable
+ *  instruction.  batch and single must be distinct decoders used for
+ *  nothing else on bytes, since each answers from the instructions it
+ *  has cached.  Returns # of instructions where they disagree.
+ *  *nReportsP is incremented for each one printed.
+ */
+static size_t
+check_batches(const char *path, const unsigned char *bytes, size_t size,
+              const Lde *batch, const Lde *single, int *nReportsP)
+{
+  size_t nDiffs = 0;
+  LdeOps ops;
+  for (size_t i = 0; i < size; ) {
+    int n = get_op_lengths(batch, &bytes[i], &bytes[size], &ops);
+    if (n == 0) {
+      i++;
+      continue;
+    }
+    int offset = 0;
+    for (int k = 0; k < n; k++) {
+      LdeOpClass opClass;
+      int len = get_op_info(single, &bytes[i + offset], &opClass);
+      bool isStart = (ops.boundaries[offset/64] >> (offset % 64)) & 1;
+      if (len != ops.lengths[k] || opClass != ops.opClasses[k] || !isStart) {
+        nDiffs++;
+        if ((*nReportsP)++ < MAX_REPORTS) {
+          printf("%s+0x%zx: batch %d, single %d\n", path, i + offset,
+                 ops.lengths[k], len);
+        }
+      }
+      offset += ops.lengths[k];
+    }
+    i += offset;
+  }
+  return nDiffs;
+}
+
+int
+main(int argc, const char *argv[])
+{
+  if (argc < 2) fatal("usage: %s FILE...\n", argv[0]);
+  Lde *native = new_lde_backend(LDE_NATIVE);
+  Lde *capstone = new_lde_backend(LDE_CAPSTONE);
+  Lde *batch = new_lde_backend(LDE_NATIVE);
+  Lde *single = new_lde_backend(LDE_NATIVE);
+  size_t nTotal = 0, nDiffs = 0;
+  int nReports = 0;
+  for (int i = 1; i < argc; i++) {
+    size_t size;
+    unsigned char *bytes = read_file(argv[i], &size);
+    nDiffs += diff_bytes(argv[i], bytes, size, native, capstone, &nReports);
+    nDiffs += check_batches(argv[i], bytes, size, batch, single, &nReports);
+    nTotal += size;
+    lde_invalidate(native, bytes, bytes + size);
+    lde_invalidate(capstone, bytes, bytes + size);
+    lde_invalidate(batch, bytes, bytes + size);
+    lde_invalidate(single, bytes, bytes + size);
+    free(bytes);
+  }
+  printf("%zu offsets decoded; %zu disagreements\n", nTotal, nDiffs);
+  free_lde(native);
+  free_lde(capstone);
+  free_lde(batch);
+  free_lde(single);
+  return nDiffs != 0;
+}
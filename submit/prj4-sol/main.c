@@ -1,11 +1,21 @@
+#define _GNU_SOURCE
+
+#include "elf-file.h"
+#include "fn-cache.h"
+#include "fn-profile.h"
 #include "fn-trace.h"
 
 #include "errors.h"
+#include "memalloc.h"
 
 #include <dlfcn.h>
+#include <errno.h>
+#include <link.h>
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 /** Driver program for project.  Loads module which contains function
@@ -27,6 +37,9 @@
  *  Run-time: In order to load the libraries, the course lib directory
  *  must be included in the value of the LD_LIBRARY_PATH environmental
  *  variable.
+ *
+ *  With the -e option the module is not loaded at all: its file is
+ *  mapped by the elf-file module and traced in place.
  */
 
 /** Declare pointer top-level function called in functions module. */
@@ -51,24 +64,308 @@ get_module_fn(const char *module, const char *fn, void **handleP)
   return f;
 }
 
-#if 0
+typedef struct {
+  ElfW(Addr) base;   //load address of module being looked for
+  bool isCode;       //only consider executable segments
+  char *lo, *hi;     //extent of its PT_LOAD segments
+} ModuleExtent;
+
+static int
+find_module_extent(struct dl_phdr_info *info, size_t size, void *data)
+{
+  ModuleExtent *extent = data;
+  if (info->dlpi_addr != extent->base) return 0;
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+    if (phdr->p_type != PT_LOAD) continue;
+    if (extent->isCode && !(phdr->p_flags & PF_X)) continue;
+    char *lo = (char *)(info->dlpi_addr + phdr->p_vaddr);
+    char *hi = lo + phdr->p_memsz;
+    if (extent->lo == NULL || lo < extent->lo) extent->lo = lo;
+    if (hi > extent->hi) extent->hi = hi;
+  }
+  return 1;
+}
+
+/** Set *loP and *hiP to the address range occupied by the module
+ *  loaded with handle (by its code only if isCode); both are set to
+ *  NULL if it cannot be found.
+ */
+static void
+get_module_extent(void *handle, bool isCode, char **loP, char **hiP)
+{
+  struct link_map *map;
+  ModuleExtent extent = { 0, isCode, NULL, NULL };
+  if (dlinfo(handle, RTLD_DI_LINKMAP, &map) == 0) {
+    extent.base = map->l_addr;
+    dl_iterate_phdr(find_module_extent, &extent);
+  }
+  *loP = extent.lo;
+  *hiP = extent.hi;
+}
+
 /** Output result of calling function f module::fn() on out. */
 static void
 out_fn_call_result(FILE *out, const char *module, const char *fn, FnP f)
 {
   fprintf(out, "%s:%s() = %d\n", module, fn, f());
 }
-#endif
 
-/** For each function called directly or indirectly by f, print
- *  address of function (relative address if isRelative is true), the
- *  # of direct calls made by that function and the # of bytes in the
- *  code for the function.
+/** Return ELF file module mapped by the elf-file module. */
+static ElfFile *
+map_elf_file(const char *module)
+{
+  ElfFile *elfFile = open_elf_file(module);
+  if (!elfFile) {
+    fatal("cannot map %s: %s\n", module, strerror(errno));
+  }
+  return elfFile;
+}
+
+/** Return pointer to code for function fn in ELF file module mapped
+ *  as elfFile, setting *codeLoP and *codeHiP to the bounds of the
+ *  section containing it.
+ */
+static void *
+get_elf_file_fn(const char *module, const char *fn, const ElfFile *elfFile,
+                void **codeLoP, void **codeHiP)
+{
+  void *f = elf_file_symbol(elfFile, fn, codeLoP, codeHiP);
+  if (!f) {
+    fatal("cannot find %s in %s\n", fn, module);
+  }
+  return f;
+}
+
+/** Set *rootsP to a newly allocated array of pointers to the code of
+ *  all functions exported by ELF file module mapped as elfFile and
+ *  return its length.  *codeLoP and *codeHiP are set to the bounds of
+ *  the section containing the first of them.
+ */
+static int
+get_elf_file_exports(const char *module, const ElfFile *elfFile,
+                     void ***rootsP, void **codeLoP, void **codeHiP)
+{
+  unsigned long *vaddrs;
+  int nExports = elf_file_exports(elfFile, &vaddrs);
+  void **roots = mallocChk((nExports + 1)*sizeof(void *));
+  int nRoots = 0;
+  for (int i = 0; i < nExports; i++) {
+    void **loP = (nRoots == 0) ? codeLoP : NULL;
+    void **hiP = (nRoots == 0) ? codeHiP : NULL;
+    void *f = elf_file_code(elfFile, vaddrs[i], loP, hiP);
+    if (f) roots[nRoots++] = f;
+  }
+  free(vaddrs);
+  if (nRoots == 0) {
+    fatal("no exported functions in %s\n", module);
+  }
+  *rootsP = roots;
+  return nRoots;
+}
+
+/** Set *rootsP to a newly allocated array of the addresses of all
+ *  functions exported by shared-object module, whose file is mapped
+ *  as elfFile and which is loaded at base, and return its length.
+ */
+static int
+get_module_exports(const char *module, const ElfFile *elfFile,
+                   ElfW(Addr) base, void ***rootsP)
+{
+  unsigned long *vaddrs;
+  int nRoots = elf_file_exports(elfFile, &vaddrs);
+  if (nRoots == 0) {
+    fatal("no exported functions in %s\n", module);
+  }
+  void **roots = mallocChk(nRoots*sizeof(void *));
+  for (int i = 0; i < nRoots; i++) {
+    roots[i] = (void *)(base + vaddrs[i]);
+  }
+  free(vaddrs);
+  *rootsP = roots;
+  return nRoots;
+}
+
+static int
+compare_ptrs(const void *p1, const void *p2)
+{
+  const char *a = *(void *const *)p1, *b = *(void *const *)p2;
+  return (a > b) - (a < b);
+}
+
+/** Return pointer to the code at virtual address vaddr of elfFile: in
+ *  the module loaded at base if isLoaded, else in the mapped elfFile.
+ *  NULL if it is not mapped.
+ */
+static void *
+fn_code(const ElfFile *elfFile, bool isLoaded, ElfW(Addr) base,
+        unsigned long vaddr)
+{
+  return isLoaded
+    ? (void *)(base + vaddr) : elf_file_code(elfFile, vaddr, NULL, NULL);
+}
+
+typedef struct { void *start, *end; } FnExtent;
+
+/** Set *startsP to a newly allocated array of the entry points of all
+ *  functions defined in elfFile in increasing order and *endsP to one
+ *  of the ends of their code according to the sizes of their symbols,
+ *  equal to the entry point where the size is unknown, and return
+ *  their #.  Addresses are in the module loaded at base if isLoaded,
+ *  else in the mapped elfFile.
+ */
+static int
+get_fn_starts(const ElfFile *elfFile, bool isLoaded, ElfW(Addr) base,
+              void ***startsP, void ***endsP)
+{
+  unsigned long *vaddrs, *sizes;
+  int n = elf_file_functions(elfFile, &vaddrs, &sizes);
+  FnExtent *extents = mallocChk((n + 1)*sizeof(FnExtent));
+  int nStarts = 0;
+  for (int i = 0; i < n; i++) {
+    char *start = fn_code(elfFile, isLoaded, base, vaddrs[i]);
+    if (start) extents[nStarts++] = (FnExtent) { start, start + sizes[i] };
+  }
+  free(vaddrs);
+  free(sizes);
+  //the start is the first member of FnExtent
+  qsort(extents, nStarts, sizeof(FnExtent), compare_ptrs);
+  void **starts = mallocChk((nStarts + 1)*sizeof(void *));
+  void **ends = mallocChk((nStarts + 1)*sizeof(void *));
+  for (int i = 0; i < nStarts; i++) {
+    starts[i] = extents[i].start;
+    ends[i] = extents[i].end;
+  }
+  free(extents);
+  *startsP = starts;
+  *endsP = ends;
+  return nStarts;
+}
+
+/** Set *partsP to a newly allocated array of the entry points of the
+ *  parts split off from functions in elfFile, such as GCC's .cold
+ *  partitions, in increasing order and return their #.  Addresses are
+ *  as for get_fn_starts().
+ */
+static int
+get_fn_parts(const ElfFile *elfFile, bool isLoaded, ElfW(Addr) base,
+             void ***partsP)
+{
+  unsigned long *vaddrs;
+  int n = elf_file_fn_parts(elfFile, &vaddrs);
+  void **parts = mallocChk((n + 1)*sizeof(void *));
+  int nParts = 0;
+  for (int i = 0; i < n; i++) {
+    void *part = fn_code(elfFile, isLoaded, base, vaddrs[i]);
+    if (part) parts[nParts++] = part;
+  }
+  free(vaddrs);
+  qsort(parts, nParts, sizeof(void *), compare_ptrs);
+  *partsP = parts;
+  return nParts;
+}
+
+/** Functions which never return: the compiler may place anything after
+ *  a call to one, for example data or the next function.
+ */
+static const char *const noReturnNames[] = {
+  "abort", "exit", "_exit", "_Exit", "quick_exit", "pthread_exit",
+  "__assert_fail", "__assert_perror_fail", "__stack_chk_fail",
+  "__stack_chk_fail_local", "__fortify_fail", "__chk_fail", "__libc_fatal",
+  "err", "errx", "verr", "verrx", "longjmp", "siglongjmp", "__longjmp_chk",
+  "__cxa_throw", "__cxa_rethrow", "_Unwind_Resume", "_ZSt9terminatev",
+  NULL
+};
+
+/** Set *fnsP to a newly allocated array of the entry points of the
+ *  functions in elfFile which never return, in increasing order, and
+ *  return their #.  Addresses are as for get_fn_starts().
+ */
+static int
+get_no_return_fns(const ElfFile *elfFile, bool isLoaded, ElfW(Addr) base,
+                  void ***fnsP)
+{
+  unsigned long *vaddrs;
+  int n = elf_file_named_fns(elfFile, noReturnNames, &vaddrs);
+  void **fns = mallocChk((n + 1)*sizeof(void *));
+  int nFns = 0;
+  for (int i = 0; i < n; i++) {
+    void *f = fn_code(elfFile, isLoaded, base, vaddrs[i]);
+    if (f) fns[nFns++] = f;
+  }
+  free(vaddrs);
+  qsort(fns, nFns, sizeof(void *), compare_ptrs);
+  *fnsP = fns;
+  return nFns;
+}
+
+/** Set *slotsP to a newly allocated array of the pointer slots of
+ *  elfFile which will hold the address of a function which never
+ *  returns, in increasing order, and return their #.  The slots are
+ *  at their virtual addresses plus delta, as seen from the traced
+ *  code.
+ */
+static int
+get_no_return_slots(const ElfFile *elfFile, intptr_t delta, void ***slotsP)
+{
+  unsigned long *vaddrs;
+  int n = elf_file_named_slots(elfFile, noReturnNames, &vaddrs);
+  void **slots = mallocChk((n + 1)*sizeof(void *));
+  for (int i = 0; i < n; i++) slots[i] = (void *)(vaddrs[i] + delta);
+  free(vaddrs);
+  *slotsP = slots;
+  return n;
+}
+
+/** FnTraceOptions resolveSlot for code traced within mapped ElfFile
+ *  ctx.
+ */
+static void *
+resolve_elf_file_slot(void *ctx, const void *slot)
+{
+  return elf_file_slot(ctx, slot);
+}
+
+/** The module loaded at base whose file is mapped as elfFile, with its
+ *  PLT at [pltLo, pltHi).
+ */
+typedef struct {
+  const ElfFile *elfFile;
+  ElfW(Addr) base;
+  const char *pltLo, *pltHi;
+} LoadedModule;
+
+/** FnTraceOptions resolveSlot for code of a loaded module, ctx being
+ *  its LoadedModule: the address held by slot, unless the dynamic
+ *  linker has not bound it yet, so that it still points back into the
+ *  module's PLT, in which case the address it will hold is found from
+ *  its relocation, as with -e.  Otherwise the graph would depend on
+ *  which functions fn-trace itself has called through that PLT so far,
+ *  for example when creating threads.
+ */
+static void *
+resolve_loaded_slot(void *ctx, const void *slot)
+{
+  const LoadedModule *module = ctx;
+  char *target = *(char *const *)slot;
+  if (target < module->pltLo || target >= module->pltHi) return target;
+  unsigned long vaddr = elf_file_slot_target(module->elfFile,
+                                             (ElfW(Addr))slot - module->base);
+  return (vaddr == 0) ? NULL : (void *)(module->base + vaddr);
+}
+
+/** For each function in fnsData, print address of function (relative
+ *  address if isRelative is true, virtual address within elfFile if
+ *  it is not NULL), the # of direct calls made by that function and
+ *  the # of bytes in the code for the function, followed by a summary
+ *  of its control-flow graph if isCfg, by its instruction mix if
+ *  fnsData has one and by its dynamic call count and time if profile
+ *  is not NULL.
  */
 static void
-out_fn_trace(FILE *out, FnP f, bool isRelative)
+out_fn_trace(FILE *out, const FnsData *fnsData, bool isRelative,
+             const ElfFile *elfFile, bool isCfg, const FnProfile *profile)
 {
-  const FnsData *fnsData = new_fns_data(f);
   char *firstAddress = NULL;
   for (const FnInfo *fnInfo = next_fn_info(fnsData, NULL); fnInfo != NULL;
        fnInfo = next_fn_info(fnsData, fnInfo)) {
@@ -76,43 +373,427 @@ out_fn_trace(FILE *out, FnP f, bool isRelative)
     if (isRelative) {
       fprintf(out, "%8ld: ", (char *)(fnInfo->address) - firstAddress);
     }
+    else if (elfFile) {
+      fprintf(out, "%#lx: ", elf_file_vaddr(elfFile, fnInfo->address));
+    }
     else {
       fprintf(out, "%p: ", fnInfo->address);
     }
-    fprintf(out, "nInCalls: %7d; nOutCalls: %7d; length: %7d\n",
+    fprintf(out, "nInCalls: %7d; nOutCalls: %7d; length: %7d",
             fnInfo->nInCalls, fnInfo->nOutCalls, fnInfo->length);
+    int index = fn_info_index(fnsData, fnInfo);
+    const FnCfg *cfg = isCfg ? fn_cfg(fnsData, index) : NULL;
+    if (cfg != NULL && cfg->nBlocks > 0) {
+      const BasicBlock *hot = &cfg->blocks[cfg->hotBlock];
+      //negative for a block in a .cold part placed before the entry
+      long hotOffset = (char *)hot->address - (char *)fnInfo->address;
+      fprintf(out, "; blocks: %5d; insns: %6u; branches: %5u; loops: %3d; "
+              "hot: %c%#lx (depth %d, %u insns)",
+              cfg->nBlocks, cfg->nInsns, cfg->nBranches, cfg->nLoops,
+              hotOffset < 0 ? '-' : '+', labs(hotOffset),
+              cfg->hotDepth, hot->nInsns);
+    }
+    const FnMix *mix = fn_mix(fnsData, index);
+    if (mix != NULL) {
+      fprintf(out, "; mix: %u insns, %u loads, %u stores, %u branches, "
+              "%u simd (sse %u, avx %u, avx512 %u), %u x87",
+              mix->nInsns, mix->nLoads, mix->nStores, mix->nBranches,
+              mix->nSimd, mix->nSse, mix->nAvx, mix->nAvx512, mix->nX87);
+    }
+    unsigned long nCalls;
+    unsigned long long ticks;
+    if (profile && fn_profile_counts(profile, index, &nCalls, &ticks)) {
+      fprintf(out, "; calls: %9lu; ticks: %13llu", nCalls, ticks);
+    }
+    else if (profile) {
+      fprintf(out, "; calls: %9s; ticks: %13s", "-", "-");
+    }
+    fprintf(out, "\n");
+  }
+}
+
+/** Return traced code address as it is to be output: relative to the
+ *  first function if isRelative, virtual address within elfFile if it
+ *  is not NULL, else its absolute address.
+ */
+static unsigned long
+out_address(const FnsData *fnsData, const void *address, bool isRelative,
+            const ElfFile *elfFile)
+{
+  if (isRelative) {
+    return (char *)address - (char *)fn_info_at(fnsData, 0)->address;
+  }
+  else if (elfFile) {
+    return elf_file_vaddr(elfFile, address);
+  }
+  else {
+    return (unsigned long)address;
   }
-  free_fns_data((FnsData *)fnsData);
 }
 
-/** Usage: fn-trace [-r] MODULE FUNCTION: static trace of all calls
- *  made by function FUNCTION in shared-object MODULE.
+/** Output call graph in fnsData on out in Graphviz DOT format: one
+ *  node per function labelled with its address and counts, and one
+ *  edge per call site.
+ */
+static void
+out_fn_dot(FILE *out, const FnsData *fnsData, bool isRelative,
+           const ElfFile *elfFile)
+{
+  fprintf(out, "digraph fns {\n");
+  int nFns = n_fn_infos(fnsData);
+  for (int i = 0; i < nFns; i++) {
+    const FnInfo *fnInfo = fn_info_at(fnsData, i);
+    fprintf(out, "  f%d [label=\"%#lx\\nin %u out %u len %u\"];\n", i,
+            out_address(fnsData, fnInfo->address, isRelative, elfFile),
+            fnInfo->nInCalls, fnInfo->nOutCalls, fnInfo->length);
+  }
+  for (int i = 0; i < nFns; i++) {
+    const int *callees;
+    int nCallees = fn_callees(fnsData, i, &callees);
+    for (int c = 0; c < nCallees; c++) {
+      fprintf(out, "  f%d -> f%d;\n", i, callees[c]);
+    }
+  }
+  fprintf(out, "}\n");
+}
+
+/** Binary call-graph format written by -g edges, in host byte order:
+ *  an EdgesHeader, then nFns EdgesFn records in address order, then
+ *  nEdges EdgesEdge records, one per call site, grouped by caller.
+ *  Functions are referred to by their 0-based record position.
+ */
+#define EDGES_MAGIC "FNEDGES1"
+typedef struct {
+  char magic[8];         /** EDGES_MAGIC without its terminating NUL */
+  uint64_t nFns, nEdges;
+} EdgesHeader;
+typedef struct {
+  uint64_t address;      /** as in the text output */
+  uint32_t length, nInCalls, nOutCalls, reserved;
+} EdgesFn;
+typedef struct {
+  uint32_t caller, callee;
+} EdgesEdge;
+
+/** Output call graph in fnsData on out in the binary edge format. */
+static void
+out_fn_edges(FILE *out, const FnsData *fnsData, bool isRelative,
+             const ElfFile *elfFile)
+{
+  int nFns = n_fn_infos(fnsData);
+  EdgesHeader header = { .nFns = nFns, .nEdges = 0 };
+  memcpy(header.magic, EDGES_MAGIC, sizeof(header.magic));
+  for (int i = 0; i < nFns; i++) {
+    const int *callees;
+    header.nEdges += fn_callees(fnsData, i, &callees);
+  }
+  fwrite(&header, sizeof(header), 1, out);
+  for (int i = 0; i < nFns; i++) {
+    const FnInfo *fnInfo = fn_info_at(fnsData, i);
+    EdgesFn fn = {
+      .address = out_address(fnsData, fnInfo->address, isRelative, elfFile),
+      .length = fnInfo->length,
+      .nInCalls = fnInfo->nInCalls,
+      .nOutCalls = fnInfo->nOutCalls,
+    };
+    fwrite(&fn, sizeof(fn), 1, out);
+  }
+  for (int i = 0; i < nFns; i++) {
+    const int *callees;
+    int nCallees = fn_callees(fnsData, i, &callees);
+    for (int c = 0; c < nCallees; c++) {
+      EdgesEdge edge = { i, callees[c] };
+      fwrite(&edge, sizeof(edge), 1, out);
+    }
+  }
+}
+
+/** Return the call graph traced from the nRoots roots with options in
+ *  the module with ELF file elfFile, whose code is at its virtual
+ *  addresses plus delta.  If cacheDir is not NULL, the graph is loaded
+ *  from the cache in it saved for key, or traced and saved there if
+ *  not found.
+ */
+static const FnsData *
+trace_cached(const char *cacheDir, const char *key, const ElfFile *elfFile,
+             intptr_t delta, void *const roots[], int nRoots,
+             const FnTraceOptions *options)
+{
+  const FnsData *fnsData = (cacheDir == NULL) ? NULL
+    : load_fn_cache(cacheDir, elfFile, key, delta);
+  if (fnsData) return fnsData;
+  fnsData = new_fns_data_options(roots, nRoots, options);
+  if (fns_data_is_truncated(fnsData)) {
+    fprintf(stderr, "trace stopped at %d functions; some calls not followed\n",
+            options->maxFns);
+  }
+  if (cacheDir && !save_fn_cache(cacheDir, elfFile, key, delta, fnsData)) {
+    fprintf(stderr, "cannot save trace in cache %s: %s\n", cacheDir,
+            strerror(errno));
+  }
+  return fnsData;
+}
+
+/** Output fnsData on out in format: "text", "dot" or "edges".  The
+ *  text format includes CFG summaries if isCfg and the counts in
+ *  profile if it is not NULL.
+ */
+static void
+out_fns(FILE *out, const char *format, const FnsData *fnsData,
+        bool isRelative, const ElfFile *elfFile, bool isCfg,
+        const FnProfile *profile)
+{
+  if (strcmp(format, "dot") == 0) {
+    out_fn_dot(out, fnsData, isRelative, elfFile);
+  }
+  else if (strcmp(format, "edges") == 0) {
+    out_fn_edges(out, fnsData, isRelative, elfFile);
+  }
+  else {
+    out_fn_trace(out, fnsData, isRelative, elfFile, isCfg, profile);
+  }
+}
+
+/** Usage: fn-trace [-r] [-e] [-b] [-m] [-p] [-g dot|edges] [-j N] [-n N]
+ *  [-c DIR] MODULE FUNCTION: static trace of all calls made by function
+ *  FUNCTION in shared-object MODULE.  -j N decodes functions using N threads.  -e
+ *  traces the ELF file MODULE (a shared object or executable) without
+ *  loading it; only calls within the executable segment containing
+ *  FUNCTION are followed and addresses are printed as virtual
+ *  addresses within the file.
+ *
+ *  Usage: fn-trace -a [-r] [-e] [-b] [-m] [-g dot|edges] [-j N] [-n N]
+ *  [-c DIR] MODULE: as above, but traces the whole module: every function
+ *  exported by MODULE is a root and all of them are traced into a
+ *  single call graph, in which each function is decoded and reported
+ *  once.
+ *
+ *  -b also builds the basic-block graph of each function and prints its
+ *  # of blocks, instructions, branches and loops, and the offset of
+ *  its hottest-looking block: the one nested in most loops.
+ *
+ *  -m also counts the instructions of each function of each kind:
+ *  memory loads and stores, branches, SIMD (SSE, AVX and AVX-512) and
+ *  x87 instructions, so that unvectorized functions stand out.
+ *
+ *  -p profiles FUNCTION: after tracing, the entry of each traced
+ *  function is patched to count its calls and the time-stamp counter
+ *  ticks spent in it, FUNCTION is called and its result printed, and
+ *  the count and ticks of each function are printed after the static
+ *  data; "-" for functions whose entry could not be patched.  Not
+ *  available with -e or -a.
+ *
+ *  -n N traces at most N functions, bounding the memory used for large
+ *  modules: calls to further functions are counted but not followed,
+ *  and a note is printed on stderr when the limit is reached.
+ *
+ *  -c DIR caches call graphs in directory DIR, keyed by the build-id
+ *  of MODULE and by FUNCTION, -a, -e and -n: a later run on the same
+ *  unchanged module loads the graph instead of tracing it again, and
+ *  a rebuilt module, or one cached by a version of fn-trace which
+ *  traces differently, is traced afresh.  Ignored with -b, -m or -p,
+ *  whose data is not cached.
+ *
+ *  -g dot outputs the call graph in Graphviz DOT format instead and
+ *  -g edges in the binary format described above EdgesHeader.
  *
  *  First prints the result of calling FUNCTION with no arguments.
  *
  *  Then for each function called directly or indirectly by FUNCTION,
  *  print address of function (relative address if -r option
- *  specified), the # of direct calls made by that function and the #
- *  of bytes in the code for the function.
+ *  specified), the # of call sites in traced functions calling it,
+ *  the # of direct calls made by that function and the # of bytes in
+ *  the code for the function.  A call site is counted whether its
+ *  callee is a root or was reached from one, and whether or not it is
+ *  the call through which the callee was discovered.
  */
 int
 main(int argc, const char *argv[]) {
-  if ((argc != 3 && argc != 4) || (argc == 4 && strcmp(argv[1], "-r") != 0)) {
-    fatal("usage: %s [-r] MODULE FUNCTION\n", argv[0]);
+  bool isRelative = false;
+  bool isElfFile = false;
+  bool isWholeModule = false;
+  bool isCfg = false;
+  bool isMix = false;
+  bool isProfile = false;
+  const char *format = "text";
+  const char *cacheDir = NULL;
+  int nThreads = 1;
+  int maxFns = 0;
+  int nonOptionArgIndex;
+  for (nonOptionArgIndex = 1;
+       nonOptionArgIndex < argc && argv[nonOptionArgIndex][0] == '-';
+       nonOptionArgIndex++) {
+    const char *opt = argv[nonOptionArgIndex];
+    if (strcmp(opt, "-r") == 0) {
+      isRelative = true;
+    }
+    else if (strcmp(opt, "-e") == 0) {
+      isElfFile = true;
+    }
+    else if (strcmp(opt, "-a") == 0) {
+      isWholeModule = true;
+    }
+    else if (strcmp(opt, "-b") == 0) {
+      isCfg = true;
+    }
+    else if (strcmp(opt, "-m") == 0) {
+      isMix = true;
+    }
+    else if (strcmp(opt, "-p") == 0) {
+      isProfile = true;
+    }
+    else if (strcmp(opt, "-g") == 0 && nonOptionArgIndex + 1 < argc) {
+      format = argv[++nonOptionArgIndex];
+      if (strcmp(format, "dot") != 0 && strcmp(format, "edges") != 0) {
+        fatal("%s: -g format must be dot or edges\n", argv[0]);
+      }
+    }
+    else if (strcmp(opt, "-j") == 0 && nonOptionArgIndex + 1 < argc) {
+      nThreads = atoi(argv[++nonOptionArgIndex]);
+      if (nThreads < 1) fatal("%s: -j requires a positive count\n", argv[0]);
+    }
+    else if (strcmp(opt, "-n") == 0 && nonOptionArgIndex + 1 < argc) {
+      maxFns = atoi(argv[++nonOptionArgIndex]);
+      if (maxFns < 1) fatal("%s: -n requires a positive count\n", argv[0]);
+    }
+    else if (strcmp(opt, "-c") == 0 && nonOptionArgIndex + 1 < argc) {
+      cacheDir = argv[++nonOptionArgIndex];
+    }
+    else {
+      break;
+    }
+  }
+  if (argc - nonOptionArgIndex != (isWholeModule ? 1 : 2)) {
+    fatal("usage: %s [-r] [-e] [-b] [-m] [-p] [-g dot|edges] [-j N] [-n N] "
+          "[-c DIR] MODULE FUNCTION\n"
+          "       %s -a [-r] [-e] [-b] [-m] [-g dot|edges] [-j N] [-n N] "
+          "[-c DIR] MODULE\n",
+          argv[0], argv[0]);
+  }
+  if (isProfile && (isElfFile || isWholeModule)) {
+    fatal("%s: -p cannot be used with -e or -a\n", argv[0]);
   }
-  bool isRelative = (argc == 4);
-  int nonOptionArgIndex = (isRelative) ? 2 : 1;
   const char *module = argv[nonOptionArgIndex];
   const char *fn = argv[nonOptionArgIndex + 1];
-
-  void *handle;
-  FnP f = get_module_fn(module, fn, &handle);
+  if (isCfg || isMix || isProfile) cacheDir = NULL;
+  //how the graph was traced, as on the command line
+  char *key = mallocChk(strlen(isWholeModule ? "-a" : fn) + 20);
+  sprintf(key, "%s%s", isElfFile ? "-e " : "", isWholeModule ? "-a" : fn);
+  if (maxFns > 0) sprintf(key + strlen(key), " -n %d", maxFns);
 
   FILE *out = stdout;
-  //out_fn_call_result(out, module, fn, f);
-  out_fn_trace(out, f, isRelative);
+  //profiling needs the CFGs to find branches to function entries
+  FnTraceOptions options = {
+    .nThreads = nThreads, .maxFns = maxFns, .isCfg = isCfg || isProfile,
+    .isMix = isMix
+  };
+  void **roots;
+  int nRoots = 1;
+  void **fnStarts, **fnEnds, **fnParts, **noReturnFns, **noReturnSlots;
+  if (isElfFile) {
+    ElfFile *elfFile = map_elf_file(module);
+    void *codeLo, *codeHi;
+    if (isWholeModule) {
+      nRoots = get_elf_file_exports(module, elfFile, &roots, &codeLo, &codeHi);
+    }
+    else {
+      roots = mallocChk(sizeof(void *));
+      roots[0] = get_elf_file_fn(module, fn, elfFile, &codeLo, &codeHi);
+    }
+    options.codeLo = codeLo;
+    options.codeHi = codeHi;
+    options.nFnStarts = get_fn_starts(elfFile, false, 0, &fnStarts, &fnEnds);
+    options.fnStarts = fnStarts;
+    options.fnEnds = fnEnds;
+    options.nFnParts = get_fn_parts(elfFile, false, 0, &fnParts);
+    options.fnParts = fnParts;
+    options.resolveSlot = resolve_elf_file_slot;
+    options.resolveCtx = elfFile;
+    intptr_t delta = (intptr_t)codeLo - elf_file_vaddr(elfFile, codeLo);
+    options.nNoReturnFns = get_no_return_fns(elfFile, false, 0, &noReturnFns);
+    options.noReturnFns = noReturnFns;
+    options.nNoReturnSlots =
+      get_no_return_slots(elfFile, delta, &noReturnSlots);
+    options.noReturnSlots = noReturnSlots;
+    const FnsData *fnsData = trace_cached(cacheDir, key, elfFile, delta,
+                                          roots, nRoots, &options);
+    out_fns(out, format, fnsData, isRelative, elfFile, isCfg, NULL);
+    free_fns_data((FnsData *)fnsData);
+    fn_trace_unload(codeLo, codeHi);
+    close_elf_file(elfFile);
+  }
+  else {
+    void *handle;
+    if (isWholeModule) {
+      handle = dlopen(module, RTLD_NOW);
+      if (!handle) {
+        fatal("cannot load %s: %s\n", module, dlerror());
+      }
+    }
+    else {
+      roots = mallocChk(sizeof(void *));
+      roots[0] = (void *)get_module_fn(module, fn, &handle);
+      //out_fn_call_result(out, module, fn, roots[0]);
+    }
+    //the module's own file supplies its exports and function starts
+    struct link_map *map;
+    if (dlinfo(handle, RTLD_DI_LINKMAP, &map) != 0) {
+      fatal("cannot find load address of %s: %s\n", module, dlerror());
+    }
+    ElfFile *elfFile = map_elf_file(map->l_name);
+    if (isWholeModule) {
+      nRoots = get_module_exports(module, elfFile, map->l_addr, &roots);
+    }
+    options.nFnStarts =
+      get_fn_starts(elfFile, true, map->l_addr, &fnStarts, &fnEnds);
+    options.fnStarts = fnStarts;
+    options.fnEnds = fnEnds;
+    options.nFnParts = get_fn_parts(elfFile, true, map->l_addr, &fnParts);
+    options.fnParts = fnParts;
+    options.nNoReturnFns =
+      get_no_return_fns(elfFile, true, map->l_addr, &noReturnFns);
+    options.noReturnFns = noReturnFns;
+    options.nNoReturnSlots =
+      get_no_return_slots(elfFile, map->l_addr, &noReturnSlots);
+    options.noReturnSlots = noReturnSlots;
+    char *codeLo, *codeHi;
+    get_module_extent(handle, true, &codeLo, &codeHi);
+    options.codeLo = codeLo;
+    options.codeHi = codeHi;
+    unsigned long pltLo, pltHi;
+    elf_file_plt(elfFile, &pltLo, &pltHi);
+    LoadedModule loaded = {
+      elfFile, map->l_addr,
+      (char *)(map->l_addr + pltLo), (char *)(map->l_addr + pltHi)
+    };
+    options.resolveSlot = resolve_loaded_slot;
+    options.resolveCtx = &loaded;
+    const FnsData *fnsData = trace_cached(cacheDir, key, elfFile, map->l_addr,
+                                          roots, nRoots, &options);
+    close_elf_file(elfFile);
+    FnProfile *profile = NULL;
+    if (isProfile) {
+      //only symbols are known to be entered by calls
+      profile = new_fn_profile(fnsData, fnStarts, options.nFnStarts);
+      if (!profile) fatal("cannot profile %s: %s\n", module, strerror(errno));
+      out_fn_call_result(out, module, fn, (FnP)roots[0]);
+    }
+    out_fns(out, format, fnsData, isRelative, NULL, isCfg, profile);
+    if (profile) free_fn_profile(profile);
+    free_fns_data((FnsData *)fnsData);
 
-  dlclose(handle);
+    char *lo, *hi;
+    get_module_extent(handle, false, &lo, &hi);
+    fn_trace_unload(lo, hi);
+    dlclose(handle);
+  }
+  free(roots);
+  free(fnStarts);
+  free(fnEnds);
+  free(fnParts);
+  free(noReturnFns);
+  free(noReturnSlots);
+  free(key);
 
   return 0;
 }
@@ -5,10 +5,15 @@
 
 #include "capstone/capstone.h"
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 
-/** Length decoder for x86_64 instructions. Uses capstone disassembler
- *  library.
+/** Length decoder for x86_64 instructions.  By default uses a built-in
+ *  decoder driven by compact tables for the 1- and 2-byte opcode maps;
+ *  legacy prefixes, REX, VEX, EVEX, XOP and the 3-byte 0F38/0F3A maps
+ *  are handled in code.  The capstone disassembler library is kept as
+ *  an alternate backend to verify the built-in decoder against.
  *
  *  Dependencies:
  *
@@ -29,49 +34,670 @@
  *  library directory when any program linked with this code is run.
  */
 
+enum { MAX_INSN_SIZE = 15 };
+
+/** Direct-mapped cache of decoded instructions indexed by the low bits
+ *  of their address, so straight-line code never conflicts with itself.
+ */
+enum { CACHE_BITS = 16, CACHE_SIZE = 1 << CACHE_BITS };
+
+typedef struct {
+  const unsigned char *addr;   //NULL if empty
+  signed char length;
+  unsigned char opClass;
+  unsigned char kinds;
+} CacheEntry;
+
 struct LdeImpl {
-  csh capstone;
+  LdeBackend backend;
+  csh capstone;     //only if backend == LDE_CAPSTONE
   cs_insn *insn;
+  CacheEntry *cache;
 };
 
 /** Return a new x86-64 length decoder */
 Lde *
 new_lde(void)
+{
+  return new_lde_backend(LDE_NATIVE);
+}
+
+/** Return a new x86-64 length decoder which uses backend */
+Lde *
+new_lde_backend(LdeBackend backend)
 {
   Lde *lde = mallocChk(sizeof(Lde));
-  cs_err err = cs_open(CS_ARCH_X86, CS_MODE_64, &lde->capstone);
-  if (err) {
-    fatal("cannot create capstone disassembler: %u\n", err);
+  lde->backend = backend;
+  lde->insn = NULL;
+  lde->cache = callocChk(CACHE_SIZE, sizeof(CacheEntry));
+  if (backend == LDE_CAPSTONE) {
+    cs_err err = cs_open(CS_ARCH_X86, CS_MODE_64, &lde->capstone);
+    if (err) {
+      fatal("cannot create capstone disassembler: %u\n", err);
+    }
+    lde->insn = cs_malloc(lde->capstone);
   }
-  lde->insn = cs_malloc(lde->capstone);
   return lde;
 }
 
 /** Free previously created x86-64 length decoder */
 void
 free_lde(Lde *lde) {
-  cs_free(lde->insn, 1);
-  cs_close(&lde->capstone);
+  if (lde->backend == LDE_CAPSTONE) {
+    cs_free(lde->insn, 1);
+    cs_close(&lde->capstone);
+  }
+  free(lde->cache);
   free(lde);
 }
 
-/** Return length of x86-64 instruction pointed to by p.  Returns < 0
- *  on error.
+/** Forget cached decodings of instructions starting in [lo, hi).  Must
+ *  be called before code in that range is unmapped or modified.
  */
-int
-get_op_length(const Lde *lde, const unsigned char *p)
+void
+lde_invalidate(const Lde *lde, const void *lo, const void *hi)
+{
+  for (int i = 0; i < CACHE_SIZE; i++) {
+    CacheEntry *e = &lde->cache[i];
+    if ((const void *)e->addr >= lo && (const void *)e->addr < hi) {
+      e->addr = NULL;
+    }
+  }
+}
+
+/** What the built-in decoder finds out about an instruction */
+typedef struct {
+  LdeOpClass opClass;
+  int ripDisp;       //as returned by get_op_rip_disp()
+  unsigned kinds;    //as returned by get_op_kinds()
+} OpDetails;
+
+static int native_decode(const unsigned char *p, OpDetails *details);
+
+static int
+capstone_op_length(const Lde *lde, const unsigned char *p)
 {
-  enum { MAX_INSN_SIZE = 15 };
   size_t size = MAX_INSN_SIZE;
   const unsigned char *p1 = p;
   uint64_t addr = (uint64_t)p;
   int isOk = cs_disasm_iter(lde->capstone, &p1, &size, &addr, lde->insn);
-  if (!isOk) {
+  return isOk ? p1 - p : -1;
+}
+
+/** Return length of instruction at p and set *opClassP to its class
+ *  and *kindsP to its LdeOpKind's.  Returns < 0 for an undecodable
+ *  instruction without reporting an error.  Results are cached by
+ *  address; kinds always come from the built-in decoder.
+ */
+int
+get_op_kinds(const Lde *lde, const unsigned char *p, LdeOpClass *opClassP,
+             unsigned *kindsP)
+{
+  CacheEntry *e = &lde->cache[(uintptr_t)p & (CACHE_SIZE - 1)];
+  if (e->addr == p) {
+    *opClassP = e->opClass;
+    *kindsP = e->kinds;
+    return e->length;
+  }
+  OpDetails details;
+  int len = native_decode(p, &details);
+  if (lde->backend == LDE_CAPSTONE) len = capstone_op_length(lde, p);
+  *opClassP = details.opClass;
+  *kindsP = details.kinds;
+  if (len >= 0) {
+    *e = (CacheEntry) {
+      .addr = p, .length = len, .opClass = details.opClass,
+      .kinds = details.kinds,
+    };
+  }
+  return len;
+}
+
+/** Return length of instruction at p and set *opClassP to its class.
+ *  Returns < 0 for an undecodable instruction without reporting an
+ *  error.  Results are cached by address.
+ */
+int
+get_op_info(const Lde *lde, const unsigned char *p, LdeOpClass *opClassP)
+{
+  unsigned kinds;
+  return get_op_kinds(lde, p, opClassP, &kinds);
+}
+
+/** Like get_op_length() but returns < 0 for an undecodable
+ *  instruction without reporting an error.
+ */
+int
+try_op_length(const Lde *lde, const unsigned char *p)
+{
+  LdeOpClass opClass;
+  return get_op_info(lde, p, &opClass);
+}
+
+/** Return the offset from p of the 32-bit displacement of the
+ *  RIP-relative memory operand of the instruction at p, 0 if it has
+ *  none.  Returns < 0 for an undecodable instruction.  Always uses the
+ *  built-in decoder and is not cached.
+ */
+int
+get_op_rip_disp(const Lde *lde, const unsigned char *p)
+{
+  OpDetails details;
+  return (native_decode(p, &details) < 0) ? -1 : details.ripDisp;
+}
+
+/** Return length of x86-64 instruction pointed to by p.  Returns < 0
+ *  on error.
+ */
+int
+get_op_length(const Lde *lde, const unsigned char *p)
+{
+  int len = try_op_length(lde, p);
+  if (len < 0) {
     for (int i = 0; i < MAX_INSN_SIZE; i++) { //assume p[i] addr ok
       fprintf(stderr, "0x%02x ", p[i]);
     }
-    fatal("\ncannot decode instruction at %p: %u\n",
-          p, cs_errno(lde->capstone));
+    fatal("\ncannot decode instruction at %p\n", p);
+  }
+  return len;
+}
+
+/** Opcode flags in decode tables */
+enum {
+  F_M = 0x01,     //has ModRM byte
+  F_I8 = 0x02,    //8-bit immediate
+  F_I16 = 0x04,   //16-bit immediate
+  F_IZ = 0x08,    //16/32-bit immediate depending on operand size
+  F_X = 0x80,     //invalid in 64-bit mode
+};
+
+#define M F_M
+#define I8 F_I8
+#define I16 F_I16
+#define IZ F_IZ
+#define X F_X
+#define MI8 (F_M|F_I8)
+#define MIZ (F_M|F_IZ)
+
+/** flags for 1-byte opcode map; prefixes, escapes and entries which
+ *  depend on more than the opcode byte are handled in code.
+ */
+static const unsigned char OP1_FLAGS[256] = {
+  /*     0    1    2    3    4    5    6    7    8    9    A    B    C    D    E    F */
+  /*0*/  M,   M,   M,   M,   I8,  IZ,  X,   X,   M,   M,   M,   M,   I8,  IZ,  X,   0,
+  /*1*/  M,   M,   M,   M,   I8,  IZ,  X,   X,   M,   M,   M,   M,   I8,  IZ,  X,   X,
+  /*2*/  M,   M,   M,   M,   I8,  IZ,  0,   X,   M,   M,   M,   M,   I8,  IZ,  0,   X,
+  /*3*/  M,   M,   M,   M,   I8,  IZ,  0,   X,   M,   M,   M,   M,   I8,  IZ,  0,   X,
+  /*4*/  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+  /*5*/  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+  /*6*/  X,   X,   0,   M,   0,   0,   0,   0,   IZ,  MIZ, I8,  MI8, 0,   0,   0,   0,
+  /*7*/  I8,  I8,  I8,  I8,  I8,  I8,  I8,  I8,  I8,  I8,  I8,  I8,  I8,  I8,  I8,  I8,
+  /*8*/  MI8, MIZ, X,   MI8, M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,
+  /*9*/  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   X,   0,   0,   0,   0,   0,
+  /*A*/  0,   0,   0,   0,   0,   0,   0,   0,   I8,  IZ,  0,   0,   0,   0,   0,   0,
+  /*B*/  I8,  I8,  I8,  I8,  I8,  I8,  I8,  I8,  IZ,  IZ,  IZ,  IZ,  IZ,  IZ,  IZ,  IZ,
+  /*C*/  MI8, MI8, I16, 0,   0,   0,   MI8, MIZ, I16|I8, 0, I16, 0,   0,   I8,  X,   0,
+  /*D*/  M,   M,   M,   M,   X,   X,   X,   0,   M,   M,   M,   M,   M,   M,   M,   M,
+  /*E*/  I8,  I8,  I8,  I8,  I8,  I8,  I8,  I8,  IZ,  IZ,  X,   I8,  0,   0,   0,   0,
+  /*F*/  0,   0,   0,   0,   0,   0,   M,   M,   0,   0,   0,   0,   0,   0,   M,   M,
+};
+
+/** flags for 2-byte 0F xx opcode map */
+static const unsigned char OP2_FLAGS[256] = {
+  /*     0    1    2    3    4    5    6    7    8    9    A    B    C    D    E    F */
+  /*0*/  M,   M,   M,   M,   X,   0,   0,   0,   0,   0,   X,   0,   X,   M,   0,   MI8,
+  /*1*/  M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,
+  /*2*/  M,   M,   M,   M,   X,   X,   X,   X,   M,   M,   M,   M,   M,   M,   M,   M,
+  /*3*/  0,   0,   0,   0,   0,   0,   X,   0,   0,   X,   0,   X,   X,   X,   X,   X,
+  /*4*/  M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,
+  /*5*/  M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,
+  /*6*/  M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,
+  /*7*/  MI8, MI8, MI8, MI8, M,   M,   M,   0,   M,   M,   X,   X,   M,   M,   M,   M,
+  /*8*/  IZ,  IZ,  IZ,  IZ,  IZ,  IZ,  IZ,  IZ,  IZ,  IZ,  IZ,  IZ,  IZ,  IZ,  IZ,  IZ,
+  /*9*/  M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,
+  /*A*/  0,   0,   0,   M,   MI8, M,   X,   X,   0,   0,   0,   M,   MI8, M,   M,   M,
+  /*B*/  M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   MI8, M,   M,   M,   M,   M,
+  /*C*/  M,   M,   MI8, M,   MI8, MI8, MI8, M,   0,   0,   0,   0,   0,   0,   0,   0,
+  /*D*/  M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,
+  /*E*/  M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,
+  /*F*/  M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,
+};
+
+#undef M
+#undef I8
+#undef I16
+#undef IZ
+#undef X
+#undef MI8
+#undef MIZ
+
+static inline bool
+is_legacy_prefix(unsigned b)
+{
+  switch (b) {
+  case 0xF0: case 0xF2: case 0xF3:
+  case 0x26: case 0x2E: case 0x36: case 0x3E: case 0x64: case 0x65:
+  case 0x66: case 0x67:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/** Return length of ModRM byte at p plus any SIB and displacement */
+static inline int
+modrm_length(const unsigned char *p)
+{
+  unsigned mod = p[0] >> 6, rm = p[0] & 7;
+  if (mod == 3) return 1;
+  int n = 1;
+  if (rm == 4) {
+    n++;
+    if (mod == 0 && (p[1] & 7) == 5) return n + 4;
+  }
+  else if (mod == 0 && rm == 5) {
+    return n + 4;   //RIP-relative
+  }
+  return n + (mod == 1 ? 1 : mod == 2 ? 4 : 0);
+}
+
+/** Immediate size for an opcode in a VEX/EVEX/XOP map */
+static inline int
+vex_imm_size(unsigned map, unsigned op)
+{
+  switch (map) {
+  case 1:
+    return ((0x70 <= op && op <= 0x73) || op == 0xC2 ||
+            (0xC4 <= op && op <= 0xC6)) ? 1 : 0;
+  case 3: case 8:
+    return 1;
+  case 0xA:
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+/** Control-flow class of 1-byte map opcode op; modrm points to the
+ *  byte following op.
+ */
+static inline LdeOpClass
+one_byte_op_class(unsigned op, const unsigned char *modrm)
+{
+  switch (op) {
+  case 0xC2: case 0xC3: case 0xCA: case 0xCB:
+    return LDE_OP_RET;
+  case 0xE8:
+    return LDE_OP_CALL;
+  case 0xE9: case 0xEB:
+    return LDE_OP_JMP;
+  case 0xE0: case 0xE1: case 0xE2: case 0xE3:   //loop*, jrcxz
+    return LDE_OP_JCC;
+  case 0xFF:
+    switch ((*modrm >> 3) & 7) {
+    case 2: case 3: return LDE_OP_CALL_INDIRECT;
+    case 4: case 5: return LDE_OP_JMP_INDIRECT;
+    default: return LDE_OP_OTHER;
+    }
+  default:
+    return (0x70 <= op && op <= 0x7F) ? LDE_OP_JCC : LDE_OP_OTHER;
+  }
+}
+
+/** Instruction encodings distinguished by op_kinds() */
+typedef enum { ENC_LEGACY, ENC_VEX, ENC_EVEX, ENC_XOP } OpEncoding;
+
+/** Mandatory prefix implied by the pp field of a VEX or EVEX prefix */
+static const unsigned char VEX_PREFIXES[4] = { 0, 0x66, 0xF3, 0xF2 };
+
+/** Return memory access kinds of 1-byte map opcode op with ModRM reg
+ *  field reg, where isMem is true iff it has a ModRM memory operand.
+ *  Stack pushes and pops count as stores and loads.
+ */
+static unsigned
+one_byte_mem_kinds(unsigned op, unsigned reg, bool isMem)
+{
+  const unsigned rw = LDE_LOAD | LDE_STORE;
+  if ((0x50 <= op && op <= 0x57) || op == 0x68 || op == 0x6A || op == 0x9C ||
+      op == 0xE8) {
+    return LDE_STORE;              //push, pushf, call
+  }
+  if ((0x58 <= op && op <= 0x5F) || op == 0x9D || op == 0xC9 ||
+      op == 0xC2 || op == 0xC3 || op == 0xCA || op == 0xCB) {
+    return LDE_LOAD;               //pop, popf, leave, ret
+  }
+  switch (op) {
+  case 0xA0: case 0xA1:            //mov from moffs
+  case 0xA6: case 0xA7:            //cmps
+  case 0xAC: case 0xAD:            //lods
+  case 0xAE: case 0xAF:            //scas
+    return LDE_LOAD;
+  case 0xA2: case 0xA3:            //mov to moffs
+  case 0xAA: case 0xAB:            //stos
+    return LDE_STORE;
+  case 0xA4: case 0xA5:            //movs
+    return rw;
+  case 0xFF:                       //call, push through r/m
+    if (reg == 2 || reg == 3 || reg == 6) return isMem ? rw : LDE_STORE;
+    break;
+  }
+  if (!isMem) return 0;
+  if (op < 0x40 && (op & 7) < 4) {           //ALU ops with r/m operand
+    if (op & 2) return LDE_LOAD;             //r/m is source
+    return ((op & 0x38) == 0x38) ? LDE_LOAD : rw;  //cmp only reads
+  }
+  switch (op) {
+  case 0x80: case 0x81: case 0x83:
+    return (reg == 7) ? LDE_LOAD : rw;
+  case 0x86: case 0x87: case 0x8F:
+  case 0xC0: case 0xC1: case 0xD0: case 0xD1: case 0xD2: case 0xD3:
+    return rw;
+  case 0x88: case 0x89: case 0x8C: case 0xC6: case 0xC7:
+    return LDE_STORE;
+  case 0x8D:                       //lea
+    return 0;
+  case 0xF6: case 0xF7:
+    return (reg == 2 || reg == 3) ? rw : LDE_LOAD;
+  case 0xFE: case 0xFF:
+    return (reg < 2) ? rw : LDE_LOAD;
+  default:
+    return LDE_LOAD;
+  }
+}
+
+/** Return true iff x87 opcode op with a memory operand and ModRM reg
+ *  field reg stores to memory.
+ */
+static bool
+is_x87_store(unsigned op, unsigned reg)
+{
+  switch (op) {
+  case 0xD9:
+    return reg == 2 || reg == 3 || reg == 6 || reg == 7;
+  case 0xDB:
+    return reg == 1 || reg == 2 || reg == 3 || reg == 7;
+  case 0xDD: case 0xDF:
+    return reg == 1 || reg == 2 || reg == 3 || reg == 6 || reg == 7;
+  default:
+    return false;
+  }
+}
+
+/** Return memory access kinds of opcode op with a memory operand in
+ *  legacy-encoded map (1 for 0F, 2 for 0F38, 3 for 0F3A), with
+ *  mandatory prefix prefix and ModRM reg field reg.
+ */
+static unsigned
+escape_mem_kinds(unsigned map, unsigned op, unsigned prefix, unsigned reg)
+{
+  const unsigned rw = LDE_LOAD | LDE_STORE;
+  if (map == 2) return (op == 0xF1 && prefix != 0xF2) ? LDE_STORE : LDE_LOAD;
+  if (map == 3) return (0x14 <= op && op <= 0x17) ? LDE_STORE : LDE_LOAD;
+  if (0x90 <= op && op <= 0x9F) return LDE_STORE;      //setcc
+  if ((0x18 <= op && op <= 0x1F) || op == 0x0D) return 0;  //hints, nop
+  switch (op) {
+  case 0x11: case 0x13: case 0x17: case 0x29: case 0x2B:
+  case 0x7F: case 0xC3: case 0xD6: case 0xE7:
+    return LDE_STORE;
+  case 0x7E:
+    return (prefix == 0xF3) ? LDE_LOAD : LDE_STORE;
+  case 0xA4: case 0xA5: case 0xAB: case 0xAC: case 0xAD:
+  case 0xB0: case 0xB1: case 0xB3: case 0xBB: case 0xC0: case 0xC1:
+    return rw;
+  case 0xBA:
+    return (reg == 4) ? LDE_LOAD : rw;
+  case 0xC7:
+    return (reg == 1) ? rw : LDE_LOAD;
+  case 0xAE:
+    return (reg == 0 || reg == 3 || reg == 4 || reg == 6) ? LDE_STORE
+      : (reg == 7) ? 0 : LDE_LOAD;
+  default:
+    return LDE_LOAD;
+  }
+}
+
+/** Return true iff VEX/EVEX opcode op in map stores its memory operand */
+static bool
+is_vex_store(unsigned map, unsigned op, unsigned prefix)
+{
+  switch (map) {
+  case 1:
+    return op == 0x11 || op == 0x13 || op == 0x17 || op == 0x29 ||
+      op == 0x2B || op == 0x7F || op == 0xD6 || op == 0xE7 ||
+      (op == 0x7E && prefix != 0xF3);
+  case 2:
+    return op == 0x2E || op == 0x2F || op == 0x8E || (0xA0 <= op && op <= 0xA3);
+  case 3:
+    return (0x14 <= op && op <= 0x17) || op == 0x19 || op == 0x1B ||
+      op == 0x1D || op == 0x39 || op == 0x3B;
+  default:
+    return false;
+  }
+}
+
+/** Return true iff legacy-encoded opcode op in map is an SSE or MMX
+ *  instruction.
+ */
+static bool
+is_sse_op(unsigned map, unsigned op)
+{
+  switch (map) {
+  case 1:
+    return (0x10 <= op && op <= 0x17) || (0x28 <= op && op <= 0x2F) ||
+      (0x50 <= op && op <= 0x7F) || op == 0xC2 ||
+      (0xC4 <= op && op <= 0xC6) || op >= 0xD0;
+  case 2:
+    return op < 0xF0;    //0F38 Fx are integer: movbe, crc32, adcx, ...
+  case 3:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/** Return LdeOpKind's of instruction with encoding enc, opcode op in
+ *  map (0 for the 1-byte map), mandatory prefix and ModRM byte at modrm
+ *  (NULL if none).
+ */
+static unsigned
+op_kinds(OpEncoding enc, unsigned map, unsigned op, unsigned prefix,
+         const unsigned char *modrm)
+{
+  bool isMem = modrm != NULL && (*modrm >> 6) != 3;
+  unsigned reg = (modrm == NULL) ? 0 : (*modrm >> 3) & 7;
+  if (enc != ENC_LEGACY) {
+    unsigned kinds = (enc == ENC_EVEX) ? LDE_AVX | LDE_AVX512 : LDE_AVX;
+    if (enc == ENC_VEX && map == 2 && op >= 0xF0) kinds = 0;  //BMI
+    if (isMem) kinds |= is_vex_store(map, op, prefix) ? LDE_STORE : LDE_LOAD;
+    return kinds;
+  }
+  if (map == 0 && 0xD8 <= op && op <= 0xDF) {
+    return LDE_X87 | (!isMem ? 0 : is_x87_store(op, reg) ? LDE_STORE : LDE_LOAD);
+  }
+  if (map == 0) return one_byte_mem_kinds(op, reg, isMem);
+  unsigned kinds = is_sse_op(map, op) ? LDE_SSE : 0;
+  if (isMem) kinds |= escape_mem_kinds(map, op, prefix, reg);
+  return kinds;
+}
+
+/** Return length of x86-64 instruction at p using the tables above,
+ *  < 0 if invalid, and fill in *details.
+ */
+static int
+native_decode(const unsigned char *p, OpDetails *details)
+{
+  const unsigned char *p0 = p;
+  *details = (OpDetails) { .opClass = LDE_OP_OTHER };
+  bool hasModrm = true;   //ModRM, if any, is at p after the switch
+  bool opSize16 = false, addrSize32 = false, rexW = false;
+  unsigned rep = 0;
+  for (;;) {
+    if (is_legacy_prefix(*p)) {
+      if (*p == 0x66) opSize16 = true;
+      else if (*p == 0x67) addrSize32 = true;
+      else if (*p == 0xF2 || *p == 0xF3) rep = *p;
+      rexW = false;
+    }
+    else if ((*p & 0xF0) == 0x40) {
+      rexW = (*p & 0x08) != 0;
+    }
+    else {
+      break;
+    }
+    if (++p - p0 >= MAX_INSN_SIZE) return -1;
+  }
+  unsigned op = *p++;
+  OpEncoding enc = ENC_LEGACY;
+  unsigned opMap = 0, opCode = op;     //for op_kinds()
+  unsigned opPrefix = rep ? rep : opSize16 ? 0x66 : 0;
+  int len;
+  switch (op) {
+  case 0x0F: {
+    unsigned op2 = *p++;
+    opMap = 1;
+    opCode = op2;
+    if (op2 == 0x38) {
+      opMap = 2;
+      opCode = *p++;
+      len = modrm_length(p);
+    }
+    else if (op2 == 0x3A) {
+      opMap = 3;
+      opCode = *p++;
+      len = modrm_length(p) + 1;
+    }
+    else {
+      unsigned flags = OP2_FLAGS[op2];
+      if (flags & F_X) return -1;
+      hasModrm = (flags & F_M) != 0;
+      len = hasModrm ? modrm_length(p) : 0;
+      if (flags & F_I8) len += 1;
+      if (flags & F_IZ) len += (opSize16 && !rexW) ? 2 : 4;
+      if (0x20 <= op2 && op2 <= 0x23) {  //mov cr/dr: ModRM is reg form
+        len = 1;
+        hasModrm = false;
+      }
+      if (op2 == 0x78 && (opSize16 || rep == 0xF2)) len += 2; //extrq/insertq
+      if ((op2 & 0xF0) == 0x80) details->opClass = LDE_OP_JCC;
+    }
+    break;
+  }
+  case 0xC4: case 0xC5: {   //VEX
+    unsigned map = 1;
+    if (op == 0xC4) {
+      map = *p & 0x1F;
+      p += 2;
+    }
+    else {
+      p += 1;
+    }
+    unsigned vop = *p++;
+    enc = ENC_VEX;
+    opMap = map;
+    opCode = vop;
+    opPrefix = VEX_PREFIXES[p[-2] & 3];
+    if (map == 1 && vop == 0x77) {  //vzeroupper/vzeroall
+      hasModrm = false;
+      len = 0;
+    }
+    else {
+      if (map < 1 || map > 3) return -1;
+      len = modrm_length(p) + vex_imm_size(map, vop);
+    }
+    break;
+  }
+  case 0x62: {   //EVEX
+    unsigned map = *p & 0x07;
+    p += 3;
+    unsigned vop = *p++;
+    if (map == 0 || map == 4 || map == 7) return -1;
+    enc = ENC_EVEX;
+    opMap = map;
+    opCode = vop;
+    opPrefix = VEX_PREFIXES[p[-3] & 3];
+    len = modrm_length(p) + vex_imm_size(map, vop);
+    break;
+  }
+  case 0x8F:
+    if ((*p & 0x1F) >= 8) {   //XOP
+      unsigned map = *p & 0x1F;
+      if (map > 0xA) return -1;
+      p += 2;
+      unsigned vop = *p++;
+      enc = ENC_XOP;
+      opMap = map;
+      opCode = vop;
+      len = modrm_length(p) + vex_imm_size(map, vop);
+    }
+    else {
+      len = modrm_length(p);
+    }
+    break;
+  case 0xA0: case 0xA1: case 0xA2: case 0xA3:   //mov with moffs
+    hasModrm = false;
+    len = addrSize32 ? 4 : 8;
+    break;
+  case 0xB8: case 0xB9: case 0xBA: case 0xBB:
+  case 0xBC: case 0xBD: case 0xBE: case 0xBF:
+    hasModrm = false;
+    len = rexW ? 8 : opSize16 ? 2 : 4;
+    break;
+  case 0xF6: case 0xF7:   //group 3: test has an immediate
+    len = modrm_length(p);
+    if (((*p >> 3) & 7) < 2) {
+      len += (op == 0xF6) ? 1 : (opSize16 && !rexW) ? 2 : 4;
+    }
+    break;
+  default: {
+    unsigned flags = OP1_FLAGS[op];
+    if (flags & F_X) return -1;
+    hasModrm = (flags & F_M) != 0;
+    len = hasModrm ? modrm_length(p) : 0;
+    if (flags & F_I8) len += 1;
+    if (flags & F_I16) len += 2;
+    if (flags & F_IZ) len += (opSize16 && !rexW) ? 2 : 4;
+    details->opClass = one_byte_op_class(op, p);
+    break;
+  }
+  }
+  if (hasModrm && (*p & 0xC7) == 0x05) details->ripDisp = p + 1 - p0;
+  details->kinds =
+    op_kinds(enc, opMap, opCode, opPrefix, hasModrm ? p : NULL);
+  len += p - p0;
+  return len > MAX_INSN_SIZE ? -1 : len;
+}
+
+/** Decode the run of straight-line instructions starting at p into
+ *  ops and return their #.  Decoding goes on with the instruction
+ *  following each one, and stops after a ret or unconditional jmp,
+ *  before an instruction starting LDE_BATCH_BYTES or more past p,
+ *  before one extending past end and before an undecodable one; 0 is
+ *  returned if the first instruction is one of the latter.  Gives the
+ *  same results as get_op_kinds() on each instruction, and like it
+ *  caches them.
+ */
+int
+get_op_lengths(const Lde *lde, const unsigned char *p,
+               const unsigned char *end, LdeOps *ops)
+{
+  memset(ops->boundaries, 0, sizeof(ops->boundaries));
+  int n = 0;
+  for (int offset = 0; offset < LDE_BATCH_BYTES && offset < end - p; ) {
+    const unsigned char *q = p + offset;
+    LdeOpClass opClass;
+    unsigned kinds;
+    int len = get_op_kinds(lde, q, &opClass, &kinds);
+    if (len < 0 || len > end - q) break;
+    ops->lengths[n] = len;
+    ops->opClasses[n] = opClass;
+    ops->kinds[n] = kinds;
+    ops->boundaries[offset/64] |= (uint64_t)1 << (offset % 64);
+    n++;
+    offset += len;
+    if (opClass == LDE_OP_RET || opClass == LDE_OP_JMP ||
+        opClass == LDE_OP_JMP_INDIRECT) {
+      break;
+    }
   }
-  return p1 - p;
+  return n;
 }
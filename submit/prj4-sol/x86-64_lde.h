@@ -1,6 +1,8 @@
 #ifndef X86_64_LDE_H_
 #define X86_64_LDE_H_
 
+#include <stdint.h>
+
 //.1
 /** Length decoder for x86-64 instructions. Requires linking with
  *  libcapstone.  See implementation file for details.
@@ -8,9 +10,39 @@
 
 typedef struct LdeImpl Lde;
 
+/** Decoding engine used by an Lde */
+typedef enum {
+  LDE_NATIVE,     /** built-in table-driven decoder */
+  LDE_CAPSTONE,   /** capstone disassembler; slower, used for verification */
+} LdeBackend;
+
+/** Control-flow class of an instruction */
+typedef enum {
+  LDE_OP_OTHER,
+  LDE_OP_CALL,           /** call rel32 */
+  LDE_OP_CALL_INDIRECT,  /** call through register or memory */
+  LDE_OP_RET,            /** near or far ret */
+  LDE_OP_JMP,            /** jmp rel8/rel32 */
+  LDE_OP_JMP_INDIRECT,   /** jmp through register or memory */
+  LDE_OP_JCC,            /** conditional branch, loop or jrcxz */
+} LdeOpClass;
+
+/** Kinds of work done by an instruction, as bits of a mask */
+typedef enum {
+  LDE_LOAD = 0x01,       /** reads memory, including pops */
+  LDE_STORE = 0x02,      /** writes memory, including pushes */
+  LDE_X87 = 0x04,        /** x87 floating point */
+  LDE_SSE = 0x08,        /** SSE or MMX, legacy encoded */
+  LDE_AVX = 0x10,        /** VEX, EVEX or XOP encoded vector */
+  LDE_AVX512 = 0x20,     /** EVEX encoded */
+} LdeOpKind;
+
 /** Return a new x86-64 length decoder */
 Lde *new_lde(void);
 
+/** Return a new x86-64 length decoder which uses backend */
+Lde *new_lde_backend(LdeBackend backend);
+
 /** Free previously created x86-64 length decoder */
 void free_lde(Lde *lde);
 
@@ -18,6 +50,63 @@ void free_lde(Lde *lde);
  *  on error.
  */
 int get_op_length(const Lde *ldeP, const unsigned char *p);
+
+/** Like get_op_length() but returns < 0 for an undecodable
+ *  instruction without reporting an error.
+ */
+int try_op_length(const Lde *ldeP, const unsigned char *p);
+
+/** Return length of instruction at p and set *opClassP to its class.
+ *  Returns < 0 for an undecodable instruction without reporting an
+ *  error.  Results are cached by address in ldeP.
+ */
+int get_op_info(const Lde *ldeP, const unsigned char *p,
+                LdeOpClass *opClassP);
+
+/** Like get_op_info(), but also sets *kindsP to the mask of the
+ *  LdeOpKind's of the instruction.
+ */
+int get_op_kinds(const Lde *ldeP, const unsigned char *p,
+                 LdeOpClass *opClassP, unsigned *kindsP);
+
+/** Bytes of code covered by one get_op_lengths() call */
+enum { LDE_BATCH_BYTES = 256 };
+
+/** Instructions decoded by get_op_lengths() from a run of code: the
+ *  k'th has lengths[k] bytes, class opClasses[k] and LdeOpKind mask
+ *  kinds[k].
+ */
+typedef struct {
+  unsigned char lengths[LDE_BATCH_BYTES];
+  unsigned char opClasses[LDE_BATCH_BYTES];
+  unsigned char kinds[LDE_BATCH_BYTES];
+  /** bit i % 64 of boundaries[i / 64] is set iff an instruction starts
+   *  i bytes into the run */
+  uint64_t boundaries[LDE_BATCH_BYTES/64];
+} LdeOps;
+
+/** Decode the run of straight-line instructions starting at p into
+ *  ops and return their #.  Decoding goes on with the instruction
+ *  following each one, and stops after a ret or unconditional jmp,
+ *  before an instruction starting LDE_BATCH_BYTES or more past p,
+ *  before one extending past end and before an undecodable one; 0 is
+ *  returned if the first instruction is one of the latter.  Gives the
+ *  same results as get_op_kinds() on each instruction, and like it
+ *  caches them.
+ */
+int get_op_lengths(const Lde *ldeP, const unsigned char *p,
+                   const unsigned char *end, LdeOps *ops);
+
+/** Return the offset from p of the 32-bit displacement of the
+ *  RIP-relative memory operand of the instruction at p, 0 if it has
+ *  none.  Returns < 0 for an undecodable instruction.
+ */
+int get_op_rip_disp(const Lde *ldeP, const unsigned char *p);
+
+/** Forget cached decodings of instructions starting in [lo, hi).  Must
+ *  be called before code in that range is unmapped or modified.
+ */
+void lde_invalidate(const Lde *ldeP, const void *lo, const void *hi);
 //.2
 
 #endif //ifndef X86_64_LDE_H_
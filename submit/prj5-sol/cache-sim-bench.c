@@ -0,0 +1,124 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cache-sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/** Microbenchmark for the cache-sim library: measures the cost per
+ *  access of cache_sim_result() and of the batch cache_sim_results()
+ *  for a pseudo-random address stream confined to a working set.
+ */
+
+static void
+usage(const char *program)
+{
+  fprintf(stderr, "usage: %s [-n N_ACCESSES] [-w WORKING_SET_BYTES] "
+          "[-r lru|mru|rand] s-E-b-m\n", program);
+  exit(1);
+}
+
+/** Return count parsed from decimal string s; calls usage() unless s
+ *  is entirely digits.
+ */
+static unsigned long
+get_count(const char *program, const char *s)
+{
+  char *end;
+  unsigned long n = strtoul(s, &end, 10);
+  if (*s < '0' || *s > '9' || *end != '\0') usage(program);
+  return n;
+}
+
+static double
+now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+static CacheSim *
+make_sim(const char *spec, Replacement replacement)
+{
+  CacheParams params = { .replacement = replacement };
+  if (sscanf(spec, "%u-%u-%u-%u", &params.nSetBits, &params.nLinesPerSet,
+             &params.nLineBits, &params.nMemAddrBits) != 4 ||
+      params.nLineBits < 2 ||
+      params.nLineBits + params.nSetBits >= params.nMemAddrBits) {
+    return NULL;
+  }
+  return new_cache_sim(&params);
+}
+
+static void
+out_result(const char *label, double ns, unsigned long n,
+           const CacheSim *sim)
+{
+  unsigned long stats[CACHE_N_STATUS];
+  cache_sim_stats(sim, stats);
+  printf("%-8s %8.2f ns/access; hits %lu/%lu\n", label, ns/n,
+         stats[CACHE_HIT], n);
+}
+
+int
+main(int argc, const char *argv[])
+{
+  const char *program = argv[0];
+  unsigned long n = 10000000UL;
+  unsigned long workingSet = 1UL << 20;
+  Replacement replacement = LRU_R;
+  int i;
+  for (i = 1; i < argc - 1 && argv[i][0] == '-'; i += 2) {
+    if (strcmp(argv[i], "-n") == 0) {
+      n = get_count(program, argv[i + 1]);
+    }
+    else if (strcmp(argv[i], "-w") == 0) {
+      workingSet = get_count(program, argv[i + 1]);
+    }
+    else if (strcmp(argv[i], "-r") == 0) {
+      const char *r = argv[i + 1];
+      if (strcmp(r, "lru") == 0) replacement = LRU_R;
+      else if (strcmp(r, "mru") == 0) replacement = MRU_R;
+      else if (strcmp(r, "rand") == 0) replacement = RANDOM_R;
+      else usage(program);
+    }
+    else {
+      usage(program);
+    }
+  }
+  if (i != argc - 1 || n == 0 || workingSet == 0) usage(program);
+
+  MemAddr *addrs = malloc(n*sizeof(MemAddr));
+  CacheResult *results = malloc(n*sizeof(CacheResult));
+  if (!addrs || !results) {
+    fprintf(stderr, "cannot allocate %lu accesses\n", n);
+    exit(1);
+  }
+  memset(results, 0, n*sizeof(CacheResult)); //fault in pages before timing
+  srand(1);
+  for (unsigned long j = 0; j < n; j++) {
+    addrs[j] = ((MemAddr)rand() << 16 ^ rand()) % workingSet;
+  }
+
+  printf("cache-sim library version %u\n", cache_sim_version());
+
+  CacheSim *sim = make_sim(argv[i], replacement);
+  if (!sim) usage(program);
+  double t0 = now_ns();
+  for (unsigned long j = 0; j < n; j++) cache_sim_result(sim, addrs[j]);
+  out_result("single", now_ns() - t0, n, sim);
+  free_cache_sim(sim);
+
+  sim = make_sim(argv[i], replacement);
+  t0 = now_ns();
+  cache_sim_results(sim, addrs, n, results);
+  out_result("batch", now_ns() - t0, n, sim);
+  free_cache_sim(sim);
+
+  free(addrs);
+  free(results);
+  return 0;
+}
@@ -6,11 +6,11 @@
 #include <stddef.h>
 #include <stdlib.h>
 
-unsigned long get_tag(CacheParams *params, MemAddr addr) {
+static unsigned long get_tag(CacheParams *params, MemAddr addr) {
 	return (addr >> (params->nLineBits + params->nSetBits));
 }
 
-unsigned long get_set(CacheParams *params, MemAddr addr) {
+static unsigned long get_set(CacheParams *params, MemAddr addr) {
 	return (addr >> params->nLineBits) & ((1u << params->nSetBits) - 1);
 }
 
@@ -22,7 +22,7 @@ typedef struct CacheLineImpl {
 	struct CacheLineImpl *prev;
 } CacheLine;
 
-CacheLine *new_cache_line(MemAddr address) {
+static CacheLine *new_cache_line(MemAddr address) {
 	CacheLine *node = malloc(sizeof(CacheLine));
 	node->valid = true;
 	node->address = address;
@@ -38,16 +38,7 @@ typedef struct {
 	unsigned capacity;
 } CacheSet;
 
-CacheSet* new_cache_set(unsigned capacity) {
-	CacheSet* set = malloc(sizeof(CacheSet));
-	set->head = NULL;
-	set->tail = NULL;
-	set->length = 0;
-	set->capacity = capacity;
-	return set;
-}
-
-void add_line(CacheSet* list, MemAddr address) {
+static void add_line(CacheSet* list, MemAddr address) {
 	if (list->length >= list->capacity) {
 		return;
 	}
@@ -63,7 +54,7 @@ void add_line(CacheSet* list, MemAddr address) {
 }
 
 // Returns address of replaced line; -1 on error
-MemAddr replace_line(CacheSet *set, CacheParams *params, MemAddr addr) {
+static MemAddr replace_line(CacheSet *set, CacheParams *params, MemAddr addr) {
 	MemAddr replaced = -1;
 	switch (params->replacement) {
 	case LRU_R: {
@@ -104,6 +95,8 @@ MemAddr replace_line(CacheSet *set, CacheParams *params, MemAddr addr) {
 				temp2->next = temp->next;
 				if (temp->prev != NULL) temp->prev->next = temp2;
 				if (temp->next != NULL) temp->next->prev = temp2;
+				if (set->head == temp) set->head = temp2;
+				if (set->tail == temp) set->tail = temp2;
 
 				replaced = temp->address;
 				if (temp != NULL) free(temp);
@@ -117,7 +110,7 @@ MemAddr replace_line(CacheSet *set, CacheParams *params, MemAddr addr) {
 	return replaced;
 }
 
-bool contains_tag(CacheSet *set, MemAddr addr, CacheParams *params) {
+static bool contains_tag(CacheSet *set, MemAddr addr, CacheParams *params) {
 	unsigned long tag = get_tag(params, addr);
 	bool flag = false;
 
@@ -160,7 +153,7 @@ bool contains_tag(CacheSet *set, MemAddr addr, CacheParams *params) {
 	return flag;
 }
 
-void free_cache_set(CacheSet *set) {
+static void free_cache_set(CacheSet *set) {
 	if (set == NULL) return;
 	CacheLine *node = set->head;
 	while (node != NULL) {
@@ -175,6 +168,7 @@ struct CacheSimImpl {
 	CacheSet* sets;
 	unsigned nSets;
 	CacheParams params;
+	unsigned long stats[CACHE_N_STATUS];
 };
 
 /** Create and return a new cache-simulation structure for a
@@ -188,6 +182,7 @@ new_cache_sim(const CacheParams *params)
 	sim->params = *params;
 	sim->nSets = (1u << params->nSetBits);
 	sim->sets = calloc(sim->nSets, sizeof(CacheSet));
+	for (int i = 0; i < CACHE_N_STATUS; i++) sim->stats[i] = 0;
 
 	for (int i = 0; i < sim->nSets; i++) {
 		sim->sets[i].head = NULL;
@@ -228,6 +223,37 @@ cache_sim_result(CacheSim *cache, MemAddr addr)
 			add_line(&cache->sets[set], addr);
 		}
 	}
+	cache->stats[result.status]++;
 
   	return result;
 }
+
+/** Request each of addrs[0..n-1] in order.  If results is not NULL,
+ *  results[i] is set to the result for addrs[i].
+ */
+void
+cache_sim_results(CacheSim *cache, const MemAddr addrs[], unsigned long n,
+                  CacheResult results[])
+{
+	if (results == NULL) {
+		for (unsigned long i = 0; i < n; i++) cache_sim_result(cache, addrs[i]);
+	} else {
+		for (unsigned long i = 0; i < n; i++) {
+			results[i] = cache_sim_result(cache, addrs[i]);
+		}
+	}
+}
+
+/** Copy # of requests so far with each CacheStatus into stats[] */
+void
+cache_sim_stats(const CacheSim *cache, unsigned long stats[CACHE_N_STATUS])
+{
+	for (int i = 0; i < CACHE_N_STATUS; i++) stats[i] = cache->stats[i];
+}
+
+/** Return CACHE_SIM_VERSION of the library actually loaded */
+unsigned
+cache_sim_version(void)
+{
+	return CACHE_SIM_VERSION;
+}
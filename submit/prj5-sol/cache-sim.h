@@ -1,6 +1,17 @@
 #ifndef CACHE_SIM_
 #define CACHE_SIM_
 
+/** Library version: major*10000 + minor*100 + patch.  The major
+ *  version is the shared-library soname version and changes only when
+ *  the ABI below changes incompatibly.
+ */
+#define CACHE_SIM_VERSION_MAJOR 1
+#define CACHE_SIM_VERSION_MINOR 0
+#define CACHE_SIM_VERSION_PATCH 0
+#define CACHE_SIM_VERSION \
+  (CACHE_SIM_VERSION_MAJOR*10000 + CACHE_SIM_VERSION_MINOR*100 + \
+   CACHE_SIM_VERSION_PATCH)
+
 /** Opaque implementation */
 typedef struct CacheSimImpl CacheSim;
 
@@ -52,4 +63,17 @@ typedef struct {
 /** Return result for requesting addr from cache */
 CacheResult cache_sim_result(CacheSim *cache, MemAddr addr);
 
+/** Request each of addrs[0..n-1] in order.  If results is not NULL,
+ *  results[i] is set to the result for addrs[i].
+ */
+void cache_sim_results(CacheSim *cache, const MemAddr addrs[], unsigned long n,
+                       CacheResult results[]);
+
+/** Copy # of requests so far with each CacheStatus into stats[] */
+void cache_sim_stats(const CacheSim *cache,
+                     unsigned long stats[CACHE_N_STATUS]);
+
+/** Return CACHE_SIM_VERSION of the library actually loaded */
+unsigned cache_sim_version(void);
+
 #endif //ifndef CACHE_SIM_
@@ -8,13 +8,16 @@
 static void
 usage(const char *program, const char *msg)
 {
-  fprintf(stderr, "%susage: %s [-r lru|mru|rand] [-s seed] [-v] s-E-b-m\n"
+  fprintf(stderr, "%susage: %s [-r lru|mru|rand] [-s seed] [-v] "
+          "[-i N [-w]] s-E-b-m\n"
           "where s-E-b-m specified cache parameters:\n"
           "  s: # of bits in address used to specify set\n"
           "  E: # of cache lines per set\n"
           "  b: # of bits in address used to specify offset in cache line\n"
           "  m: total # of bits used to address primary memory\n"
-          "  must have all non-negative and 2 <= b and b + s < m\n",
+          "  must have all non-negative and 2 <= b and b + s < m\n"
+          "-i N outputs hit/miss/replace counts after every N accesses;\n"
+          "-w adds # of distinct cache lines touched in each interval\n",
           msg, program);
     exit(1);
 }
@@ -43,11 +46,12 @@ get_replacement(const char *name) {
 
 /** Somewhat non-elegant allocation here to force new_cache_sim() to
  *  make copies of *params.  Sets *nMemAddrBitsP which is used for
- *  verbose formatting in do_cache_sim().  Returns NULL on error.
+ *  verbose formatting in do_cache_sim() and *nLineBitsP which is used
+ *  for working-set tracking.  Returns NULL on error.
  */
 static CacheSim *
 make_cache_sim(const char *paramsSpec, Replacement replacement,
-               unsigned *nMemAddrBitsP)
+               unsigned *nMemAddrBitsP, unsigned *nLineBitsP)
 {
   CacheParams params;
   params.replacement = replacement;
@@ -65,6 +69,7 @@ make_cache_sim(const char *paramsSpec, Replacement replacement,
     *fieldsP[i] = v;
   }
   *nMemAddrBitsP = params.nMemAddrBits;
+  *nLineBitsP = params.nLineBits;
   return (*p == '\0') && (i == 4) && (params.nLineBits >= 2) &&
          (params.nLineBits + params.nSetBits < params.nMemAddrBits)
          ? new_cache_sim(&params)
@@ -96,17 +101,135 @@ static const char *STATUS_STRS[] = {
   "hit", "miss-without-replace", "miss-with-replace"
 };
 
+/** Set of cache lines touched during the current interval.  Open
+ *  addressing; a slot is occupied only if its gen matches the current
+ *  interval number, so starting a new interval is just gen++ rather
+ *  than clearing the table.  The table is doubled whenever it becomes
+ *  more than half full, so its size follows the # of distinct lines
+ *  rather than the interval size.
+ */
+typedef struct {
+  MemAddr line;
+  unsigned long gen;
+} LineSlot;
+
+typedef struct {
+  unsigned long size;                   /** # of accesses per interval */
+  unsigned long nAccesses;              /** # of accesses in interval */
+  unsigned long stats[CACHE_N_STATUS];  /** per-interval status counts */
+  unsigned long nLines;                 /** # of distinct lines touched */
+  unsigned nLineBits;
+  unsigned long gen;                    /** current interval # + 1 */
+  unsigned long mask;                   /** # of slots - 1; 0 if no wss */
+  LineSlot *slots;
+} IntervalStats;
+
+enum { INIT_LINE_SLOTS = 64 };
+
+/** Return a zeroed table of nSlots LineSlot's, exiting on failure */
+static LineSlot *
+new_line_slots(unsigned long nSlots)
+{
+  LineSlot *slots = calloc(nSlots, sizeof(LineSlot));
+  if (!slots) {
+    fprintf(stderr, "cannot allocate working-set table\n");
+    exit(1);
+  }
+  return slots;
+}
+
+static void
+init_interval_stats(IntervalStats *interval, unsigned long size,
+                    bool isWorkingSet, unsigned nLineBits)
+{
+  *interval = (IntervalStats) { .size = size, .nLineBits = nLineBits,
+                                .gen = 1 };
+  if (size > 0 && isWorkingSet) {
+    interval->slots = new_line_slots(INIT_LINE_SLOTS);
+    interval->mask = INIT_LINE_SLOTS - 1;
+  }
+}
+
+/** Return the slot holding line in the working-set table of interval,
+ *  or the free slot where it is to be added.
+ */
+static inline LineSlot *
+find_line_slot(const IntervalStats *interval, MemAddr line)
+{
+  unsigned long i = (line * 0x9E3779B97F4A7C15UL) >> 17;
+  for (i &= interval->mask; ; i = (i + 1) & interval->mask) {
+    LineSlot *slot = &interval->slots[i];
+    if (slot->gen != interval->gen || slot->line == line) return slot;
+  }
+}
+
+/** Double the working-set table of interval, keeping the lines of the
+ *  current interval.
+ */
+static void
+grow_line_slots(IntervalStats *interval)
+{
+  LineSlot *old = interval->slots;
+  unsigned long nOld = interval->mask + 1;
+  interval->slots = new_line_slots(2*nOld);
+  interval->mask = 2*nOld - 1;
+  for (unsigned long i = 0; i < nOld; i++) {
+    if (old[i].gen == interval->gen) {
+      *find_line_slot(interval, old[i].line) = old[i];
+    }
+  }
+  free(old);
+}
+
+static inline void
+track_line(IntervalStats *interval, MemAddr addr)
+{
+  MemAddr line = addr >> interval->nLineBits;
+  LineSlot *slot = find_line_slot(interval, line);
+  if (slot->gen == interval->gen) return;
+  slot->line = line;
+  slot->gen = interval->gen;
+  //keep load factor <= 1/2
+  if (2*++interval->nLines > interval->mask + 1) grow_line_slots(interval);
+}
+
+static void
+out_interval_header(const IntervalStats *interval, FILE *out)
+{
+  fprintf(out, "# accesses hits misses-without-replace "
+          "misses-with-replace%s\n", interval->slots ? " lines" : "");
+}
+
+/** Output one line for the interval ending at access # nTotal, then
+ *  reset interval counters.
+ */
+static void
+out_interval(IntervalStats *interval, unsigned long nTotal, FILE *out)
+{
+  const unsigned long *stats = interval->stats;
+  fprintf(out, "%lu %lu %lu %lu", nTotal, stats[CACHE_HIT],
+          stats[CACHE_MISS_WITHOUT_REPLACE], stats[CACHE_MISS_WITH_REPLACE]);
+  if (interval->slots) fprintf(out, " %lu", interval->nLines);
+  fprintf(out, "\n");
+  for (int i = 0; i < CACHE_N_STATUS; i++) interval->stats[i] = 0;
+  interval->nAccesses = interval->nLines = 0;
+  interval->gen++;
+}
+
 static void
 do_cache_sim(CacheSim *cache, bool isVerbose, unsigned nMemAddrBits,
-             FILE *in, FILE *out)
+             IntervalStats *interval, FILE *in, FILE *out)
 {
   unsigned long stats[] = { 0UL, 0UL, 0UL };
+  unsigned long nTotal = 0UL;
   unsigned addrWidth = (nMemAddrBits + 3)/4;
+  if (interval->size > 0) out_interval_header(interval, out);
   while (1) {
     MemAddr addr;
     if (fscanf(in, "%lx", &addr) != 1) break;
     CacheResult result = cache_sim_result(cache, addr);
     stats[result.status]++;
+    nTotal++;
     if (isVerbose) {
       fprintf(out, "%0*lx: %s", addrWidth, addr, STATUS_STRS[result.status]);
       if (result.status == CACHE_MISS_WITH_REPLACE) {
@@ -114,11 +237,16 @@ do_cache_sim(CacheSim *cache, bool isVerbose, unsigned nMemAddrBits,
       }
       fprintf(out, "\n");
     }
+    //after the access's own verbose line, so that the output is in order
+    if (interval->size > 0) {
+      interval->stats[result.status]++;
+      if (interval->slots) track_line(interval, addr);
+      if (++interval->nAccesses == interval->size) {
+        out_interval(interval, nTotal, out);
+      }
+    }
   } // while (1)
-  unsigned long nTotal = 0UL;
-  for (int i = 0; i < CACHE_N_STATUS; i++) {
-    nTotal += stats[i];
-  }
+  if (interval->nAccesses > 0) out_interval(interval, nTotal, out);
   out_cache_stats(stats, nTotal, out);
 }
 
@@ -128,8 +256,10 @@ main(int argc, const char *argv[])
   const char *program = argv[0];
   if (argc <= 1) usage(program, "");
   bool isVerbose = false;
+  bool isWorkingSet = false;
   int replacement = LRU_R;
   int seed = 0;
+  long intervalSize = 0;
   int i;
   for (i = 1; i < argc && argv[i][0] == '-'; i++) {
     if (strcmp(argv[i], "-v") == 0) {
@@ -144,6 +274,19 @@ main(int argc, const char *argv[])
         usage(program, "replacement must be lru|mru|rand\n");
       }
     }
+    else if (strcmp(argv[i], "-i") == 0) {
+      if (i >= argc - 1) {
+        usage(program, "-i requires interval size additional argument\n");
+      }
+      char *p;
+      intervalSize = strtol(argv[++i], &p, 10);
+      if (intervalSize <= 0 || *p != '\0') {
+        usage(program, "interval size must be a positive integer\n");
+      }
+    }
+    else if (strcmp(argv[i], "-w") == 0) {
+      isWorkingSet = true;
+    }
     else if (strcmp(argv[i], "-s") == 0) {
       if (i >= argc - 1) {
         usage(program, "-s requires seed additional argument\n");
@@ -161,14 +304,21 @@ main(int argc, const char *argv[])
   if (i != argc - 1) {
     usage(program, "cache spec s-E-b-m required\n");
   }
+  if (isWorkingSet && intervalSize == 0) {
+    usage(program, "-w requires -i\n");
+  }
 
   srand(seed);
   const char *paramsSpec = argv[i];
 
-  unsigned nMemAddrBits;
-  CacheSim *cacheSim = make_cache_sim(paramsSpec, replacement, &nMemAddrBits);
+  unsigned nMemAddrBits, nLineBits;
+  CacheSim *cacheSim =
+    make_cache_sim(paramsSpec, replacement, &nMemAddrBits, &nLineBits);
   if (!cacheSim) usage(program, "invalid cache params\n");
-  do_cache_sim(cacheSim, isVerbose, nMemAddrBits, stdin, stdout);
+  IntervalStats interval;
+  init_interval_stats(&interval, intervalSize, isWorkingSet, nLineBits);
+  do_cache_sim(cacheSim, isVerbose, nMemAddrBits, &interval, stdin, stdout);
+  free(interval.slots);
   free_cache_sim(cacheSim);
   return 0;
 